@@ -22,6 +22,7 @@
 #define BWT_T
 
 #include "configuration.hpp"
+#include "parallel.hpp"
 
 using namespace std;
 
@@ -61,14 +62,8 @@ namespace ring_ltj {
             m_C_select0.set_vector(&m_C);
         }
 
-    public:
-
-        bwt() = default;
-
-        bwt(const int_vector<> &L, const vector<uint64_t> &C) {
-            //Building the wavelet matrix
-            construct_im(m_L, L);
-            //Building C and its rank and select structures
+        //Building C and its rank and select structures
+        void build_C(const vector<uint64_t> &C){
             m_C = c_type(C[C.size() - 1] + 1 + C.size(), 0);
             for (uint64_t i = 0; i < C.size(); i++) {
                 m_C[C[i] + i] = 1;
@@ -78,6 +73,22 @@ namespace ring_ltj {
             util::init_support(m_C_select0, &m_C);
         }
 
+    public:
+
+        bwt() = default;
+
+        bwt(const int_vector<> &L, const vector<uint64_t> &C) {
+            //Building the wavelet matrix (it may be built at the same time as other columns)
+            parallel::construct_im(m_L, L);
+            build_C(C);
+        }
+
+        //The column L is read from disk
+        bwt(int_vector_buffer<> &L, const vector<uint64_t> &C) {
+            m_L = wm_type(L, L.size());
+            build_C(C);
+        }
+
 
         //! Copy constructor
         bwt(const bwt &o) {
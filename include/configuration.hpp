@@ -37,6 +37,9 @@ typedef std::tuple<uint32_t, uint32_t, uint32_t> spo_triple;
 typedef struct {
     uint64_t id;
     uint64_t k;
+    //Distance (0 if unknown). It takes 8 of the 24 bytes of an item while the graph is read, also
+    //without distances; the index only stores them (quantized) if some of them is not 0.
+    double d;
 } knn_item_type;
 typedef std::vector<std::vector<knn_item_type>> knn_graph_type;
 enum descriptor_type {s, p, o, sim};
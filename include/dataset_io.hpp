@@ -0,0 +1,400 @@
+/*
+ * dataset_io.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_DATASET_IO_HPP
+#define RING_DATASET_IO_HPP
+
+#include <configuration.hpp>
+#include <parallel.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+
+namespace ring_ltj {
+
+    /**
+     * Input formats of the builders.
+     *
+     * Text (the original one):
+     *   - <dataset>.dat:          a triple "s p o" by line
+     *   - <dataset>-knn-dir.dat:  a line by node with the ids of its neighbours sorted by k
+     *   - <dataset>-knn-dist.dat: (optional) a line by node with the distances to its neighbours, in the
+     *                             same order as <dataset>-knn-dir.dat, so they are non-decreasing
+     *
+     * Binary (fixed width, little endian):
+     *   - <dataset>-triples.bin:  magic, n and n triples of three uint32_t
+     *   - <dataset>-knn-dir.bin:  magic, nodes, max_k and nodes*max_k uint32_t (the list of node i is at
+     *                             [i*max_k, (i+1)*max_k), the id of its k-th neighbour at position k-1 and
+     *                             0 if it has no k-th neighbour)
+     */
+    namespace dataset_io {
+
+        typedef uint64_t size_type;
+
+        const uint64_t triples_magic = 0x52494E4754524950ULL; //"RINGTRIP"
+        const uint64_t knn_magic = 0x52494E474B4E4E47ULL;     //"RINGKNNG"
+
+        //Reads the whole file into memory
+        inline bool read_file(const std::string &file, std::string &content){
+            std::ifstream in(file, std::ios::binary);
+            if(!in) return false;
+            in.seekg(0, std::ios::end);
+            content.resize(in.tellg());
+            in.seekg(0, std::ios::beg);
+            in.read(&content[0], content.size());
+            return true;
+        }
+
+        //Splits [0, size) into n chunks whose boundaries are right after a new line
+        inline std::vector<size_type> split_lines(const std::string &content, const size_type n){
+            std::vector<size_type> bounds(1, 0);
+            for(size_type i = 1; i < n; ++i){
+                size_type pos = std::max(bounds.back(), content.size() * i / n);
+                while(pos < content.size() && content[pos] != '\n') ++pos;
+                if(pos < content.size()) ++pos;
+                bounds.push_back(pos);
+            }
+            bounds.push_back(content.size());
+            return bounds;
+        }
+
+        //Parses the next unsigned integer of the line; returns false at the end of the line
+        inline bool next_uint(const char* &ptr, const char* end, uint64_t &value){
+            while(ptr < end && *ptr != '\n' && (*ptr < '0' || *ptr > '9')) ++ptr;
+            if(ptr == end || *ptr == '\n') return false;
+            value = 0;
+            while(ptr < end && *ptr >= '0' && *ptr <= '9'){
+                value = value * 10 + (*ptr - '0');
+                ++ptr;
+            }
+            return true;
+        }
+
+        //Parses the next real number of the line; returns false at the end of the line
+        inline bool next_double(const char* &ptr, const char* end, double &value){
+            while(ptr < end && *ptr != '\n' && (*ptr == ' ' || *ptr == '\t' || *ptr == '\r' || *ptr == ',')) ++ptr;
+            if(ptr == end || *ptr == '\n') return false;
+            char* next;
+            value = std::strtod(ptr, &next);
+            if(next == ptr) return false;
+            ptr = next;
+            return true;
+        }
+
+        inline bool file_exists(const std::string &file){
+            std::ifstream in(file);
+            return in.good();
+        }
+
+        /******** Triples *******/
+
+        /**
+         * Parses a text file of triples with several threads.
+         *
+         * @param file      Text file with a triple "s p o" by line
+         * @param D         Triples
+         * @param threads   Number of threads
+         */
+        inline bool read_triples_text(const std::string &file, std::vector<spo_triple> &D, const size_type threads = 1){
+            std::string content;
+            if(!read_file(file, content)) return false;
+            size_type n_chunks = std::max<size_type>(1, threads);
+            auto bounds = split_lines(content, n_chunks);
+            std::vector<std::vector<spo_triple>> chunks(n_chunks);
+            parallel::for_each(n_chunks, threads, [&](size_type c, size_type){
+                const char* ptr = content.data() + bounds[c];
+                const char* end = content.data() + bounds[c+1];
+                uint64_t t[3];
+                while(ptr < end){
+                    if(next_uint(ptr, end, t[0]) && next_uint(ptr, end, t[1]) && next_uint(ptr, end, t[2])){
+                        chunks[c].emplace_back(spo_triple(t[0], t[1], t[2]));
+                    }
+                    //Next line
+                    while(ptr < end && *ptr != '\n') ++ptr;
+                    ++ptr;
+                }
+            });
+            std::string().swap(content);
+            size_type n = 0;
+            for(const auto &chunk : chunks) n += chunk.size();
+            D.clear();
+            D.reserve(n);
+            for(auto &chunk : chunks){
+                D.insert(D.end(), chunk.begin(), chunk.end());
+                std::vector<spo_triple>().swap(chunk);
+            }
+            return true;
+        }
+
+        inline bool write_triples_binary(const std::string &file, const std::vector<spo_triple> &D){
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            if(!out) return false;
+            uint64_t n = D.size();
+            out.write((const char*) &triples_magic, sizeof(triples_magic));
+            out.write((const char*) &n, sizeof(n));
+            std::vector<uint32_t> buffer;
+            buffer.reserve(3 * 1024 * 1024);
+            for(size_type i = 0; i < n; ++i){
+                buffer.push_back(std::get<0>(D[i]));
+                buffer.push_back(std::get<1>(D[i]));
+                buffer.push_back(std::get<2>(D[i]));
+                if(buffer.size() == buffer.capacity() || i+1 == n){
+                    out.write((const char*) buffer.data(), buffer.size() * sizeof(uint32_t));
+                    buffer.clear();
+                }
+            }
+            return out.good();
+        }
+
+        inline bool read_triples_binary(const std::string &file, std::vector<spo_triple> &D){
+            std::ifstream in(file, std::ios::binary);
+            if(!in) return false;
+            uint64_t magic = 0, n = 0;
+            in.read((char*) &magic, sizeof(magic));
+            if(magic != triples_magic) return false;
+            in.read((char*) &n, sizeof(n));
+            std::vector<uint32_t> values(3*n);
+            in.read((char*) values.data(), values.size() * sizeof(uint32_t));
+            if(!in) return false;
+            D.clear();
+            D.reserve(n);
+            for(size_type i = 0; i < n; ++i){
+                D.emplace_back(spo_triple(values[3*i], values[3*i+1], values[3*i+2]));
+            }
+            return true;
+        }
+
+        /**
+         * Reads the triples of a file one by one without keeping them in memory. The file can be binary
+         * (it starts with triples_magic) or text.
+         *
+         * @param file  File of triples
+         * @param f     Function called as f(s, p, o) for every triple
+         * @return      False if the file cannot be read
+         */
+        template<class Function>
+        inline bool scan_triples(const std::string &file, Function f){
+            std::ifstream in(file, std::ios::binary);
+            if(!in) return false;
+            uint64_t magic = 0, n = 0;
+            in.read((char*) &magic, sizeof(magic));
+            if(in && magic == triples_magic){
+                in.read((char*) &n, sizeof(n));
+                std::vector<uint32_t> block;
+                while(n > 0 && in){
+                    size_type m = std::min<size_type>(n, 1024 * 1024);
+                    block.resize(3 * m);
+                    in.read((char*) block.data(), block.size() * sizeof(uint32_t));
+                    if(!in) return false;
+                    for(size_type i = 0; i < m; ++i){
+                        f(block[3*i], block[3*i+1], block[3*i+2]);
+                    }
+                    n -= m;
+                }
+                return n == 0;
+            }
+            in.clear();
+            in.seekg(0, std::ios::beg);
+            uint64_t s, p, o;
+            while(in >> s >> p >> o){
+                f(s, p, o);
+            }
+            return true;
+        }
+
+        /******** KNN graph *******/
+
+        /**
+         * Parses the text file of a KNN graph with several threads.
+         *
+         * @param file      Text file with the neighbours of a node by line
+         * @param g         KNN graph
+         * @param threads   Number of threads
+         * @return          Maximum k (0 if the file cannot be read)
+         */
+        inline size_type read_knn_text(const std::string &file, knn_graph_type &g, const size_type threads = 1){
+            std::string content;
+            if(!read_file(file, content)) return 0;
+            size_type n_chunks = std::max<size_type>(1, threads);
+            auto bounds = split_lines(content, n_chunks);
+            std::vector<knn_graph_type> chunks(n_chunks);
+            std::vector<size_type> max_ks(n_chunks, 0);
+            parallel::for_each(n_chunks, threads, [&](size_type c, size_type){
+                const char* ptr = content.data() + bounds[c];
+                const char* end = content.data() + bounds[c+1];
+                uint64_t id;
+                while(ptr < end){
+                    std::vector<knn_item_type> list;
+                    while(next_uint(ptr, end, id)){
+                        knn_item_type item{id, list.size()+1, 0};
+                        list.emplace_back(item);
+                    }
+                    if(list.size() > max_ks[c]) max_ks[c] = list.size();
+                    chunks[c].emplace_back(std::move(list));
+                    ++ptr; //Skip the new line
+                }
+            });
+            std::string().swap(content);
+            size_type max_k = 0;
+            g.clear();
+            for(size_type c = 0; c < n_chunks; ++c){
+                max_k = std::max(max_k, max_ks[c]);
+                for(auto &list : chunks[c]){
+                    g.emplace_back(std::move(list));
+                }
+                knn_graph_type().swap(chunks[c]);
+            }
+            return max_k;
+        }
+
+        inline bool write_knn_binary(const std::string &file, const knn_graph_type &g, const size_type max_k){
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            if(!out) return false;
+            uint64_t nodes = g.size();
+            out.write((const char*) &knn_magic, sizeof(knn_magic));
+            out.write((const char*) &nodes, sizeof(nodes));
+            out.write((const char*) &max_k, sizeof(max_k));
+            std::vector<uint32_t> row(max_k);
+            for(const auto &list : g){
+                std::fill(row.begin(), row.end(), 0);
+                for(const auto &item : list){
+                    row[item.k-1] = item.id;
+                }
+                out.write((const char*) row.data(), row.size() * sizeof(uint32_t));
+            }
+            return out.good();
+        }
+
+        /**
+         *
+         * @param file  Binary file of a KNN graph
+         * @param g     KNN graph
+         * @return      Maximum k (0 if the file cannot be read)
+         */
+        inline size_type read_knn_binary(const std::string &file, knn_graph_type &g){
+            std::ifstream in(file, std::ios::binary);
+            if(!in) return 0;
+            uint64_t magic = 0, nodes = 0, max_k = 0;
+            in.read((char*) &magic, sizeof(magic));
+            if(magic != knn_magic) return 0;
+            in.read((char*) &nodes, sizeof(nodes));
+            in.read((char*) &max_k, sizeof(max_k));
+            g.clear();
+            g.reserve(nodes);
+            std::vector<uint32_t> row(max_k);
+            for(size_type i = 0; i < nodes; ++i){
+                in.read((char*) row.data(), row.size() * sizeof(uint32_t));
+                std::vector<knn_item_type> list;
+                for(size_type k = 0; k < max_k; ++k){
+                    if(row[k] != 0){
+                        knn_item_type item{row[k], k+1, 0};
+                        list.emplace_back(item);
+                    }
+                }
+                g.emplace_back(std::move(list));
+            }
+            if(!in) return 0;
+            return max_k;
+        }
+
+        /**
+         * Parses the distances of a KNN graph with several threads.
+         *
+         * @param file      Text file with the distances to the neighbours of a node by line
+         * @param g         KNN graph, the distance of each item is set
+         * @param threads   Number of threads
+         * @return          False if the file cannot be read, does not match g or a list is not sorted
+         *                  (knn_graph_cds::k_within searches the distances of a node with a binary search)
+         */
+        inline bool read_knn_dist_text(const std::string &file, knn_graph_type &g, const size_type threads = 1){
+            std::string content;
+            if(!read_file(file, content)) return false;
+            size_type n_chunks = std::max<size_type>(1, threads);
+            auto bounds = split_lines(content, n_chunks);
+            std::vector<std::vector<std::vector<double>>> chunks(n_chunks);
+            parallel::for_each(n_chunks, threads, [&](size_type c, size_type){
+                const char* ptr = content.data() + bounds[c];
+                const char* end = content.data() + bounds[c+1];
+                double d;
+                while(ptr < end){
+                    std::vector<double> list;
+                    while(next_double(ptr, end, d)){
+                        list.push_back(d);
+                    }
+                    chunks[c].emplace_back(std::move(list));
+                    while(ptr < end && *ptr != '\n') ++ptr;
+                    ++ptr; //Skip the new line
+                }
+            });
+            std::string().swap(content);
+            size_type i = 0;
+            for(auto &chunk : chunks){
+                for(auto &list : chunk){
+                    if(i == g.size() || list.size() != g[i].size()) return false;
+                    if(!std::is_sorted(list.begin(), list.end())) return false;
+                    for(size_type j = 0; j < list.size(); ++j){
+                        g[i][j].d = list[j];
+                    }
+                    ++i;
+                }
+            }
+            return i == g.size();
+        }
+
+        /******** Datasets *******/
+
+        //<dataset>-triples.bin if it exists or <dataset>.dat otherwise
+        inline std::string triples_file(const std::string &dataset){
+            std::string bin = dataset + "-triples.bin";
+            return file_exists(bin) ? bin : dataset + ".dat";
+        }
+
+        //Reads <dataset>-triples.bin if it exists or <dataset>.dat otherwise
+        inline bool read_triples(const std::string &dataset, std::vector<spo_triple> &D, const size_type threads = 1){
+            std::string bin = dataset + "-triples.bin";
+            if(file_exists(bin)) return read_triples_binary(bin, D);
+            return read_triples_text(dataset + ".dat", D, threads);
+        }
+
+        //Reads <dataset>-knn-dir.bin if it exists or <dataset>-knn-dir.dat otherwise, and the distances of
+        //<dataset>-knn-dist.dat if it exists
+        inline size_type read_knn(const std::string &dataset, knn_graph_type &g, const size_type threads = 1){
+            std::string bin = dataset + "-knn-dir.bin";
+            size_type max_k;
+            if(file_exists(bin)){
+                max_k = read_knn_binary(bin, g);
+            }else{
+                max_k = read_knn_text(dataset + "-knn-dir.dat", g, threads);
+            }
+            std::string dist = dataset + "-knn-dist.dat";
+            if(max_k > 0 && file_exists(dist) && !read_knn_dist_text(dist, g, threads)){
+                //Without all the distances the graph is indexed without them
+                for(auto &list : g){
+                    for(auto &item : list) item.d = 0;
+                }
+            }
+            return max_k;
+        }
+    }
+}
+
+#endif //RING_DATASET_IO_HPP
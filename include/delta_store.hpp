@@ -0,0 +1,399 @@
+/*
+ * delta_store.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_DELTA_STORE_HPP
+#define RING_DELTA_STORE_HPP
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <cmath>
+
+namespace ring_ltj {
+
+    /**
+     * Triples inserted into and deleted from an index after it was built. The triples of the queries are
+     * the ones of the index plus the inserted ones minus the deleted ones (tombstones). The inserted
+     * triples are never in the index and the deleted ones always are, so both sets are disjoint and a
+     * triple that is inserted and then deleted (or the other way round) just leaves the delta.
+     *
+     * Each set keeps its triples sorted in the six orders of the terms, so the values of a term after
+     * binding any of the other two are a range of one of them (as the ring does with its three BWTs).
+     * The delta is meant to be small, it is merged into the index when it grows (see ring_dynamic).
+     *
+     * A copy of the delta shares the bulk of its triples with the original (see layered_set), so the
+     * writers can copy it on every update and leave the queries with the triples they started with.
+     */
+    class delta_store {
+
+    public:
+        typedef uint64_t size_type;
+        typedef uint64_t value_type;
+        typedef std::array<value_type, 3> triple_type; //subject, predicate and object
+
+        //Terms of a triple
+        static const uint8_t subject = 0, predicate = 1, object = 2;
+
+        //Terms bound to a value
+        struct bound_type {
+            uint8_t mask = 0;
+            triple_type values{{0, 0, 0}};
+
+            inline void bind(const uint8_t term, const value_type v){
+                mask |= (1 << term);
+                values[term] = v;
+            }
+
+            inline void unbind(const uint8_t term){
+                mask &= ~(1 << term);
+                values[term] = 0;
+            }
+
+            inline bool is_bound(const uint8_t term) const {
+                return mask & (1 << term);
+            }
+
+            inline size_type size() const {
+                return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1);
+            }
+        };
+
+    private:
+
+        //Orders of the terms: any set of bound terms followed by any other term is a prefix of one of them
+        static inline const std::array<uint8_t, 3>& order(const size_type i){
+            static const std::array<uint8_t, 3> orders[6] = {{{0, 1, 2}}, {{0, 2, 1}}, {{1, 0, 2}},
+                                                             {{1, 2, 0}}, {{2, 0, 1}}, {{2, 1, 0}}};
+            return orders[i];
+        }
+
+        //Order whose prefix are the bound terms followed by target (target = 3 for any order)
+        static size_type order_of(const bound_type &bound, const uint8_t target){
+            size_type n = bound.size();
+            for(size_type i = 0; i < 6; ++i){
+                const auto &ord = order(i);
+                bool ok = true;
+                for(size_type j = 0; j < n && ok; ++j){
+                    ok = bound.is_bound(ord[j]);
+                }
+                if(ok && (target > 2 || (n < 3 && ord[n] == target))) return i;
+            }
+            return 0;
+        }
+
+        static inline triple_type permute(const triple_type &t, const size_type i){
+            const auto &ord = order(i);
+            return triple_type{{t[ord[0]], t[ord[1]], t[ord[2]]}};
+        }
+
+        //Triples sorted in every order, the first one is SPO
+        class set_type {
+
+        private:
+            std::array<std::vector<triple_type>, 6> m_sorted;
+
+            static inline bool less_prefix(const triple_type &a, const triple_type &b, const size_type n){
+                for(size_type j = 0; j < n; ++j){
+                    if(a[j] != b[j]) return a[j] < b[j];
+                }
+                return false;
+            }
+
+        public:
+            set_type() = default;
+
+            //Triples sorted in SPO without repetitions
+            explicit set_type(const std::vector<triple_type> &spo){
+                for(size_type i = 0; i < 6; ++i){
+                    auto &v = m_sorted[i];
+                    v.reserve(spo.size());
+                    for(const auto &t : spo){
+                        v.push_back(permute(t, i));
+                    }
+                    if(i > 0) std::sort(v.begin(), v.end());
+                }
+            }
+
+            inline size_type size() const {
+                return m_sorted[0].size();
+            }
+
+            inline const std::vector<triple_type>& spo() const {
+                return m_sorted[0];
+            }
+
+            inline bool contains(const triple_type &t) const {
+                return std::binary_search(m_sorted[0].begin(), m_sorted[0].end(), t);
+            }
+
+            void insert(const triple_type &t){
+                for(size_type i = 0; i < 6; ++i){
+                    auto key = permute(t, i);
+                    auto &v = m_sorted[i];
+                    auto it = std::lower_bound(v.begin(), v.end(), key);
+                    if(it == v.end() || *it != key) v.insert(it, key);
+                }
+            }
+
+            void erase(const triple_type &t){
+                for(size_type i = 0; i < 6; ++i){
+                    auto key = permute(t, i);
+                    auto &v = m_sorted[i];
+                    auto it = std::lower_bound(v.begin(), v.end(), key);
+                    if(it != v.end() && *it == key) v.erase(it);
+                }
+            }
+
+            //Smallest value of target >= c among the triples with the bound terms (0 if there is none)
+            value_type next(const bound_type &bound, const uint8_t target, const value_type c) const {
+                size_type i = order_of(bound, target);
+                size_type n = bound.size();
+                const auto &ord = order(i);
+                triple_type key{{0, 0, 0}};
+                for(size_type j = 0; j < n; ++j) key[j] = bound.values[ord[j]];
+                key[n] = c;
+                const auto &v = m_sorted[i];
+                auto it = std::lower_bound(v.begin(), v.end(), key);
+                if(it == v.end() || less_prefix(key, *it, n)) return 0;
+                return (*it)[n];
+            }
+
+            //Number of triples with the bound terms
+            size_type count(const bound_type &bound) const {
+                size_type n = bound.size();
+                if(n == 0) return size();
+                size_type i = order_of(bound, 3);
+                const auto &ord = order(i);
+                triple_type key{{0, 0, 0}};
+                for(size_type j = 0; j < n; ++j) key[j] = bound.values[ord[j]];
+                const auto &v = m_sorted[i];
+                auto r = std::equal_range(v.begin(), v.end(), key,
+                                          [n](const triple_type &a, const triple_type &b){
+                                              return less_prefix(a, b, n);
+                                          });
+                return r.second - r.first;
+            }
+        };
+
+        /**
+         * Set of triples made of a base shared by the copies of the delta, which is never modified, and a
+         * small tail with the triples added to it and removed from it. Copying the set only copies the
+         * tail, and the tail is folded into a new base when it grows.
+         */
+        class layered_set {
+
+        private:
+            std::shared_ptr<const set_type> m_base = std::make_shared<const set_type>();
+            set_type m_added;   //not in the base
+            set_type m_removed; //in the base
+
+            //Folds the tail into a new base once it is larger than the square root of the base
+            void compact(){
+                size_type tail = m_added.size() + m_removed.size();
+                size_type limit = std::max<size_type>(1024, (size_type) std::sqrt((double) m_base->size()));
+                if(tail < limit) return;
+                m_base = std::make_shared<const set_type>(spo());
+                m_added = set_type();
+                m_removed = set_type();
+            }
+
+        public:
+            layered_set() = default;
+
+            //Triples sorted in SPO without repetitions
+            explicit layered_set(const std::vector<triple_type> &spo)
+                : m_base(std::make_shared<const set_type>(spo)) {}
+
+            inline size_type size() const {
+                return m_base->size() - m_removed.size() + m_added.size();
+            }
+
+            //Triples sorted in SPO
+            std::vector<triple_type> spo() const {
+                if(m_removed.size() == 0 && m_added.size() == 0) return m_base->spo();
+                std::vector<triple_type> kept, r;
+                std::set_difference(m_base->spo().begin(), m_base->spo().end(), m_removed.spo().begin(),
+                                    m_removed.spo().end(), std::back_inserter(kept));
+                std::set_union(kept.begin(), kept.end(), m_added.spo().begin(), m_added.spo().end(),
+                               std::back_inserter(r));
+                return r;
+            }
+
+            inline bool contains(const triple_type &t) const {
+                return m_added.contains(t) || (m_base->contains(t) && !m_removed.contains(t));
+            }
+
+            void insert(const triple_type &t){
+                if(m_removed.contains(t)){
+                    m_removed.erase(t);
+                }else if(!m_base->contains(t)){
+                    m_added.insert(t);
+                    compact();
+                }
+            }
+
+            void erase(const triple_type &t){
+                if(m_added.contains(t)){
+                    m_added.erase(t);
+                }else if(m_base->contains(t)){
+                    m_removed.insert(t);
+                    compact();
+                }
+            }
+
+            //Smallest value of target >= c among the triples with the bound terms (0 if there is none)
+            value_type next(const bound_type &bound, const uint8_t target, value_type c) const {
+                value_type a = m_added.next(bound, target, c);
+                value_type b = m_base->next(bound, target, c);
+                //A value of the base is skipped when all its triples were removed
+                while(b != 0 && m_removed.size() > 0){
+                    bound_type with_b = bound;
+                    with_b.bind(target, b);
+                    if(m_base->count(with_b) > m_removed.count(with_b)) break;
+                    b = m_base->next(bound, target, b + 1);
+                }
+                return (a == 0) ? b : ((b == 0) ? a : std::min(a, b));
+            }
+
+            //Number of triples with the bound terms
+            inline size_type count(const bound_type &bound) const {
+                return m_base->count(bound) - m_removed.count(bound) + m_added.count(bound);
+            }
+        };
+
+        layered_set m_inserted;
+        layered_set m_deleted;
+
+        static std::vector<triple_type> difference(const std::vector<triple_type> &a, const std::vector<triple_type> &b){
+            std::vector<triple_type> r;
+            std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(r));
+            return r;
+        }
+
+        static std::vector<triple_type> merge(const std::vector<triple_type> &a, const std::vector<triple_type> &b){
+            std::vector<triple_type> r;
+            std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(r));
+            return r;
+        }
+
+    public:
+
+        delta_store() = default;
+
+        /**
+         * Inserts a triple.
+         *
+         * @param t         Triple
+         * @param in_base   The triple is in the index
+         */
+        void insert(const triple_type &t, const bool in_base){
+            if(in_base){
+                m_deleted.erase(t);
+            }else{
+                m_inserted.insert(t);
+            }
+        }
+
+        /**
+         * Deletes a triple.
+         *
+         * @param t         Triple
+         * @param in_base   The triple is in the index
+         */
+        void remove(const triple_type &t, const bool in_base){
+            if(in_base){
+                m_deleted.insert(t);
+            }else{
+                m_inserted.erase(t);
+            }
+        }
+
+        /**
+         * Delta of an index rebuilt from the triples of this delta at the time of snapshot: the changes made
+         * since then are kept, the ones already in the index are dropped. Neither delta has to check the
+         * index, since the inserted triples of snapshot are now in it and its deleted ones are not.
+         *
+         * @param snapshot  Delta merged into the new index
+         */
+        delta_store rebase(const delta_store &snapshot) const {
+            const auto ins = m_inserted.spo(), del = m_deleted.spo();
+            const auto s_ins = snapshot.m_inserted.spo(), s_del = snapshot.m_deleted.spo();
+            delta_store r;
+            r.m_inserted = layered_set(merge(difference(ins, s_ins), difference(s_del, del)));
+            r.m_deleted = layered_set(merge(difference(del, s_del), difference(s_ins, ins)));
+            return r;
+        }
+
+        inline bool empty() const {
+            return m_inserted.size() == 0 && m_deleted.size() == 0;
+        }
+
+        //Number of inserted and deleted triples
+        inline size_type size() const {
+            return m_inserted.size() + m_deleted.size();
+        }
+
+        inline size_type inserted_size() const {
+            return m_inserted.size();
+        }
+
+        inline size_type deleted_size() const {
+            return m_deleted.size();
+        }
+
+        //Inserted triples sorted in SPO
+        inline std::vector<triple_type> inserted() const {
+            return m_inserted.spo();
+        }
+
+        //Deleted triples sorted in SPO
+        inline std::vector<triple_type> deleted() const {
+            return m_deleted.spo();
+        }
+
+        inline bool is_inserted(const triple_type &t) const {
+            return m_inserted.contains(t);
+        }
+
+        inline bool is_deleted(const triple_type &t) const {
+            return m_deleted.contains(t);
+        }
+
+        //Smallest value of target >= c among the inserted triples with the bound terms (0 if there is none)
+        inline value_type next_inserted(const bound_type &bound, const uint8_t target, const value_type c) const {
+            return m_inserted.next(bound, target, c);
+        }
+
+        //Number of inserted triples with the bound terms
+        inline size_type count_inserted(const bound_type &bound) const {
+            return m_inserted.count(bound);
+        }
+
+        //Number of deleted triples with the bound terms
+        inline size_type count_deleted(const bound_type &bound) const {
+            return m_deleted.count(bound);
+        }
+    };
+}
+
+#endif //RING_DELTA_STORE_HPP
@@ -0,0 +1,186 @@
+/*
+ * external_sort.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_EXTERNAL_SORT_HPP
+#define RING_EXTERNAL_SORT_HPP
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <cstdio>
+#include <cstdint>
+
+namespace ring_ltj {
+
+    /**
+     * Sorts a sequence of elements that does not fit in memory. The elements are buffered until the
+     * RAM budget is reached, then the buffer is sorted and written to disk as a run. The runs are
+     * finally merged with a k-way merge.
+     *
+     * T has to be trivially copyable because the runs store its raw bytes.
+     */
+    template<class T, class Compare = std::less<T>>
+    class external_sorter {
+
+        static_assert(std::is_trivially_copyable<T>::value, "external_sorter needs trivially copyable elements");
+
+    public:
+        typedef uint64_t size_type;
+        typedef T value_type;
+
+    private:
+        std::string m_prefix;
+        size_type m_buffer_elems;
+        size_type m_size = 0;
+        std::vector<value_type> m_buffer;
+        std::vector<std::string> m_runs;
+        Compare m_cmp;
+
+        void write_run(){
+            std::sort(m_buffer.begin(), m_buffer.end(), m_cmp);
+            std::string file = m_prefix + ".run." + std::to_string(m_runs.size());
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            out.write((const char*) m_buffer.data(), m_buffer.size() * sizeof(value_type));
+            out.close();
+            m_runs.push_back(file);
+            m_buffer.clear();
+        }
+
+        //Reads a run by blocks
+        struct run_reader {
+            std::ifstream in;
+            std::vector<value_type> block;
+            size_type pos = 0;
+
+            run_reader(const std::string &file, const size_type block_elems)
+                : in(file, std::ios::binary) {
+                block.reserve(block_elems);
+            }
+
+            bool fill(const size_type block_elems){
+                block.resize(block_elems);
+                in.read((char*) block.data(), block_elems * sizeof(value_type));
+                block.resize(in.gcount() / sizeof(value_type));
+                pos = 0;
+                return !block.empty();
+            }
+        };
+
+        void remove_runs(){
+            for(const auto &file : m_runs){
+                std::remove(file.c_str());
+            }
+            m_runs.clear();
+        }
+
+    public:
+
+        /**
+         *
+         * @param prefix        Prefix of the temporary files
+         * @param ram_budget    Maximum number of bytes buffered in memory
+         * @param cmp           Comparison function
+         */
+        external_sorter(const std::string &prefix, const size_type ram_budget, Compare cmp = Compare())
+                : m_prefix(prefix), m_cmp(cmp) {
+            m_buffer_elems = std::max<size_type>(1, ram_budget / sizeof(value_type));
+            m_buffer.reserve(m_buffer_elems);
+        }
+
+        //! Copy constructor
+        external_sorter(const external_sorter &o) = delete;
+
+        //! Copy Operator=
+        external_sorter &operator=(const external_sorter &o) = delete;
+
+        ~external_sorter(){
+            remove_runs();
+        }
+
+        inline void push_back(const value_type &v){
+            if(m_buffer.size() == m_buffer_elems){
+                write_run();
+            }
+            m_buffer.push_back(v);
+            ++m_size;
+        }
+
+        inline size_type size() const {
+            return m_size;
+        }
+
+        inline size_type runs() const {
+            return m_runs.size();
+        }
+
+        /**
+         * Reports the elements in sorted order. It can only be called once.
+         *
+         * @param f     Function called as f(element) for every element
+         */
+        template<class Function>
+        void merge(Function f){
+            if(m_runs.empty()){ //Everything fits in memory
+                std::sort(m_buffer.begin(), m_buffer.end(), m_cmp);
+                for(const auto &v : m_buffer) f(v);
+                std::vector<value_type>().swap(m_buffer);
+                return;
+            }
+            if(!m_buffer.empty()) write_run();
+            std::vector<value_type>().swap(m_buffer);
+
+            //The budget is shared among the blocks of the runs
+            size_type block_elems = std::max<size_type>(1, m_buffer_elems / m_runs.size());
+            std::vector<std::unique_ptr<run_reader>> readers;
+            readers.reserve(m_runs.size());
+            typedef std::pair<value_type, size_type> heap_item_type;
+            Compare cmp = m_cmp;
+            auto heap_cmp = [cmp](const heap_item_type &a, const heap_item_type &b){
+                return cmp(b.first, a.first);
+            };
+            std::priority_queue<heap_item_type, std::vector<heap_item_type>, decltype(heap_cmp)> heap(heap_cmp);
+            for(size_type r = 0; r < m_runs.size(); ++r){
+                readers.emplace_back(new run_reader(m_runs[r], block_elems));
+                if(readers[r]->fill(block_elems)){
+                    heap.push({readers[r]->block[0], r});
+                    readers[r]->pos = 1;
+                }
+            }
+            while(!heap.empty()){
+                heap_item_type top = heap.top();
+                heap.pop();
+                f(top.first);
+                run_reader* reader = readers[top.second].get();
+                if(reader->pos == reader->block.size() && !reader->fill(block_elems)) continue;
+                heap.push({reader->block[reader->pos], top.second});
+                ++reader->pos;
+            }
+            readers.clear();
+            remove_runs();
+        }
+    };
+}
+
+#endif //RING_EXTERNAL_SORT_HPP
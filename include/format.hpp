@@ -0,0 +1,78 @@
+/*
+ * format.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_FORMAT_HPP
+#define RING_FORMAT_HPP
+
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <sdsl/io.hpp>
+
+namespace ring_ltj {
+
+    /**
+     * Versions of the serialized structures. Structures whose layout changed after the first release
+     * write a header (magic and version) before their members. Files without the header are read with
+     * the original layout (version 0).
+     */
+    namespace format {
+
+        typedef uint64_t size_type;
+
+        const uint64_t knn_graph_magic = 0x4B4E4E4744534300ULL; //"KNNGDSC\0"
+        //1: quantized distances
+        //2: variable-length forward lists
+        //3: mutual neighbours
+        const uint64_t knn_graph_version = 3;
+
+        const uint64_t knn_index_magic = 0x4B4E4E494E444558ULL; //"KNNINDEX"
+        //2: the stamp is the hash of the space of identifiers (1: number of triples and largest identifiers)
+        const uint64_t knn_index_version = 2;
+
+        inline size_type write_header(const uint64_t magic, const uint64_t version, std::ostream &out,
+                                      sdsl::structure_tree_node *v = nullptr){
+            size_type written_bytes = 0;
+            written_bytes += sdsl::write_member(magic, out, v, "magic");
+            written_bytes += sdsl::write_member(version, out, v, "version");
+            return written_bytes;
+        }
+
+        /**
+         * Reads the header of a structure if it is there, otherwise the stream is left untouched.
+         *
+         * @return  Version of the structure (0 for files written before the header existed)
+         */
+        inline uint64_t read_header(const uint64_t magic, std::istream &in){
+            auto pos = in.tellg();
+            uint64_t m = 0, version = 0;
+            sdsl::read_member(m, in);
+            if(in && m == magic){
+                sdsl::read_member(version, in);
+                return version;
+            }
+            in.clear();
+            in.seekg(pos);
+            return 0;
+        }
+    }
+}
+
+#endif //RING_FORMAT_HPP
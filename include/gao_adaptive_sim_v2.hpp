@@ -35,7 +35,7 @@ namespace ring_ltj {
     namespace gao {
 
         template<class ring_t = ring<>,  class var_t = uint8_t,
-                class const_t = uint64_t>
+                class const_t = uint64_t, class iter_basic_t = ltj_iterator<ring_t, var_t, const_t>>
         class gao_adaptive_sim_v2 {
 
         public:
@@ -44,7 +44,7 @@ namespace ring_ltj {
             typedef uint64_t size_type;
             typedef ring_t ring_type;
             typedef ltj_iterator_base<var_type, const_type> ltj_iter_type;
-            typedef ltj_iterator<ring_type, var_type, const_type> ltj_iter_basic_type;
+            typedef iter_basic_t ltj_iter_basic_type;
             typedef ltj_iterator_similarity<ring_type, var_type, const_type>     ltj_iter_bi_similarity_type;
             typedef ltj_iterator_uni_similarity<ring_type, var_type, const_type> ltj_iter_uni_similarity_type;
             typedef var_sets<var_type, const_type> var_sets_type;
@@ -38,7 +38,8 @@ namespace ring_ltj {
     namespace gao {
 
         template<class ring_t = ring<>,  class var_t = uint8_t,
-                class const_t = uint64_t>
+                class const_t = uint64_t, class trait_t = utils::trait_size,
+                class iter_basic_t = ltj_iterator<ring_t, var_t, const_t>>
         class gao_adaptive_sim_v3 {
 
         public:
@@ -47,7 +48,7 @@ namespace ring_ltj {
             typedef uint64_t size_type;
             typedef ring_t ring_type;
             typedef ltj_iterator_base<var_type, const_type> ltj_iter_type;
-            typedef ltj_iterator<ring_type, var_type, const_type> ltj_iter_basic_type;
+            typedef iter_basic_t ltj_iter_basic_type;
             typedef ltj_iterator_similarity<ring_type, var_type, const_type>     ltj_iter_bi_similarity_type;
             typedef ltj_iterator_uni_similarity<ring_type, var_type, const_type> ltj_iter_uni_similarity_type;
             typedef var_sets_sccs<var_type, const_type> var_sets_type;
@@ -77,10 +78,17 @@ namespace ring_ltj {
 
 
 
+            //Iterator that gives a weight to a variable, its type and the term of the variable
+            typedef struct {
+                ltj_iter_type* iter;
+                uint8_t kind; //see ltj_iterator_base::is_similarity
+                uint8_t term; //0=s, 1=p, 2=o
+            } weight_source_type;
+
             typedef std::vector<update_weight_type> version_weight_type;
             typedef std::vector<update_set_type>    version_set_type;
 
-            typedef utils::trait_size gao_trait_type;
+            typedef trait_t gao_trait_type;
             typedef std::unordered_map<var_type, std::vector<ltj_iter_type*>> var_to_iterators_type;
             typedef std::stack<version_weight_type> versions_weight_type;
             typedef std::stack<version_set_type> versions_set_type;
@@ -99,6 +107,7 @@ namespace ring_ltj {
             bound_type m_bound;
             versions_weight_type m_versions_weight;
             versions_set_type m_versions_set;
+            std::vector<std::vector<weight_source_type>> m_weight_sources;
 
 
 
@@ -115,6 +124,31 @@ namespace ring_ltj {
                 m_versions_weight = o.m_versions_weight;
                 m_versions_set = o.m_versions_set;
                 m_var_sets = o.m_var_sets;
+                m_weight_sources = o.m_weight_sources;
+            }
+
+            //Type of each iterator of the variables, so down does not need virtual calls
+            void build_weight_sources(const size_type num_vars){
+                m_weight_sources.assign(num_vars, {});
+                for(const auto &p : *m_ptr_var_iterators){
+                    for(ltj_iter_type* iter : p.second){
+                        uint8_t term = iter->is_variable_subject(p.first) ? 0 :
+                                       (iter->is_variable_predicate(p.first) ? 1 : 2);
+                        m_weight_sources[p.first].push_back({iter, (uint8_t) iter->is_similarity(), term});
+                    }
+                }
+            }
+
+            inline size_type weight(const weight_source_type &src){
+                switch (src.kind * 3 + src.term) {
+                    case 0: return gao_trait_type::subject(m_ptr_ring, *static_cast<ltj_iter_basic_type*>(src.iter));
+                    case 1: return gao_trait_type::predicate(m_ptr_ring, *static_cast<ltj_iter_basic_type*>(src.iter));
+                    case 2: return gao_trait_type::object(m_ptr_ring, *static_cast<ltj_iter_basic_type*>(src.iter));
+                    case 3: return gao_trait_type::subject_sim(m_ptr_ring, *static_cast<ltj_iter_uni_similarity_type*>(src.iter));
+                    case 5: return gao_trait_type::object_sim(m_ptr_ring, *static_cast<ltj_iter_uni_similarity_type*>(src.iter));
+                    case 6: return gao_trait_type::subject_sim(m_ptr_ring, *static_cast<ltj_iter_bi_similarity_type*>(src.iter));
+                    default: return gao_trait_type::object_sim(m_ptr_ring, *static_cast<ltj_iter_bi_similarity_type*>(src.iter));
+                }
             }
 
             bool var_to_vector(const var_type var, const size_type size){
@@ -391,6 +425,8 @@ namespace ring_ltj {
                     }
                 }
 
+                build_weight_sources(num_vars);
+
 
 #if PRINT_VARSET
                 m_var_sets.print();
@@ -431,6 +467,8 @@ namespace ring_ltj {
                     m_bound = std::move(o.m_bound);
                     m_versions_weight = std::move(o.m_versions_weight);
                     m_versions_set = std::move(o.m_versions_set);
+                    m_size_lonely = o.m_size_lonely;
+                    m_weight_sources = std::move(o.m_weight_sources);
                 }
                 return *this;
             }
@@ -447,6 +485,56 @@ namespace ring_ltj {
                 std::swap(m_bound, o.m_bound);
                 std::swap(m_versions_weight, o.m_versions_weight);
                 std::swap(m_versions_set, o.m_versions_set);
+                std::swap(m_size_lonely, o.m_size_lonely);
+                std::swap(m_weight_sources, o.m_weight_sources);
+            }
+
+            /**
+             * Recomputes the weights of the variables from the current iterators, which have been rebuilt
+             * with other constants (see ltj_algorithm_similarity::rebind). The sets of variables and the
+             * SCCs only depend on the variables of the patterns, so they are kept.
+             */
+            void update_weights(){
+                for(var_type var = 0; var < m_var_sets.size(); ++var){
+                    m_var_sets.set_weight(var, UINT64_MAX);
+                }
+                for(const auto & b_iter : *m_ptr_basic_iterators){
+                    const triple_pattern* triple_pattern = b_iter.ptr_triple_pattern;
+                    if (triple_pattern->s_is_variable()) {
+                        var_to_vector((var_type) triple_pattern->term_s.value,
+                                      gao_trait_type::subject(m_ptr_ring, b_iter));
+                    }
+                    if (triple_pattern->p_is_variable()) {
+                        var_to_vector((var_type) triple_pattern->term_p.value,
+                                      gao_trait_type::predicate(m_ptr_ring, b_iter));
+                    }
+                    if (triple_pattern->o_is_variable()) {
+                        var_to_vector((var_type) triple_pattern->term_o.value,
+                                      gao_trait_type::object(m_ptr_ring, b_iter));
+                    }
+                }
+                for(const auto & uni_iter : *m_ptr_uni_sim_iterators){
+                    const triple_pattern* triple_pattern = uni_iter.ptr_triple_pattern;
+                    if (triple_pattern->s_is_variable()) {
+                        var_to_vector((var_type) triple_pattern->term_s.value,
+                                      gao_trait_type::subject_sim(m_ptr_ring, uni_iter));
+                    }
+                    if (triple_pattern->o_is_variable()) {
+                        var_to_vector((var_type) triple_pattern->term_o.value,
+                                      gao_trait_type::object_sim(m_ptr_ring, uni_iter));
+                    }
+                }
+                for(const auto & bi_iter : *m_ptr_bi_sim_iterators){
+                    const triple_pattern* triple_pattern = bi_iter.ptr_triple_patterns[0];
+                    if (triple_pattern->s_is_variable()) {
+                        var_to_vector((var_type) triple_pattern->term_s.value,
+                                      gao_trait_type::subject_sim(m_ptr_ring, bi_iter));
+                    }
+                    if (triple_pattern->o_is_variable()) {
+                        var_to_vector((var_type) triple_pattern->term_o.value,
+                                      gao_trait_type::object_sim(m_ptr_ring, bi_iter));
+                    }
+                }
             }
 
             inline var_type next() {
@@ -535,48 +623,8 @@ namespace ring_ltj {
                         if(!m_var_sets.info[link].is_bound){
                             bool u = false;
                             size_type min_w = m_var_sets.info[link].weight, w;
-                            auto &iters = m_ptr_var_iterators->at(link);
-                            for(ltj_iter_type* iter : iters){ //Check each iterator
-                                if(iter->is_variable_subject(link)){
-                                    switch (iter->is_similarity()) {
-                                        case 2: {
-                                            auto s_iter = static_cast<ltj_iter_bi_similarity_type*>(iter);
-                                            w = gao_trait_type::subject_sim(m_ptr_ring, *s_iter);
-                                            break;
-                                        }
-                                        case 1: {
-                                            auto s_iter = static_cast<ltj_iter_uni_similarity_type*>(iter);
-                                            w = gao_trait_type::subject_sim(m_ptr_ring, *s_iter);
-                                            break;
-                                        }
-                                        case 0: {
-                                            auto b_iter = static_cast<ltj_iter_basic_type*>(iter);
-                                            w = gao_trait_type::subject(m_ptr_ring, *b_iter); //New weight
-                                            break;
-                                        }
-                                    }
-                                }else if (iter->is_variable_predicate(link)){
-                                    auto b_iter = static_cast<ltj_iter_basic_type*>(iter);
-                                    w = gao_trait_type::predicate(m_ptr_ring, *b_iter);
-                                }else{
-                                    switch (iter->is_similarity()) {
-                                        case 2: {
-                                            auto s_iter = static_cast<ltj_iter_bi_similarity_type*>(iter);
-                                            w = gao_trait_type::object_sim(m_ptr_ring, *s_iter);
-                                            break;
-                                        }
-                                        case 1: {
-                                            auto s_iter = static_cast<ltj_iter_uni_similarity_type*>(iter);
-                                            w = gao_trait_type::object_sim(m_ptr_ring, *s_iter);
-                                            break;
-                                        }
-                                        case 0: {
-                                            auto b_iter = static_cast<ltj_iter_basic_type*>(iter);
-                                            w = gao_trait_type::object(m_ptr_ring, *b_iter); //New weight
-                                            break;
-                                        }
-                                    }
-                                }
+                            for(const auto &src : m_weight_sources[link]){ //Check each iterator
+                                w = weight(src); //New weight
                                 if(min_w > w) {
                                     min_w = w;
                                     u = true;
@@ -0,0 +1,350 @@
+/*
+ * knn_cache.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_KNN_CACHE_HPP
+#define RING_KNN_CACHE_HPP
+
+#include <vector>
+#include <list>
+#include <mutex>
+#include <memory>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+#include <mutual_knn.hpp>
+
+namespace ring_ltj {
+
+    /**
+     * Cache of decoded lists of the KNN graphs. An entry is the sorted list of the k nearest neighbours of
+     * an anchor x (forward), of the nodes that have x among their k nearest neighbours (inverse), or the
+     * intersection of both lists for k1 and k2, in one of the KNN graphs of the index.
+     *
+     * The entries are split into shards by the hash of their key, each one with its own lock, LRU list and
+     * part of the budget, so threads solving different anchors rarely wait for each other. The lists are
+     * shared, an evicted list stays alive while an iterator still uses it.
+     */
+    class knn_cache {
+
+    public:
+        typedef uint64_t size_type;
+        typedef uint64_t value_type;
+        typedef std::vector<value_type> list_type;
+        typedef std::shared_ptr<const list_type> list_ptr_type;
+        enum direction_type : uint8_t {forward = 0, inverse = 1, intersection = 2};
+
+    private:
+        struct key_type {
+            size_type graph;
+            value_type x;
+            size_type k1;
+            size_type k2;
+            uint8_t direction;
+
+            inline bool operator==(const key_type &o) const {
+                return x == o.x && k1 == o.k1 && k2 == o.k2 && direction == o.direction && graph == o.graph;
+            }
+        };
+
+        struct key_hash {
+            inline size_type operator()(const key_type &k) const {
+                uint64_t h = k.x * 0x9E3779B97F4A7C15ULL;
+                h ^= (k.k1 << 2 | k.direction) * 0xC2B2AE3D27D4EB4FULL;
+                h ^= k.k2 * 0x165667B19E3779F9ULL;
+                h ^= k.graph * 0x27D4EB2F165667C5ULL;
+                h ^= h >> 33;
+                h *= 0xFF51AFD7ED558CCDULL;
+                h ^= h >> 33;
+                return h;
+            }
+        };
+
+        typedef std::pair<key_type, list_ptr_type> entry_type;
+        typedef std::list<entry_type> lru_type;
+
+        struct shard_type {
+            std::mutex mutex;
+            lru_type lru; //most recently used first
+            std::unordered_map<key_type, typename lru_type::iterator, key_hash> table;
+            size_type bytes = 0;
+            size_type hits = 0;
+            size_type misses = 0;
+            size_type evictions = 0;
+        };
+
+        size_type m_budget = 0;
+        size_type m_shard_budget = 0;
+        std::vector<std::unique_ptr<shard_type>> m_shards;
+
+        static inline size_type bytes(const list_type &l){
+            //Values and the nodes of the list and the table
+            return l.size() * sizeof(value_type) + sizeof(list_type) + sizeof(entry_type) + 64;
+        }
+
+        inline shard_type& shard(const key_type &k){
+            return *m_shards[key_hash()(k) % m_shards.size()];
+        }
+
+    public:
+
+        /**
+         *
+         * @param budget    Maximum number of bytes of the lists
+         * @param shards    Number of shards
+         */
+        explicit knn_cache(const size_type budget, const size_type shards = 16){
+            m_budget = budget;
+            size_type n = std::max<size_type>(1, shards);
+            m_shard_budget = budget / n;
+            for(size_type i = 0; i < n; ++i){
+                m_shards.emplace_back(new shard_type());
+            }
+        }
+
+        /**
+         * Cached list of an anchor, decoded with decode(list) if it is not in the cache. The decoding runs
+         * without the lock of the shard, so two threads may decode the same list at the same time.
+         *
+         * @param graph     KNN graph
+         * @param x         Anchor
+         * @param k1        k of the forward list
+         * @param k2        k of the inverse list
+         * @param direction List of the anchor
+         * @param decode    Fills the sorted list of the anchor
+         */
+        template<class decode_t>
+        list_ptr_type get(const size_type graph, const value_type x, const size_type k1, const size_type k2,
+                          const direction_type direction, decode_t decode){
+            key_type key{graph, x, k1, k2, (uint8_t) direction};
+            shard_type &s = shard(key);
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                auto it = s.table.find(key);
+                if(it != s.table.end()){
+                    ++s.hits;
+                    s.lru.splice(s.lru.begin(), s.lru, it->second);
+                    return it->second->second;
+                }
+                ++s.misses;
+            }
+            std::shared_ptr<list_type> list = std::make_shared<list_type>();
+            decode(*list);
+            size_type b = bytes(*list);
+            if(b > m_shard_budget) return list;
+
+            std::lock_guard<std::mutex> lock(s.mutex);
+            auto it = s.table.find(key);
+            if(it != s.table.end()) return it->second->second; //Decoded by another thread
+            s.lru.emplace_front(key, list);
+            s.table.insert({key, s.lru.begin()});
+            s.bytes += b;
+            while(s.bytes > m_shard_budget){
+                auto &e = s.lru.back();
+                s.bytes -= bytes(*e.second);
+                s.table.erase(e.first);
+                s.lru.pop_back();
+                ++s.evictions;
+            }
+            return list;
+        }
+
+        inline size_type budget() const {
+            return m_budget;
+        }
+
+        size_type hits() const {
+            size_type r = 0;
+            for(const auto &s : m_shards){
+                std::lock_guard<std::mutex> lock(s->mutex);
+                r += s->hits;
+            }
+            return r;
+        }
+
+        size_type misses() const {
+            size_type r = 0;
+            for(const auto &s : m_shards){
+                std::lock_guard<std::mutex> lock(s->mutex);
+                r += s->misses;
+            }
+            return r;
+        }
+
+        size_type evictions() const {
+            size_type r = 0;
+            for(const auto &s : m_shards){
+                std::lock_guard<std::mutex> lock(s->mutex);
+                r += s->evictions;
+            }
+            return r;
+        }
+
+        size_type entries() const {
+            size_type r = 0;
+            for(const auto &s : m_shards){
+                std::lock_guard<std::mutex> lock(s->mutex);
+                r += s->lru.size();
+            }
+            return r;
+        }
+
+        size_type size_in_bytes() const {
+            size_type r = 0;
+            for(const auto &s : m_shards){
+                std::lock_guard<std::mutex> lock(s->mutex);
+                r += s->bytes;
+            }
+            return r;
+        }
+
+        double hit_rate() const {
+            size_type h = hits(), m = misses();
+            return (h + m == 0) ? 0.0 : (double) h / (double) (h + m);
+        }
+
+        void clear(){
+            for(auto &s : m_shards){
+                std::lock_guard<std::mutex> lock(s->mutex);
+                s->lru.clear();
+                s->table.clear();
+                s->bytes = 0;
+            }
+        }
+    };
+
+    /**
+     * Helper of the KNN graph (see wt_range_helper and wt_intersection_helper) that answers next from a
+     * precomputed list of mutual neighbours (see mutual_knn) or from a decoded list when the anchor is in
+     * the cache. Without a list it walks the wavelet matrices.
+     */
+    template<class helper_t>
+    class knn_cached_helper {
+
+    public:
+        typedef helper_t helper_type;
+        typedef typename knn_cache::size_type size_type;
+        typedef typename knn_cache::value_type value_type;
+        typedef typename knn_cache::list_type list_type;
+        typedef typename knn_cache::list_ptr_type list_ptr_type;
+
+    private:
+        helper_type m_helper;
+        list_ptr_type m_list;
+        mutual_knn::list_type m_mutual;
+
+        void copy(const knn_cached_helper &o) {
+            m_helper = o.m_helper;
+            m_list = o.m_list;
+            m_mutual = o.m_mutual;
+        }
+
+    public:
+
+        knn_cached_helper() = default;
+
+        //Helper that is decoded or replaced by a list
+        inline helper_type& helper() {
+            return m_helper;
+        }
+
+        inline void set_list(const list_ptr_type &list){
+            m_list = list;
+            m_mutual = mutual_knn::list_type();
+        }
+
+        inline void set_list(const mutual_knn::list_type &list){
+            m_list.reset();
+            m_mutual = list;
+        }
+
+        inline void reset_list(){
+            m_list.reset();
+            m_mutual = mutual_knn::list_type();
+        }
+
+        //Sorted values of the helper
+        void decode(list_type &out){
+            out.clear();
+            if(m_helper.is_empty()) return;
+            value_type c = m_helper.next();
+            while(c != 0){
+                out.push_back(c);
+                c = m_helper.next(c + 1);
+            }
+        }
+
+        inline value_type next(){
+            if(m_mutual.is_valid()) return (m_mutual.size() == 0) ? 0 : m_mutual[0];
+            if(!m_list) return m_helper.next();
+            return m_list->empty() ? 0 : m_list->front();
+        }
+
+        inline value_type next(const value_type c){
+            if(m_mutual.is_valid()) return m_mutual.next(c);
+            if(!m_list) return m_helper.next(c);
+            auto it = std::lower_bound(m_list->begin(), m_list->end(), c);
+            return (it == m_list->end()) ? 0 : *it;
+        }
+
+        inline bool is_empty() const {
+            return m_helper.is_empty();
+        }
+
+        inline size_type distinct() const {
+            return m_helper.distinct();
+        }
+
+        //! Copy constructor
+        knn_cached_helper(const knn_cached_helper &o) {
+            copy(o);
+        }
+
+        //! Move constructor
+        knn_cached_helper(knn_cached_helper &&o) {
+            *this = std::move(o);
+        }
+
+        //! Copy Operator=
+        knn_cached_helper &operator=(const knn_cached_helper &o) {
+            if (this != &o) {
+                copy(o);
+            }
+            return *this;
+        }
+
+        //! Move Operator=
+        knn_cached_helper &operator=(knn_cached_helper &&o) {
+            if (this != &o) {
+                m_helper = std::move(o.m_helper);
+                m_list = std::move(o.m_list);
+                m_mutual = o.m_mutual;
+            }
+            return *this;
+        }
+
+        void swap(knn_cached_helper &o) {
+            m_helper.swap(o.m_helper);
+            std::swap(m_list, o.m_list);
+            std::swap(m_mutual, o.m_mutual);
+        }
+    };
+}
+
+#endif //RING_KNN_CACHE_HPP
@@ -36,13 +36,18 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 
 #include <configuration.hpp>
+#include <parallel.hpp>
+#include <format.hpp>
+#include <cmath>
 #include <sdsl/bit_vectors.hpp>
 #include <sdsl/rank_support.hpp>
 #include <sdsl/select_support.hpp>
 #include <wt_intersection_iterator.hpp>
 #include <wt_intersection_helper.hpp>
+#include <wt_intersection_pair.hpp>
 #include <wt_range_iterator.hpp>
 #include <wt_range_helper.hpp>
+#include <mutual_knn.hpp>
 
 namespace ring_ltj {
 
@@ -56,11 +61,18 @@ namespace ring_ltj {
         typedef sdsl::wm_int<wm_bit_vector_t, wm_rank_t,
                 sdsl::select_support_scan<1>, sdsl::select_support_scan<0>> wt_type;
         typedef b_bit_vector_t b_type;
-        typedef wt_intersection_iterator<wt_type> intersection_iterator_type;
-        typedef wt_intersection_helper<wt_type> intersection_helper_type;
+        typedef wt_intersection_pair_iterator<wt_type> intersection_iterator_type;
+        typedef wt_intersection_pair_helper<wt_type> intersection_helper_type;
         typedef wt_range_iterator<wt_type> range_iterator_type;
         typedef wt_range_helper<wt_type> range_helper_type;
         typedef typename b_bit_vector_t::select_1_type b_select_1_type;
+        typedef struct {
+            size_type anchor;
+            range_type r0;
+            range_type r1;
+        } batch_item_type;
+        typedef std::vector<batch_item_type> batch_level_type;
+        typedef std::vector<std::array<batch_level_type, 2>> batch_buffers_type; //see batch_intersection
 
     private:
         std::vector<wt_type> m_wts;
@@ -68,6 +80,15 @@ namespace ring_ltj {
         b_select_1_type m_b_select;
         size_type m_max_k;
         size_type m_nodes;
+        sdsl::int_vector<> m_dist; //Quantized distances aligned with m_wts[0] (empty without distances)
+        double m_d_min = 0;
+        double m_d_step = 0;
+        //Variable-length forward lists: m_wts[0] only stores the neighbours of each node and m_bf marks the
+        //beginning of each list with a 1 followed by a 0 per neighbour
+        bool m_variable = false;
+        b_type m_bf;
+        b_select_1_type m_bf_select;
+        mutual_knn m_mutual; //Mutual neighbours for some values of k (optional)
 
 
         void copy(const knn_graph_cds &o) {
@@ -77,20 +98,121 @@ namespace ring_ltj {
             m_b_select.set_vector(&m_b);
             m_max_k = o.m_max_k;
             m_nodes = o.m_nodes;
+            m_dist = o.m_dist;
+            m_d_min = o.m_d_min;
+            m_d_step = o.m_d_step;
+            m_variable = o.m_variable;
+            m_bf = o.m_bf;
+            m_bf_select = o.m_bf_select;
+            m_bf_select.set_vector(&m_bf);
+            m_mutual = o.m_mutual;
         }
 
         inline size_type p(const value_type x, const size_type k){
             return m_b_select((x-1)*m_max_k + k)+1 - (x-1)*m_max_k - k + 1;
         }
 
+        //Position of the first neighbour of x in m_wts[0]
+        inline size_type beg_in_g(const value_type x) const {
+            if(!m_variable) return (x-1)*m_max_k+1;
+            return m_bf_select(x) - x + 2;
+        }
+
+        //Number of slots of the list of x (max_k in the fixed layout)
+        inline size_type length_in_g(const value_type x) const {
+            if(!m_variable) return m_max_k;
+            return m_bf_select(x+1) - m_bf_select(x) - 1;
+        }
+
         inline range_type range_in_g(const value_type x, const size_type k){
-            return range_type{(x-1)*m_max_k+1, (x-1)*m_max_k+k};
+            if(!m_variable) return range_type{(x-1)*m_max_k+1, (x-1)*m_max_k+k};
+            size_type b = m_bf_select(x);
+            size_type beg = b - x + 2;
+            size_type len = m_bf_select(x+1) - b - 1;
+            return range_type{beg, beg + std::min(k, len) - 1};
         }
 
         inline range_type range_in_inv_g(const value_type x, const size_type k){
             return range_type{p(x,1), p(x, k+1)-1};
         }
 
+        void batch_intersection_rec(const typename wt_type::node_type &v0, const typename wt_type::node_type &v1,
+                                    const size_type level, const batch_level_type &active,
+                                    batch_buffers_type &buffers, std::vector<std::vector<value_type>> &out){
+            if(m_wts[0].is_leaf(v0)){
+                for(const auto &item : active){
+                    out[item.anchor].push_back(v0.sym);
+                }
+                return;
+            }
+            //The children of the next level are written in its buffers, the ones of this level are kept
+            auto &left = buffers[level+1][0];
+            auto &right = buffers[level+1][1];
+            left.clear();
+            right.clear();
+            std::array<typename wt_type::node_type, 2> children0, children1;
+            range_type l0, r0, l1, r1;
+            size_type rnk;
+            for(const auto &item : active){
+                //The children nodes are the same for every anchor
+                children0 = m_wts[0].my_expand(v0, item.r0, l0, r0, rnk);
+                children1 = m_wts[1].my_expand(v1, item.r1, l1, r1, rnk);
+                if(!sdsl::empty(l0) && !sdsl::empty(l1)){
+                    left.push_back(batch_item_type{item.anchor, l0, l1});
+                }
+                if(!sdsl::empty(r0) && !sdsl::empty(r1)){
+                    right.push_back(batch_item_type{item.anchor, r0, r1});
+                }
+            }
+            if(!left.empty()){
+                batch_intersection_rec(children0[0], children1[0], level+1, left, buffers, out);
+            }
+            if(!right.empty()){
+                batch_intersection_rec(children0[1], children1[1], level+1, right, buffers, out);
+            }
+        }
+
+        //Largest quantized value, used for the positions without neighbour
+        inline size_type max_quantized() const {
+            return sdsl::bits::lo_set[m_dist.width()];
+        }
+
+        /**
+         * Quantized distances take the value floor((d - d_min) / step). An entry is below the threshold t
+         * when the lower bound of its bucket is smaller than t, i.e. when its value is smaller than the
+         * returned one.
+         */
+        inline size_type quantized_threshold(const double t) const {
+            if(t <= m_d_min) return 0;
+            if(m_d_step == 0) return max_quantized() + 1;
+            double q = std::ceil((t - m_d_min) / m_d_step);
+            return (q > (double) max_quantized()) ? max_quantized() + 1 : (size_type) q;
+        }
+
+        //The distances of each list have to be non-decreasing in k (see k_within and dataset_io::read_knn_dist_text)
+        void build_distances(const knn_graph_type &g, const uint8_t bits){
+            double d_min = 0, d_max = 0;
+            bool first = true;
+            for(const auto &list : g){
+                for(const auto &item : list){
+                    if(first || item.d < d_min) d_min = item.d;
+                    if(first || item.d > d_max) d_max = item.d;
+                    first = false;
+                }
+            }
+            m_d_min = d_min;
+            size_type max_q = sdsl::bits::lo_set[bits];
+            m_d_step = (d_max - d_min) / max_q;
+            m_dist = sdsl::int_vector<>(m_wts[0].size(), max_q, bits);
+            for(size_type i = 0; i < m_nodes; ++i){
+                size_type beg = beg_in_g(i+1);
+                for(const auto &item : g[i]){
+                    size_type q = (m_d_step == 0) ? 0 : (size_type) std::floor((item.d - m_d_min) / m_d_step);
+                    m_dist[beg + item.k - 1] = std::min(q, max_q);
+                }
+            }
+        }
+
         struct sort_inverse {
             bool operator()(const knn_item_type &a, const knn_item_type &b) {
                 if (a.k == b.k) {
@@ -106,30 +228,69 @@ namespace ring_ltj {
         const size_type& max_k = m_max_k;
         const size_type& nodes = m_nodes;
 
+        //Bits of the quantized distances
+        static const uint8_t dist_bits = 8;
+
         knn_graph_cds() = default;
 
-        //The inverted list is sorted by the k value
+        /**
+         * The inverted list is sorted by the k value. Distances are kept if some item of g has one.
+         *
+         * The forward lists are stored with variable length when the k values of every list are 1, 2, ...
+         * and the padding of the lists shorter than max_k costs more than the delimiters. Otherwise each
+         * list takes max_k slots.
+         */
         knn_graph_cds(const knn_graph_type &g, const size_type max_k_p){
 
             m_max_k = max_k_p;
             m_nodes = g.size();
             m_wts.resize(2);
 
+            bool has_dist = false, contiguous = true;
+            size_type n_items = 0;
+            for(size_type i = 0; i < m_nodes; ++i){
+                for(size_type j = 0; j < g[i].size(); ++j){
+                    has_dist = has_dist || (g[i][j].d != 0);
+                    contiguous = contiguous && (g[i][j].k == j+1);
+                }
+                n_items += g[i].size();
+            }
+            //Bits of the padding in the wavelet matrix against the delimiters and their select
+            size_type padding_bits = (m_nodes*m_max_k - n_items) * sdsl::bits::hi(std::max<size_type>(m_nodes, 1)) + 1;
+            size_type delimiter_bits = (n_items + m_nodes + 1) * 5 / 4;
+            m_variable = contiguous && padding_bits > delimiter_bits;
+
             knn_graph_type inv_g(m_nodes);
             {
-                sdsl::int_vector<> aux(m_nodes*m_max_k+1, 0);
+                sdsl::int_vector<> aux((m_variable ? n_items : m_nodes*m_max_k)+1, 0);
                 aux[0] = m_nodes-1;
+                if(m_variable){
+                    m_bf = b_type(n_items + m_nodes + 1, 0);
+                }
+                size_type a_i = 1;
                 for(size_type i = 0; i < m_nodes; ++i){
+                    if(m_variable){
+                        m_bf[a_i + i - 1] = 1;
+                    }
                     for(size_type j = 0; j < g[i].size(); ++j){
                         auto& element = g[i][j];
-                        aux[i*m_max_k + element.k]=element.id;
-                        knn_item_type inv_item{i+1, element.k};
+                        if(m_variable){
+                            aux[a_i++] = element.id;
+                        }else{
+                            aux[i*m_max_k + element.k]=element.id;
+                        }
+                        knn_item_type inv_item{i+1, element.k, 0};
                         inv_g[element.id-1].push_back(inv_item);
                     }
                 }
+                if(m_variable){
+                    m_bf[n_items + m_nodes] = 1;
+                }
+                sdsl::util::init_support(m_bf_select, &m_bf);
                 sdsl::util::bit_compress(aux);
-                construct_im(m_wts[0], aux);
+                parallel::construct_im(m_wts[0], aux);
             }
+            if(has_dist) build_distances(g, dist_bits);
 
             for(size_type i = 0; i < m_nodes; ++i){
                 sort(inv_g[i].begin(), inv_g[i].end(), sort_inverse());
@@ -158,7 +319,7 @@ namespace ring_ltj {
                 }
                 m_b[b_index] = 1;
                 sdsl::util::bit_compress(aux);
-                construct_im(m_wts[1], aux);
+                parallel::construct_im(m_wts[1], aux);
             }
             sdsl::util::init_support(m_b_select, &m_b);
         }
@@ -190,6 +351,14 @@ namespace ring_ltj {
                 m_b_select.set_vector(&m_b);
                 m_max_k = o.m_max_k;
                 m_nodes = o.m_nodes;
+                m_dist = std::move(o.m_dist);
+                m_d_min = o.m_d_min;
+                m_d_step = o.m_d_step;
+                m_variable = o.m_variable;
+                m_bf = std::move(o.m_bf);
+                m_bf_select = std::move(o.m_bf_select);
+                m_bf_select.set_vector(&m_bf);
+                m_mutual = std::move(o.m_mutual);
             }
             return *this;
         }
@@ -201,6 +370,13 @@ namespace ring_ltj {
             sdsl::util::swap_support(m_b_select, o.m_b_select, &m_b, &o.m_b);
             std::swap(m_max_k, o.m_max_k);
             std::swap(m_nodes, o.m_nodes);
+            m_dist.swap(o.m_dist);
+            std::swap(m_d_min, o.m_d_min);
+            std::swap(m_d_step, o.m_d_step);
+            std::swap(m_variable, o.m_variable);
+            std::swap(m_bf, o.m_bf);
+            sdsl::util::swap_support(m_bf_select, o.m_bf_select, &m_bf, &o.m_bf);
+            m_mutual.swap(o.m_mutual);
         }
 
         void print_structure(){
@@ -211,6 +387,13 @@ namespace ring_ltj {
                 std::cout << m_wts[0][i] << ", ";
             }
             std::cout << std::endl;
+            if(m_variable){
+                std::cout << "B': ";
+                for(uint64_t i = 0; i < m_bf.size(); ++i){
+                    std::cout << (uint64_t) m_bf[i] << ", ";
+                }
+                std::cout << std::endl;
+            }
 
             std::cout << "Inverse Graph" << std::endl;
             std::cout << "===============" << std::endl;
@@ -230,20 +413,18 @@ namespace ring_ltj {
         inline void beg_intersection_iterator(const value_type x, const size_type k1, const size_type k2,
                                               intersection_iterator_type& it){
             if(x > m_nodes || k1 > m_max_k || k2 > m_max_k){
-                it = intersection_iterator_type();
+                it.reset();
             }else{
-                std::vector<range_type> ranges = {range_in_g(x, k1), range_in_inv_g(x, k2)};
-                it = intersection_iterator_type(&m_wts, ranges);
+                it.reset(&m_wts, range_in_g(x, k1), range_in_inv_g(x, k2));
             }
         }
 
         inline void beg_intersection_helper(const value_type x, const size_type k1, const size_type k2,
                                               intersection_helper_type& it){
             if(x > m_nodes || k1 > m_max_k || k2 > m_max_k){
-                it = intersection_helper_type();
+                it.reset();
             }else{
-                std::vector<range_type> ranges = {range_in_g(x, k1), range_in_inv_g(x, k2)};
-                it = intersection_helper_type(&m_wts, ranges);
+                it.reset(&m_wts, range_in_g(x, k1), range_in_inv_g(x, k2));
             }
         }
 
@@ -279,21 +460,150 @@ namespace ring_ltj {
             }
         }
 
+        /**
+         * Position of y in the list of nearest neighbours of x.
+         *
+         * @return  k such that y is the k-th nearest neighbour of x, or 0 if it is not one of its max_k neighbours
+         */
+        size_type neighbour_rank(const value_type x, const value_type y){
+            if(x == 0 || x > m_nodes || y == 0) return 0;
+            range_type r = range_in_g(x, m_max_k);
+            if(sdsl::empty(r)) return 0;
+            size_type before = m_wts[0].rank(r[0], y);
+            if(m_wts[0].rank(r[1]+1, y) == before) return 0;
+            return m_wts[0].select(before+1, y) - r[0] + 1;
+        }
+
+        inline bool has_distances() const {
+            return !m_dist.empty();
+        }
+
+        /**
+         * Distance between x and its k-th nearest neighbour (lower bound of its quantization bucket).
+         */
+        inline double distance(const value_type x, const size_type k) const {
+            if(!has_distances()) return 0;
+            if(k == 0 || k > length_in_g(x)) return m_d_min + max_quantized() * m_d_step;
+            return m_d_min + m_dist[beg_in_g(x) + k - 1] * m_d_step;
+        }
+
+        /**
+         * Number of nearest neighbours of x whose distance is below t. The lists are sorted by distance,
+         * so they are a prefix of the list and a binary search finds them.
+         *
+         * @return  k such that the first k neighbours of x are below t (max_k if there are no distances)
+         */
+        size_type k_within(const value_type x, const double t) const {
+            if(!has_distances()) return m_max_k;
+            if(x == 0 || x > m_nodes) return 0;
+            size_type qt = quantized_threshold(t);
+            size_type base = beg_in_g(x);
+            size_type lo = 0, hi = length_in_g(x);
+            while(lo < hi){
+                size_type mid = (lo + hi) / 2;
+                if(m_dist[base + mid] < qt){
+                    lo = mid + 1;
+                }else{
+                    hi = mid;
+                }
+            }
+            return lo;
+        }
+
+        /**
+         * Checks if y is one of the nearest neighbours of x with a distance below t.
+         */
+        bool distance_below(const value_type x, const value_type y, const double t){
+            size_type k = neighbour_rank(x, y);
+            if(k == 0) return false;
+            if(!has_distances()) return true;
+            return m_dist[beg_in_g(x) + k - 1] < quantized_threshold(t);
+        }
+
+        /**
+         * Computes the intersections between the k1 nearest neighbours and the k2 reverse nearest neighbours
+         * of several anchors with a single traversal of both wavelet matrices. Each node of the traversal is
+         * visited once for all the anchors whose ranges are not empty in it, and the ranges of each level are
+         * kept in buffers that are reused during the whole traversal.
+         *
+         * It needs the anchors in advance, so it is used when building (see mutual_knn). The iterators of a
+         * query get one anchor at a time and use beg_intersection_helper, whose stack is reused between anchors.
+         *
+         * @param anchors   Sorted list of nodes
+         * @param k1        k of the graph
+         * @param k2        k of the reverse graph
+         * @param out       out[i] is the intersection of anchors[i] in increasing order
+         * @param buffers   Buffers of the traversal, they can be reused by the next call
+         */
+        void batch_intersection(const std::vector<value_type> &anchors, const size_type k1, const size_type k2,
+                                std::vector<std::vector<value_type>> &out, batch_buffers_type &buffers){
+            out.resize(anchors.size());
+            for(auto &o : out) o.clear();
+            if(k1 > m_max_k || k2 > m_max_k || anchors.empty()) return;
+
+            buffers.resize(m_wts[0].max_level + 2);
+            auto &root = buffers[0][0];
+            root.clear();
+            root.reserve(anchors.size());
+            for(size_type i = 0; i < anchors.size(); ++i){
+                const auto x = anchors[i];
+                if(x == 0 || x > m_nodes) continue;
+                range_type r0 = range_in_g(x, k1);
+                range_type r1 = range_in_inv_g(x, k2);
+                if(!sdsl::empty(r0) && !sdsl::empty(r1)){
+                    root.push_back(batch_item_type{i, r0, r1});
+                }
+            }
+            if(root.empty()) return;
+            for(auto &b : buffers){
+                b[0].reserve(root.size());
+                b[1].reserve(root.size());
+            }
+            batch_intersection_rec(m_wts[0].root(), m_wts[1].root(), 0, root, buffers, out);
+        }
+
+        void batch_intersection(const std::vector<value_type> &anchors, const size_type k1, const size_type k2,
+                                std::vector<std::vector<value_type>> &out){
+            batch_buffers_type buffers;
+            batch_intersection(anchors, k1, k2, out, buffers);
+        }
+
+        /**
+         * Precomputes the mutual neighbours of every node for the given values of k (see mutual_knn).
+         * Values of k larger than max_k are ignored.
+         */
+        void build_mutual(const std::vector<size_type> &ks){
+            m_mutual = mutual_knn(*this, ks);
+        }
+
+        inline const mutual_knn& mutual() const {
+            return m_mutual;
+        }
+
         //! Serializes the data structure into the given ostream
         size_type serialize(std::ostream &out, sdsl::structure_tree_node *v = nullptr, std::string name = "") const {
             sdsl::structure_tree_node *child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
             size_type written_bytes = 0;
+            written_bytes += format::write_header(format::knn_graph_magic, format::knn_graph_version, out, child);
             written_bytes += sdsl::serialize_vector(m_wts, out, child, "wts");
             written_bytes += m_b.serialize(out, child, "b");
             written_bytes += m_b_select.serialize(out, child, "b_select");
             written_bytes += sdsl::write_member(m_max_k, out, child, "max_k");
             written_bytes += sdsl::write_member(m_nodes, out, child, "nodes");
+            written_bytes += m_dist.serialize(out, child, "dist");
+            written_bytes += sdsl::write_member(m_d_min, out, child, "d_min");
+            written_bytes += sdsl::write_member(m_d_step, out, child, "d_step");
+            written_bytes += sdsl::write_member(m_variable, out, child, "variable");
+            written_bytes += m_bf.serialize(out, child, "bf");
+            written_bytes += m_bf_select.serialize(out, child, "bf_select");
+            written_bytes += m_mutual.serialize(out, child, "mutual");
             sdsl::structure_tree::add_size(child, written_bytes);
             return written_bytes;
         }
 
 
         void load(std::istream &in) {
+            auto version = format::read_header(format::knn_graph_magic, in);
             m_wts.resize(2);
             sdsl::load_vector(m_wts, in);
             m_b.load(in);
@@ -301,6 +611,25 @@ namespace ring_ltj {
             m_b_select.set_vector(&m_b);
             sdsl::read_member(m_max_k, in);
             sdsl::read_member(m_nodes, in);
+            if(version >= 1){
+                m_dist.load(in);
+                sdsl::read_member(m_d_min, in);
+                sdsl::read_member(m_d_step, in);
+            }else{
+                m_dist = sdsl::int_vector<>();
+                m_d_min = m_d_step = 0;
+            }
+            m_variable = false;
+            if(version >= 2){
+                sdsl::read_member(m_variable, in);
+                m_bf.load(in);
+                m_bf_select.load(in);
+                m_bf_select.set_vector(&m_bf);
+            }
+            m_mutual = mutual_knn();
+            if(version >= 3){
+                m_mutual.load(in);
+            }
         }
 
 
@@ -0,0 +1,416 @@
+/*
+ * knn_index.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_KNN_INDEX_HPP
+#define RING_KNN_INDEX_HPP
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <configuration.hpp>
+#include <format.hpp>
+#include <knn_graph_cds.hpp>
+#include <knn_cache.hpp>
+
+namespace ring_ltj {
+
+    /**
+     * KNN component of an index: the default KNN graph, the named ones and the cache of their decoded
+     * lists. It can be stored in its own file and replaced while the index is running (see
+     * ring_similarity::replace_knn), so the graphs are rebuilt without rebuilding the BWTs.
+     *
+     * The stamp identifies the space of identifiers of the index the graphs were built for (the nodes of
+     * the graphs are identifiers of subjects and objects). A component is only accepted by an index with
+     * the same stamp. Updating the triples of an index does not change its identifiers, so the stamp is
+     * kept by the indexes rebuilt with the updates (see ring_dynamic).
+     */
+    template<class knn_graph_cds_t = knn_graph_cds<>>
+    class knn_index {
+
+    public:
+        typedef uint64_t size_type;
+        typedef uint64_t value_type;
+        typedef knn_graph_cds_t knn_graph_cds_type;
+        typedef typename knn_graph_cds_type::intersection_iterator_type intersection_iterator_type;
+        typedef typename knn_graph_cds_type::range_iterator_type range_iterator_type;
+        typedef knn_cached_helper<typename knn_graph_cds_type::intersection_helper_type> intersection_helper_type;
+        typedef knn_cached_helper<typename knn_graph_cds_type::range_helper_type> range_helper_type;
+        typedef typename mutual_knn::list_type mutual_list_type;
+
+        //Space of identifiers of the index
+        struct stamp_type {
+            uint64_t id_space = 0;
+
+            inline bool operator==(const stamp_type &o) const {
+                return id_space == o.id_space;
+            }
+
+            inline bool operator!=(const stamp_type &o) const {
+                return !(*this == o);
+            }
+
+            static inline uint64_t mix(uint64_t h, const uint64_t v){
+                h ^= v + 0x9E3779B97F4A7C15ULL + (h << 6) + (h >> 2);
+                h ^= h >> 33;
+                h *= 0xFF51AFD7ED558CCDULL;
+                h ^= h >> 33;
+                return h;
+            }
+
+            /**
+             * Hash of the identifiers used by the subjects and the objects of the index.
+             *
+             * @param ids   Bitmap of the identifiers (bit i of ids[i/64] is set if i is used)
+             */
+            static uint64_t of_ids(const std::vector<uint64_t> &ids){
+                uint64_t h = mix(0, ids.size());
+                for(const auto &w : ids){
+                    h = mix(h, w);
+                }
+                return h;
+            }
+
+            //Stamp of the indexes and components stored before the space of identifiers was recorded
+            static uint64_t legacy(const size_type n_triples, const size_type max_s,
+                                   const size_type max_p, const size_type max_o){
+                return mix(mix(mix(mix(0, n_triples), max_s), max_p), max_o);
+            }
+        };
+
+    private:
+        stamp_type m_stamp;
+        knn_graph_cds_type m_graph;
+        //Named KNN graphs (optional), the graph i > 0 of the queries is m_graphs[i-1]
+        std::vector<std::string> m_names;
+        std::vector<knn_graph_cds_type> m_graphs;
+        std::shared_ptr<knn_cache> m_cache; //Decoded lists of the graphs (optional, not serialized)
+
+        void copy(const knn_index &o) {
+            m_stamp = o.m_stamp;
+            m_graph = o.m_graph;
+            m_names = o.m_names;
+            m_graphs = o.m_graphs;
+            m_cache = o.m_cache;
+        }
+
+    public:
+
+        knn_index() = default;
+
+        /**
+         *
+         * @param g     Default KNN graph
+         * @param max_k Maximum k of the graph
+         */
+        knn_index(const knn_graph_type &g, const size_type max_k) : m_graph(g, max_k) {}
+
+        //Component without neighbours, it keeps the place of the KNN graph in an index stored without it
+        static knn_index empty(const stamp_type &stamp){
+            knn_index r(knn_graph_type(1), 1);
+            r.m_stamp = stamp;
+            return r;
+        }
+
+        //! Copy constructor
+        knn_index(const knn_index &o) {
+            copy(o);
+        }
+
+        //! Move constructor
+        knn_index(knn_index &&o) {
+            *this = std::move(o);
+        }
+
+        //! Copy Operator=
+        knn_index &operator=(const knn_index &o) {
+            if (this != &o) {
+                copy(o);
+            }
+            return *this;
+        }
+
+        //! Move Operator=
+        knn_index &operator=(knn_index &&o) {
+            if (this != &o) {
+                m_stamp = o.m_stamp;
+                m_graph = std::move(o.m_graph);
+                m_names = std::move(o.m_names);
+                m_graphs = std::move(o.m_graphs);
+                m_cache = std::move(o.m_cache);
+            }
+            return *this;
+        }
+
+        void swap(knn_index &o) {
+            std::swap(m_stamp, o.m_stamp);
+            std::swap(m_graph, o.m_graph);
+            std::swap(m_names, o.m_names);
+            std::swap(m_graphs, o.m_graphs);
+            std::swap(m_cache, o.m_cache);
+        }
+
+        //Component without neighbours, as the one made by empty
+        inline bool is_empty() const {
+            return m_graphs.empty() && m_graph.nodes <= 1;
+        }
+
+        inline const stamp_type& stamp() const {
+            return m_stamp;
+        }
+
+        inline void set_stamp(const stamp_type &stamp){
+            m_stamp = stamp;
+        }
+
+        /**
+         * Adds a named KNN graph (another embedding space) over the same nodes. The similarity patterns
+         * choose it with k<k>@name (see graph_id).
+         *
+         * @param name  Name of the graph
+         * @param g     KNN graph
+         * @param max_k Maximum k of the graph
+         */
+        void add_graph(const std::string &name, const knn_graph_type &g, const size_type max_k){
+            std::cout << "Building KNN " << name << " with nodes=" << g.size() << " and max_k=" << max_k << std::endl;
+            m_names.push_back(name);
+            m_graphs.emplace_back(knn_graph_cds_type(g, max_k));
+            std::cout << " Done." << std::endl;
+        }
+
+        //Number of KNN graphs, the default one included
+        inline size_type graphs() const {
+            return m_graphs.size() + 1;
+        }
+
+        //Identifier of a KNN graph for the queries: 0 for the default one ("") and -1ULL if there is none
+        size_type graph_id(const std::string &name) const {
+            if(name.empty()) return 0;
+            for(size_type i = 0; i < m_names.size(); ++i){
+                if(m_names[i] == name) return i + 1;
+            }
+            return -1ULL;
+        }
+
+        inline const std::vector<std::string>& names() const {
+            return m_names;
+        }
+
+        inline knn_graph_cds_type& graph(const size_type g){
+            return (g == 0) ? m_graph : m_graphs[g-1];
+        }
+
+        inline const knn_graph_cds_type& graph(const size_type g) const {
+            return (g == 0) ? m_graph : m_graphs[g-1];
+        }
+
+        inline size_type max_k(const size_type g) const {
+            return graph(g).max_k;
+        }
+
+        inline size_type nodes(const size_type g) const {
+            return graph(g).nodes;
+        }
+
+        //Largest number of nodes of the graphs
+        size_type max_nodes() const {
+            size_type r = 0;
+            for(size_type g = 0; g < graphs(); ++g){
+                r = std::max(r, nodes(g));
+            }
+            return r;
+        }
+
+        inline void intersection_iter(value_type x, size_type k1, size_type k2,
+                                      intersection_iterator_type &it, const size_type g = 0){
+            graph(g).beg_intersection_iterator(x, k1, k2, it);
+        }
+
+        inline void range_iter(value_type x, size_type k, bool subject,
+                               range_iterator_type &it, const size_type g = 0){
+            graph(g).beg_range_iterator(x, k, subject, it);
+        }
+
+        inline void intersection_helper(value_type x, size_type k1, size_type k2,
+                                        intersection_helper_type &it, const size_type g = 0){
+            knn_graph_cds_type &gr = graph(g);
+            gr.beg_intersection_helper(x, k1, k2, it.helper());
+            mutual_list_type mutual;
+            if(!it.is_empty() && gr.mutual().list(x, k1, k2, mutual)){
+                it.set_list(mutual);
+            }else if(m_cache && !it.is_empty()){
+                it.set_list(m_cache->get(g, x, k1, k2, knn_cache::intersection,
+                                         [&it](knn_cache::list_type &l){ it.decode(l); }));
+            }else{
+                it.reset_list();
+            }
+        }
+
+        inline void range_helper(value_type x, size_type k, bool subject,
+                                 range_helper_type &it, const size_type g = 0){
+            graph(g).beg_range_helper(x, k, subject, it.helper());
+            if(m_cache && !it.is_empty()){
+                it.set_list(m_cache->get(g, x, k, 0, subject ? knn_cache::forward : knn_cache::inverse,
+                                         [&it](knn_cache::list_type &l){ it.decode(l); }));
+            }else{
+                it.reset_list();
+            }
+        }
+
+        /**
+         * Keeps the decoded lists of the graphs in a cache shared by all the queries (and threads) that
+         * use this component.
+         *
+         * @param budget    Maximum number of bytes of the cache (0 removes it)
+         * @param shards    Number of shards of the cache, each one with its own lock
+         */
+        void set_cache(const size_type budget, const size_type shards = 16){
+            if(budget == 0){
+                m_cache.reset();
+            }else{
+                m_cache = std::make_shared<knn_cache>(budget, shards);
+            }
+        }
+
+        inline const knn_cache* cache() const {
+            return m_cache.get();
+        }
+
+        /**
+         * Precomputed intersection of the k1 neighbours and the k2 reverse neighbours of x (see mutual_knn).
+         *
+         * @return  False if it was not precomputed for k1 and k2
+         */
+        inline bool mutual(value_type x, size_type k1, size_type k2, mutual_list_type &l, const size_type g = 0){
+            return graph(g).mutual().list(x, k1, k2, l);
+        }
+
+        //Precomputes the mutual neighbours of every graph for the given values of k (see knn_graph_cds::build_mutual)
+        inline void build_mutual(const std::vector<size_type> &ks){
+            for(size_type g = 0; g < graphs(); ++g){
+                graph(g).build_mutual(ks);
+            }
+        }
+
+        //k such that y is the k-th nearest neighbour of x (0 if it is not a neighbour)
+        inline size_type rank(value_type x, value_type y, const size_type g = 0){
+            return graph(g).neighbour_rank(x, y);
+        }
+
+        //k restricted to the neighbours of x whose distance is below t
+        inline size_type k_within(value_type x, size_type k, double t, const size_type g = 0){
+            return std::min(k, graph(g).k_within(x, t));
+        }
+
+        //Checks if y is a neighbour of x whose distance is below t
+        inline bool distance_below(value_type x, value_type y, double t, const size_type g = 0){
+            return graph(g).distance_below(x, y, t);
+        }
+
+        //Intersections of the k1 neighbours and the k2 reverse neighbours of each anchor (sorted) at once.
+        //It needs the anchors in advance, the queries use intersection_helper with one anchor at a time.
+        inline void batch_intersection(const std::vector<value_type> &anchors, size_type k1, size_type k2,
+                                       std::vector<std::vector<value_type>> &out, const size_type g = 0){
+            graph(g).batch_intersection(anchors, k1, k2, out);
+        }
+
+        //! Serializes the named graphs, the index stores them after its optional sections
+        size_type serialize_named(std::ostream &out, sdsl::structure_tree_node *v = nullptr) const {
+            size_type written_bytes = 0;
+            size_type n_graphs = m_graphs.size();
+            written_bytes += sdsl::write_member(n_graphs, out, v, "n_knn_graphs");
+            for(size_type i = 0; i < n_graphs; ++i){
+                written_bytes += sdsl::write_member(m_names[i], out, v, "knn_name");
+                written_bytes += m_graphs[i].serialize(out, v, "knn_graph_cds_" + m_names[i]);
+            }
+            return written_bytes;
+        }
+
+        void load_named(std::istream &in) {
+            size_type n_graphs = 0;
+            sdsl::read_member(n_graphs, in);
+            m_names.resize(n_graphs);
+            m_graphs.resize(n_graphs);
+            for(size_type i = 0; i < n_graphs; ++i){
+                sdsl::read_member(m_names[i], in);
+                m_graphs[i].load(in);
+            }
+        }
+
+        //! Serializes the data structure into the given ostream
+        size_type serialize(std::ostream &out, sdsl::structure_tree_node *v = nullptr, std::string name = "") const {
+            sdsl::structure_tree_node *child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
+            size_type written_bytes = 0;
+            written_bytes += format::write_header(format::knn_index_magic, format::knn_index_version, out, child);
+            written_bytes += sdsl::write_member(m_stamp.id_space, out, child, "id_space");
+            written_bytes += m_graph.serialize(out, child, "knn_graph_cds");
+            written_bytes += serialize_named(out, child);
+            sdsl::structure_tree::add_size(child, written_bytes);
+            return written_bytes;
+        }
+
+        void load(std::istream &in) {
+            auto version = format::read_header(format::knn_index_magic, in);
+            if(version == 0){
+                in.setstate(std::ios::failbit);
+                return;
+            }
+            if(version == 1){
+                size_type n_triples = 0, max_s = 0, max_p = 0, max_o = 0;
+                sdsl::read_member(n_triples, in);
+                sdsl::read_member(max_s, in);
+                sdsl::read_member(max_p, in);
+                sdsl::read_member(max_o, in);
+                m_stamp.id_space = stamp_type::legacy(n_triples, max_s, max_p, max_o);
+            }else{
+                sdsl::read_member(m_stamp.id_space, in);
+            }
+            m_graph.load(in);
+            load_named(in);
+        }
+
+        /**
+         * Reads a component stored with store_to_file.
+         *
+         * @return  False if the file cannot be read or it is not a KNN component
+         */
+        bool load_from_file(const std::string &file){
+            std::ifstream in(file, std::ios::binary);
+            if(!in) return false;
+            load(in);
+            return (bool) in;
+        }
+
+        bool store_to_file(const std::string &file) const {
+            std::ofstream out(file, std::ios::binary | std::ios::trunc);
+            if(!out) return false;
+            serialize(out);
+            return (bool) out;
+        }
+
+        void print(){
+            m_graph.print_structure();
+        }
+    };
+}
+
+#endif //RING_KNN_INDEX_HPP
@@ -53,8 +53,13 @@ bool sort_sec(const std::pair<uint32_t, uint32_t> &a,
 }
 
 
+//Adds the pair of a line to the KNN lists. If knn_dist is not null, it keeps the distances aligned with knn_sim
+//and it has to be the same vector for all the lines. The lines are expected in increasing order of distance,
+//since the neighbours of each entity are appended in the order of the lines and the distance lists have to be
+//sorted (see knn_graph_cds::k_within).
 void get_data(const std::string &line, std::vector<std::vector<uint32_t>> &knn_sim,
-                   std::unordered_map<uint32_t, uint32_t> &entities, uint32_t &id, uint32_t k){
+              std::vector<std::vector<double>> *knn_dist,
+              std::unordered_map<uint32_t, uint32_t> &entities, uint32_t &id, uint32_t k){
 
     auto i1 = line.find('\'')+1;
     auto j1 = line.find('#');
@@ -64,7 +69,9 @@ void get_data(const std::string &line, std::vector<std::vector<uint32_t>> &knn_s
     auto j3 = line.find(')', i3);
     auto e1_s = line.substr(i1, j1-i1+1);
     auto e2_s = line.substr(i2, j2-i2+1);
-    auto d_s = line.substr(i3, j3-i3+1);
+    //The distance is the last field of the tuple
+    auto i4 = line.rfind(',', j3)+1;
+    auto d_s = line.substr(i4, j3-i4);
     data_type data;
     uint32_t id1, id2;
     data.e1 = std::stoi(e1_s);
@@ -73,6 +80,7 @@ void get_data(const std::string &line, std::vector<std::vector<uint32_t>> &knn_s
         entities.insert({data.e1, ++id});
         id1 = id;
         knn_sim.emplace_back();
+        if(knn_dist) knn_dist->emplace_back();
     }else{
         id1 = it1->second;
     }
@@ -82,17 +90,33 @@ void get_data(const std::string &line, std::vector<std::vector<uint32_t>> &knn_s
         entities.insert({data.e2, ++id});
         id2 = id;
         knn_sim.emplace_back();
+        if(knn_dist) knn_dist->emplace_back();
     }else{
         id2 = it2->second;
     }
+    data.d = std::stod(d_s);
     if(knn_sim[id1-1].size() < k){
         knn_sim[id1-1].emplace_back(id2);
+        if(knn_dist) (*knn_dist)[id1-1].emplace_back(data.d);
     }
     if(knn_sim[id2-1].size() < k){
         knn_sim[id2-1].emplace_back(id1);
+        if(knn_dist) (*knn_dist)[id2-1].emplace_back(data.d);
     }
 }
 
+void get_data(const std::string &line, std::vector<std::vector<uint32_t>> &knn_sim,
+              std::vector<std::vector<double>> &knn_dist,
+              std::unordered_map<uint32_t, uint32_t> &entities, uint32_t &id, uint32_t k){
+    get_data(line, knn_sim, &knn_dist, entities, id, k);
+}
+
+//Without the distances
+void get_data(const std::string &line, std::vector<std::vector<uint32_t>> &knn_sim,
+              std::unordered_map<uint32_t, uint32_t> &entities, uint32_t &id, uint32_t k){
+    get_data(line, knn_sim, nullptr, entities, id, k);
+}
+
 void map_to_file(const std::string &file_name, std::unordered_map<uint32_t, uint32_t> &map, bool append = false){
 
     std::vector<std::pair<uint32_t , uint32_t>> pairs(map.begin(), map.end());
@@ -124,6 +148,20 @@ void knn_graph_wikidata(const std::string &file_name, const std::vector<std::vec
     }
 }
 
+//Writes the distances in the format of <dataset>-knn-dist.dat (see dataset_io.hpp)
+void knn_dist_wikidata(const std::string &file_name, const std::vector<std::vector<double>> &dist){
+
+    std::ofstream out(file_name);
+    out.precision(9);
+    for(uint64_t i = 0; i < dist.size(); ++i){
+        for(uint64_t j = 0; j < dist[i].size(); ++j){
+            out << dist[i][j];
+            if(j < dist[i].size()-1) out << " ";
+        }
+        out << std::endl;
+    }
+}
+
 
 
 
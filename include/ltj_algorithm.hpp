@@ -28,6 +28,7 @@
 #include <ltj_iterator.hpp>
 #include <gao_simple.hpp>
 #include <gao_adaptive.hpp>
+#include <ltj_count.hpp>
 
 namespace ring_ltj {
 
@@ -246,6 +247,25 @@ namespace ring_ltj {
         };
 
 
+        /**
+         *
+         * @param timeout_seconds   Timeout in seconds
+         * @return                  Number of results (partial if the timeout is reached)
+         */
+        size_type count(const size_type timeout_seconds = 0){
+            if(m_is_empty) return 0;
+            time_point_type start = std::chrono::high_resolution_clock::now();
+            auto check = [start, timeout_seconds](){
+                if(timeout_seconds == 0) return true;
+                time_point_type stop = std::chrono::high_resolution_clock::now();
+                auto sec = std::chrono::duration_cast<std::chrono::seconds>(stop-start).count();
+                return sec <= (int64_t) timeout_seconds;
+            };
+            auto seek_fn = [this](const var_type x_j, value_type c){ return seek(x_j, c); };
+            bool ok = true;
+            return ltj_count::count_rec(0, m_gao, m_var_to_iterators, seek_fn, check, ok);
+        };
+
         /**
          *
          * @param x_j   Variable
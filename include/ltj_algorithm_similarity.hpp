@@ -25,7 +25,7 @@
 
 #include <triple_pattern.hpp>
 #include <ring_similarity.hpp>
-#include <ltj_iterator.hpp>
+#include <ltj_iterator_delta.hpp>
 #include <ltj_iterator_similarity.hpp>
 #include <ltj_iterator_uni_similarity.hpp>
 #include <gao_adaptive_sim_v3.hpp>
@@ -33,12 +33,21 @@
 #include <gao_adaptive_sim_basic.hpp>
 #include <descriptor.hpp>
 #include <hash_vector.hpp>
+#include <ltj_iterator_ref.hpp>
+#include <parallel.hpp>
+#include <result_sink.hpp>
+#include <query_governor.hpp>
+#include <ltj_count.hpp>
+#include <memory>
+#include <atomic>
+#include <limits>
+#include <mutex>
 
 namespace ring_ltj {
 
     template<class ring_t = ring_similarity<>,
              class var_t = uint8_t, class cons_t = uint64_t,
-             class gao_t = gao::gao_adaptive_sim_v3<ring_t, var_t, cons_t> >
+             class gao_t = gao::gao_adaptive_sim_v3<ring_t, var_t, cons_t>>
     class ltj_algorithm_similarity {
 
     public:
@@ -48,12 +57,16 @@ namespace ring_ltj {
         typedef ring_t ring_type;
         typedef cons_t const_type;
         typedef gao_t gao_type;
+        typedef typename ring_type::knn_ptr_type knn_ptr_type;
+        typedef typename ring_type::delta_ptr_type delta_ptr_type;
         typedef ltj_iterator_base<var_type, const_type> ltj_iter_type;
         typedef std::vector<const_type> const_vec_type;
-        typedef ltj_iterator<ring_type, var_type, const_type> ltj_iter_basic_type;
+        typedef typename gao_type::ltj_iter_basic_type ltj_iter_basic_type;
         typedef ltj_iterator_similarity<ring_type, var_type, const_type> ltj_iter_bi_similarity_type;
         typedef ltj_iterator_uni_similarity<ring_type, var_type, const_type> ltj_iter_uni_similarity_type;
         typedef std::unordered_map<var_type, std::vector<ltj_iter_type*>> var_to_iterators_type;
+        typedef ltj_iterator_virtual_ref<ring_type, var_type, const_type> iter_ref_type;
+        typedef std::vector<std::vector<iter_ref_type>> var_to_refs_type; //iterators of each variable used by the search
 
         typedef std::unordered_map<var_type, size_type> kr_pos_type; //to fingerprint
         typedef std::unordered_set<const_vec_type, ::hash::hash_vector, ::hash::equal_vector> kr_table_type;
@@ -63,6 +76,13 @@ namespace ring_ltj {
 
         typedef std::unordered_map<pair_term_pattern, std::pair<size_type, size_type>, hash_pair_term_pattern> sim_table_type;
 
+        //Triple patterns of the basic, unidirectional and bidirectional similarity iterators
+        typedef struct {
+            std::vector<size_type> basic;
+            std::vector<size_type> uni_similarity;
+            std::vector<std::pair<size_type, size_type>> bi_similarity;
+        } plan_type;
+
         typedef struct {
             tuple_type tuple_base;
             std::vector<value_type> kr_values;
@@ -74,30 +94,69 @@ namespace ring_ltj {
         const std::vector<triple_pattern>* m_ptr_triple_patterns;
         gao_type m_gao;
         ring_type* m_ptr_ring;
+        knn_ptr_type m_knn; //KNN component of the query, the same one for all its iterators
+        delta_ptr_type m_delta; //Updated triples of the query, the same ones for all its basic iterators
         std::vector<ltj_iter_basic_type> m_iterators_basic;
         std::vector<ltj_iter_bi_similarity_type> m_iterators_bi_similarity;
         std::vector<ltj_iter_uni_similarity_type> m_iterators_uni_similarity;
         var_to_iterators_type m_var_to_iterators;
+        var_to_refs_type m_var_to_refs;
         bool m_is_empty = false;
+        size_type m_num_vars = 0;
 
         kr_pos_type m_kr_pos;
         kr_table_type m_kr_table;
 
+        //Cursor (see next_batch): bound levels of the search and the action pending on them
+        typedef struct {
+            var_type var;
+            std::vector<iter_ref_type>* itrs;
+            value_type c;
+            bool lonely;
+        } frame_type;
+        std::vector<frame_type> m_frames;
+        tuple_type m_cursor_tuple;
+        bool m_cursor_started = false;
+        bool m_cursor_open = true; //true: open the next level, false: next value of the last one
+        bool m_cursor_done = false;
+
+        //Prepared queries
+        bool m_prepared = false;
+        plan_type m_plan;
+        bool m_has_gao_prepared = false;
+        gao_type m_gao_prepared;
+
         void copy(const ltj_algorithm_similarity &o) {
             m_ptr_triple_patterns = o.m_ptr_triple_patterns;
             m_gao = o.m_gao;
             m_ptr_ring = o.m_ptr_ring;
+            m_knn = o.m_knn;
+            m_delta = o.m_delta;
             m_iterators_basic = o.m_iterators_basic;
             m_iterators_bi_similarity = o.m_iterators_bi_similarity;
             m_iterators_uni_similarity = o.m_iterators_uni_similarity;
             m_var_to_iterators = o.m_var_to_iterators;
+            m_var_to_refs = o.m_var_to_refs;
             m_is_empty = o.m_is_empty;
+            m_num_vars = o.m_num_vars;
             m_kr_pos = o.m_kr_pos;
             m_kr_table = o.m_kr_table;
+            m_prepared = o.m_prepared;
+            m_plan = o.m_plan;
+            m_has_gao_prepared = o.m_has_gao_prepared;
+            m_gao_prepared = o.m_gao_prepared;
+            m_frames = o.m_frames;
+            m_cursor_tuple = o.m_cursor_tuple;
+            m_cursor_started = o.m_cursor_started;
+            m_cursor_open = o.m_cursor_open;
+            m_cursor_done = o.m_cursor_done;
         }
 
 
-        inline void add_var_to_iterator(const var_type var, ltj_iter_type* ptr_iterator){
+        template<class iterator_t>
+        inline void add_var_to_iterator(const var_type var, iterator_t* ptr_iterator){
+            if(m_var_to_refs.size() <= var) m_var_to_refs.resize(var + 1);
+            m_var_to_refs[var].emplace_back(ptr_iterator);
             auto it =  m_var_to_iterators.find(var);
             if(it != m_var_to_iterators.end()){
                 it->second.push_back(ptr_iterator);
@@ -178,27 +237,90 @@ namespace ring_ltj {
             return false;
         }
 
-    public:
-
-
-        ltj_algorithm_similarity() = default;
-
-        ltj_algorithm_similarity(const std::vector<triple_pattern>* triple_patterns, ring_type* ring,
-                                 const size_type num_vars){
-
-            m_ptr_triple_patterns = triple_patterns;
-            m_ptr_ring = ring;
+        /**
+         * Builds the iterators of a plan and links each variable to its iterators.
+         *
+         * @param plan          Triple patterns of each iterator (see make_plan)
+         * @param stop_empty    Stops at the first empty iterator
+         * @return              False if one of the iterators is empty
+         */
+        bool build_iterators(const plan_type &plan, const bool stop_empty){
+            m_var_to_refs.resize(m_num_vars);
+            m_iterators_basic.reserve(plan.basic.size());
+            m_iterators_bi_similarity.reserve(plan.bi_similarity.size());
+            m_iterators_uni_similarity.reserve(plan.uni_similarity.size());
+            for(size_type i_basic = 0; i_basic < plan.basic.size(); ++i_basic){
+                const auto& triple = m_ptr_triple_patterns->at(plan.basic[i_basic]);
+                m_iterators_basic.emplace_back(basic_iterator_builder<ltj_iter_basic_type>::build(&triple, m_ptr_ring, m_delta));
+                if(m_iterators_basic[i_basic].is_empty()){
+                    m_is_empty = true;
+                    if(stop_empty) return false;
+                }
+                //For each variable we add the pointers to its iterators
+                if(triple.o_is_variable()){
+                    add_var_to_iterator(triple.term_o.value, &(m_iterators_basic[i_basic]));
+                }
+                if(triple.p_is_variable()){
+                    add_var_to_iterator(triple.term_p.value, &(m_iterators_basic[i_basic]));
+                }
+                if(triple.s_is_variable()){
+                    add_var_to_iterator(triple.term_s.value, &(m_iterators_basic[i_basic]));
+                }
+            }
 
-            sim_table_type sim_table;
+            //Bulding similarity iterators
+            for(size_type i_uni_sim = 0; i_uni_sim < plan.uni_similarity.size(); ++i_uni_sim){
+                //Unidirectional
+                const auto& triple = m_ptr_triple_patterns->at(plan.uni_similarity[i_uni_sim]);
+                m_iterators_uni_similarity.emplace_back(ltj_iter_uni_similarity_type (&triple, m_ptr_ring, m_knn));
+                if(m_iterators_uni_similarity[i_uni_sim].is_empty()){
+                    m_is_empty = true;
+                    if(stop_empty) return false;
+                }
+                //For each variable we add the pointers to its iterators
+                if(triple.o_is_variable()){
+                    add_var_to_iterator(triple.term_o.value, &(m_iterators_uni_similarity[i_uni_sim]));
+                }
+                if(triple.s_is_variable()){
+                    add_var_to_iterator(triple.term_s.value, &(m_iterators_uni_similarity[i_uni_sim]));
+                }
+            }
+            for(size_type i_bi_sim = 0; i_bi_sim < plan.bi_similarity.size(); ++i_bi_sim){
+                //Bidirectional
+                const auto& triple = m_ptr_triple_patterns->at(plan.bi_similarity[i_bi_sim].first);
+                m_iterators_bi_similarity.emplace_back(
+                        ltj_iter_bi_similarity_type(&triple,
+                                                    &m_ptr_triple_patterns->at(plan.bi_similarity[i_bi_sim].second),
+                                                    m_ptr_ring, m_knn));
+                if(m_iterators_bi_similarity[i_bi_sim].is_empty()){
+                    m_is_empty = true;
+                    if(stop_empty) return false;
+                }
+                //For each variable we add the pointers to its iterators
+                if(triple.o_is_variable()){
+                    add_var_to_iterator(triple.term_o.value, &(m_iterators_bi_similarity[i_bi_sim]));
+                }
+                if(triple.s_is_variable()){
+                    add_var_to_iterator(triple.term_s.value, &(m_iterators_bi_similarity[i_bi_sim]));
+                }
+            }
+            return !m_is_empty;
+        }
 
+    public:
 
-            size_type i_basic = 0,  i_similarity = 0, i_triple = 0;
-            m_iterators_basic.reserve(m_ptr_triple_patterns->size());
-            m_iterators_bi_similarity.reserve(m_ptr_triple_patterns->size());
-            m_iterators_uni_similarity.reserve(m_ptr_triple_patterns->size());
-            for(const auto& triple : *m_ptr_triple_patterns){
-                //Bulding iterators
+        /**
+         * Decides the iterator of each triple pattern. The similarity patterns (x k y) and (y k x) on the
+         * same KNN graph share a bidirectional iterator, the remaining ones get a unidirectional iterator.
+         */
+        static plan_type make_plan(const std::vector<triple_pattern> &triple_patterns){
+            plan_type plan;
+            std::vector<sim_table_type> sim_tables; //One by KNN graph
+            size_type i_triple = 0;
+            for(const auto& triple : triple_patterns){
                 if(triple.is_similarity()){
+                    if(triple.graph >= sim_tables.size()) sim_tables.resize(triple.graph + 1);
+                    sim_table_type &sim_table = sim_tables[triple.graph];
                     pair_term_pattern so {triple.term_s, triple.term_o};
                     auto it = sim_table.find(so);
                     if(it != sim_table.end()){
@@ -210,76 +332,119 @@ namespace ring_ltj {
                         pair_term_pattern so_rev {triple.term_o, triple.term_s};
                         sim_table.insert({so_rev, positions});
                     }
-                    ++i_similarity;
                 }else{
-                    m_iterators_basic.emplace_back(ltj_iter_basic_type(&triple, m_ptr_ring));
-                    if(m_iterators_basic[i_basic].is_empty()){
-                        m_is_empty = true;
-                        return;
-                    }
-                    //For each variable we add the pointers to its iterators
-                    if(triple.o_is_variable()){
-                        add_var_to_iterator(triple.term_o.value, &(m_iterators_basic[i_basic]));
-                    }
-                    if(triple.p_is_variable()){
-                        add_var_to_iterator(triple.term_p.value, &(m_iterators_basic[i_basic]));
-                    }
-                    if(triple.s_is_variable()){
-                        add_var_to_iterator(triple.term_s.value, &(m_iterators_basic[i_basic]));
-                    }
-                    ++i_basic;
+                    plan.basic.push_back(i_triple);
                 }
                 ++i_triple;
             }
-
-            //Bulding similarity iterators
-            size_type i_uni_sim = 0, i_bi_sim = 0;
-            for(const auto &sim : sim_table){
-                auto fst_triple = sim.second.first;
-                auto sec_triple = sim.second.second;
-                if(sec_triple == -1ULL){
-                    //Unidirectional
-                    m_iterators_uni_similarity.emplace_back(
-                            ltj_iter_uni_similarity_type (&m_ptr_triple_patterns->at(fst_triple), m_ptr_ring));
-                    if(m_iterators_uni_similarity[i_uni_sim].is_empty()){
-                        m_is_empty = true;
-                        return;
-                    }
-                    const auto& triple = m_ptr_triple_patterns->at(fst_triple);
-                    //For each variable we add the pointers to its iterators
-                    if(triple.o_is_variable()){
-                        add_var_to_iterator(triple.term_o.value, &(m_iterators_uni_similarity[i_uni_sim]));
-                    }
-                    if(triple.s_is_variable()){
-                        add_var_to_iterator(triple.term_s.value, &(m_iterators_uni_similarity[i_uni_sim]));
-                    }
-                    ++i_uni_sim;
-                }else{
-                    //Bidirectional
-                    m_iterators_bi_similarity.emplace_back(
-                            ltj_iter_bi_similarity_type(&m_ptr_triple_patterns->at(fst_triple),
-                                                               &m_ptr_triple_patterns->at(sec_triple), m_ptr_ring));
-                    if(m_iterators_bi_similarity[i_bi_sim].is_empty()){
-                        m_is_empty = true;
-                        return;
-                    }
-                    const auto& triple = m_ptr_triple_patterns->at(fst_triple);
-                    //For each variable we add the pointers to its iterators
-                    if(triple.o_is_variable()){
-                        add_var_to_iterator(triple.term_o.value, &(m_iterators_bi_similarity[i_bi_sim]));
-                    }
-                    if(triple.s_is_variable()){
-                        add_var_to_iterator(triple.term_s.value, &(m_iterators_bi_similarity[i_bi_sim]));
+            for(const auto &sim_table : sim_tables){
+                for(const auto &sim : sim_table){
+                    if(sim.second.second == -1ULL){
+                        plan.uni_similarity.push_back(sim.second.first);
+                    }else{
+                        plan.bi_similarity.emplace_back(sim.second.first, sim.second.second);
                     }
-                    ++i_bi_sim;
                 }
             }
+            return plan;
+        }
+
+
+        ltj_algorithm_similarity() = default;
+
+        ltj_algorithm_similarity(const std::vector<triple_pattern>* triple_patterns, ring_type* ring,
+                                 const size_type num_vars)
+                : ltj_algorithm_similarity(triple_patterns, ring, num_vars, ring->knn(), ring->delta()) {}
+
+        /**
+         * Builds the algorithm with the given KNN component and delta of the ring instead of the current
+         * ones, so several algorithms (e.g. the threads of join_parallel) see the same triples.
+         */
+        ltj_algorithm_similarity(const std::vector<triple_pattern>* triple_patterns, ring_type* ring,
+                                 const size_type num_vars, knn_ptr_type knn, delta_ptr_type delta){
 
+            m_ptr_triple_patterns = triple_patterns;
+            m_ptr_ring = ring;
+            m_knn = std::move(knn);
+            m_delta = std::move(delta);
+            m_num_vars = num_vars;
+
+            if(!build_iterators(make_plan(*m_ptr_triple_patterns), true)) return;
             m_gao = gao_type(&m_iterators_basic, &m_iterators_uni_similarity, &m_iterators_bi_similarity,
                              &m_var_to_iterators, num_vars, m_ptr_ring);
 
         }
 
+        /**
+         * Builds the algorithm of a prepared query (see prepared_query.hpp). The plan has to be computed
+         * from the patterns and every iterator is built even if one of them is empty, so the constants
+         * can be replaced later with rebind.
+         */
+        ltj_algorithm_similarity(const std::vector<triple_pattern>* triple_patterns, ring_type* ring,
+                                 const size_type num_vars, const plan_type &plan){
+
+            m_ptr_triple_patterns = triple_patterns;
+            m_ptr_ring = ring;
+            m_knn = ring->knn();
+            m_delta = ring->delta();
+            m_num_vars = num_vars;
+            m_plan = plan;
+            m_prepared = true;
+
+            if(!build_iterators(m_plan, false)) return;
+            m_gao = gao_type(&m_iterators_basic, &m_iterators_uni_similarity, &m_iterators_bi_similarity,
+                             &m_var_to_iterators, num_vars, m_ptr_ring);
+            m_gao_prepared = m_gao;
+            m_has_gao_prepared = true;
+        }
+
+        /**
+         * Replaces the constants of a prepared query. The patterns have the same variables and the same
+         * kinds of terms as the ones used to build the algorithm, and they usually are the same vector
+         * with other constants. The iterators are rebuilt in place, so the pointers of the variables to
+         * their iterators and the structure of the GAO are kept; only the weights of the GAO are updated.
+         *
+         * @return False if the algorithm was not built from a plan
+         */
+        bool rebind(const std::vector<triple_pattern>* triple_patterns){
+            if(!m_prepared) return false;
+            m_ptr_triple_patterns = triple_patterns;
+            m_knn = m_ptr_ring->knn(); //The component and the delta may have been replaced since the last binding
+            m_delta = m_ptr_ring->delta();
+            m_is_empty = false;
+            for(size_type i = 0; i < m_plan.basic.size(); ++i){
+                m_iterators_basic[i] = basic_iterator_builder<ltj_iter_basic_type>::build(
+                        &m_ptr_triple_patterns->at(m_plan.basic[i]), m_ptr_ring, m_delta);
+                if(m_iterators_basic[i].is_empty()) m_is_empty = true;
+            }
+            for(size_type i = 0; i < m_plan.uni_similarity.size(); ++i){
+                m_iterators_uni_similarity[i] = ltj_iter_uni_similarity_type(
+                        &m_ptr_triple_patterns->at(m_plan.uni_similarity[i]), m_ptr_ring, m_knn);
+                if(m_iterators_uni_similarity[i].is_empty()) m_is_empty = true;
+            }
+            for(size_type i = 0; i < m_plan.bi_similarity.size(); ++i){
+                m_iterators_bi_similarity[i] = ltj_iter_bi_similarity_type(
+                        &m_ptr_triple_patterns->at(m_plan.bi_similarity[i].first),
+                        &m_ptr_triple_patterns->at(m_plan.bi_similarity[i].second), m_ptr_ring, m_knn);
+                if(m_iterators_bi_similarity[i].is_empty()) m_is_empty = true;
+            }
+            m_kr_table.clear();
+            m_frames.clear();
+            m_cursor_started = false;
+            if(m_is_empty) return true;
+            if(m_has_gao_prepared){
+                m_gao = m_gao_prepared;
+                m_gao.update_weights();
+            }else{
+                //The first binding was empty
+                m_gao = gao_type(&m_iterators_basic, &m_iterators_uni_similarity, &m_iterators_bi_similarity,
+                                 &m_var_to_iterators, m_num_vars, m_ptr_ring);
+                m_gao_prepared = m_gao;
+                m_has_gao_prepared = true;
+            }
+            return true;
+        }
+
         //! Copy constructor
         ltj_algorithm_similarity(const ltj_algorithm_similarity &o) {
             copy(o);
@@ -304,13 +469,26 @@ namespace ring_ltj {
                 m_ptr_triple_patterns = std::move(o.m_ptr_triple_patterns);
                 m_gao = std::move(o.m_gao);
                 m_ptr_ring = std::move(o.m_ptr_ring);
+                m_knn = std::move(o.m_knn);
+                m_delta = std::move(o.m_delta);
                 m_iterators_basic = std::move(o.m_iterators_basic);
                 m_iterators_bi_similarity = std::move(o.m_iterators_bi_similarity);
                 m_iterators_uni_similarity = std::move(o.m_iterators_uni_similarity);
                 m_var_to_iterators = std::move(o.m_var_to_iterators);
+                m_var_to_refs = std::move(o.m_var_to_refs);
                 m_is_empty = o.m_is_empty;
+                m_num_vars = o.m_num_vars;
                 m_kr_pos = o.m_kr_pos;
                 m_kr_table = o.m_kr_table;
+                m_prepared = o.m_prepared;
+                m_plan = std::move(o.m_plan);
+                m_has_gao_prepared = o.m_has_gao_prepared;
+                m_gao_prepared = std::move(o.m_gao_prepared);
+                m_frames = std::move(o.m_frames);
+                m_cursor_tuple = std::move(o.m_cursor_tuple);
+                m_cursor_started = o.m_cursor_started;
+                m_cursor_open = o.m_cursor_open;
+                m_cursor_done = o.m_cursor_done;
             }
             return *this;
         }
@@ -319,13 +497,26 @@ namespace ring_ltj {
             std::swap(m_ptr_triple_patterns, o.m_ptr_triple_patterns);
             std::swap(m_gao, o.m_gao);
             std::swap(m_ptr_ring, o.m_ptr_ring);
+            std::swap(m_knn, o.m_knn);
+            std::swap(m_delta, o.m_delta);
             std::swap(m_iterators_basic, o.m_iterators_basic);
             std::swap(m_iterators_bi_similarity, o.m_iterators_bi_similarity);
             std::swap(m_iterators_uni_similarity, o.m_iterators_uni_similarity);
             std::swap(m_var_to_iterators, o.m_var_to_iterators);
+            std::swap(m_var_to_refs, o.m_var_to_refs);
             std::swap(m_is_empty, o.m_is_empty);
+            std::swap(m_num_vars, o.m_num_vars);
             std::swap(m_kr_pos, o.m_kr_pos);
             std::swap(m_kr_table, o.m_kr_table);
+            std::swap(m_prepared, o.m_prepared);
+            std::swap(m_plan, o.m_plan);
+            std::swap(m_has_gao_prepared, o.m_has_gao_prepared);
+            std::swap(m_gao_prepared, o.m_gao_prepared);
+            std::swap(m_frames, o.m_frames);
+            std::swap(m_cursor_tuple, o.m_cursor_tuple);
+            std::swap(m_cursor_started, o.m_cursor_started);
+            std::swap(m_cursor_open, o.m_cursor_open);
+            std::swap(m_cursor_done, o.m_cursor_done);
         }
 
 
@@ -333,53 +524,49 @@ namespace ring_ltj {
          *
          * @param j                 Index of the variable
          * @param tuple             Tuple of the current search
-         * @param res               Results
-         * @param start             Initial time to check timeout
+         * @param res               Sink of the results (see result_sink.hpp)
+         * @param gov               Governor of the query (timeout, cancellation and memory of the results)
          * @param limit_results     Limit of results
-         * @param timeout_seconds   Timeout in seconds
          */
-        bool search(const size_type j, tuple_type &tuple, std::vector<tuple_type> &res,
-                    const time_point_type start,
-                    const size_type limit_results = 0, const size_type timeout_seconds = 0){
+        template<class sink_t>
+        bool search(const size_type j, tuple_type &tuple, sink_t &res,
+                    query_governor &gov, const size_type limit_results = 0){
 
-            //(Optional) Check timeout
-            if(timeout_seconds > 0){
-                time_point_type stop = std::chrono::high_resolution_clock::now();
-                auto sec = std::chrono::duration_cast<std::chrono::seconds>(stop-start).count();
-                if(sec > timeout_seconds) return false;
-            }
+            //(Optional) Check timeout and cancellation (amortized by the governor)
+            if(!gov.step()) return false;
 
             //(Optional) Check limit
             if(limit_results > 0 && res.size() == limit_results) return false;
 
             if(j == m_gao.size()){
                 //Report results
-                res.emplace_back(tuple);
+                res.add(tuple);
+                if(!gov.add_result()) return false;
                 //std::cout << "Adding tuple" << std::endl;
             }else{
                 var_type x_j = m_gao.next();
                // std::cout << "At: " << j << " var: " << (uint64_t) x_j << std::endl;
-                std::vector<ltj_iter_type*>& itrs = m_var_to_iterators[x_j];
+                std::vector<iter_ref_type>& itrs = m_var_to_refs[x_j];
                 bool ok;
-                if(itrs.size() == 1 && itrs[0]->in_last_level()) {//Lonely variables
+                if(itrs.size() == 1 && itrs[0].in_last_level()) {//Lonely variables
 
-                    value_type c = itrs[0]->seek_last(x_j);
+                    value_type c = itrs[0].seek_last(x_j);
                     //std::cout << "Results: " << results.size() << std::endl;
                     //std::cout << "Seek (last level): (" << (uint64_t) x_j << ": " << c << ")" <<std::endl;
                     while (c != 0) { //If empty c=0
                         //1. Adding result to tuple
                         tuple[x_j] = c;
                         //2. Going down in the trie by setting x_j = c (\mu(t_i) in paper)
-                        itrs[0]->down(x_j, c);
+                        itrs[0].down(x_j, c);
                         m_gao.down();
                         //2. Search with the next variable x_{j+1}
-                        ok = search(j + 1, tuple, res, start, limit_results, timeout_seconds);
+                        ok = search(j + 1, tuple, res, gov, limit_results);
                         if(!ok) return false;
                         //4. Going up in the trie by removing x_j = c
-                        itrs[0]->up(x_j);
+                        itrs[0].up(x_j);
                         m_gao.up();
 
-                        c = itrs[0]->seek_last_next(x_j);
+                        c = itrs[0].seek_last_next(x_j);
                     }
 
                 }else {
@@ -390,16 +577,16 @@ namespace ring_ltj {
                         tuple[x_j] = c;
                         //std::cout << "Set " << (uint64_t) x_j << " to " << c << std::endl;
                         //2. Going down in the tries by setting x_j = c (\mu(t_i) in paper)
-                        for (ltj_iter_type* iter : itrs) {
-                            iter->down(x_j, c);
+                        for (iter_ref_type &iter : itrs) {
+                            iter.down(x_j, c);
                         }
                         m_gao.down();
                         //3. Search with the next variable x_{j+1}
-                        ok = search(j + 1, tuple, res, start, limit_results, timeout_seconds);
+                        ok = search(j + 1, tuple, res, gov, limit_results);
                         if(!ok) return false;
                         //4. Going up in the tries by removing x_j = c
-                        for (ltj_iter_type *iter : itrs) {
-                            iter->up(x_j);
+                        for (iter_ref_type &iter : itrs) {
+                            iter.up(x_j);
                         }
                         m_gao.up();
                         //5. Next constant for x_j
@@ -420,13 +607,357 @@ namespace ring_ltj {
         */
         void join(std::vector<tuple_type> &res,
                   const size_type limit_results = 0, const size_type timeout_seconds = 0){
-            if(m_is_empty) return;
-            time_point_type start = std::chrono::high_resolution_clock::now();
+            result_sink::vector_sink<tuple_type> sink(res);
+            join(sink, limit_results, timeout_seconds);
+        };
+
+        /**
+        *
+        * @param sink              Sink of the results (see result_sink.hpp)
+        * @param limit_results     Limit of results
+        * @param timeout_seconds   Timeout in seconds
+        */
+        template<class sink_t>
+        void join(sink_t &sink,
+                  const size_type limit_results = 0, const size_type timeout_seconds = 0){
+            query_governor gov(timeout_seconds);
+            join(sink, gov, limit_results);
+        };
+
+        /**
+        *
+        * @param sink              Sink of the results (see result_sink.hpp)
+        * @param gov               Governor of the query, its status tells why the join stopped
+        * @param limit_results     Limit of results
+        */
+        template<class sink_t>
+        void join(sink_t &sink, query_governor &gov, const size_type limit_results = 0){
+            if(m_is_empty){
+                gov.stop(true);
+                return;
+            }
             tuple_type t(m_gao.size());
-            search(0, t, res, start, limit_results, timeout_seconds);
+            gov.stop(search(0, t, sink, gov, limit_results));
         };
 
 
+        /**
+         * Solves the first variable of the GAO only for the constants in [lo, hi) and the remaining
+         * variables as in search.
+         *
+         * @param lo                Lower bound of the first variable (included)
+         * @param hi                Upper bound of the first variable (excluded)
+         * @param res               Sink of the results
+         * @param gov               Governor of the query
+         * @param limit_results     Limit of results
+         * @return                  False if the search was interrupted by the limit or the governor
+         */
+        template<class sink_t>
+        bool search_range(const value_type lo, const value_type hi, sink_t &res,
+                          query_governor &gov, const size_type limit_results = 0){
+
+            tuple_type tuple(m_gao.size());
+            var_type x_j = m_gao.next();
+            std::vector<iter_ref_type>& itrs = m_var_to_refs[x_j];
+            bool ok;
+            value_type c = seek(x_j, lo);
+            while (c != 0 && c < hi) { //If empty c=0
+                //1. Adding result to tuple
+                tuple[x_j] = c;
+                //2. Going down in the tries by setting x_j = c (\mu(t_i) in paper)
+                for (iter_ref_type &iter : itrs) {
+                    iter.down(x_j, c);
+                }
+                m_gao.down();
+                //3. Search with the next variable x_{j+1}
+                ok = search(1, tuple, res, gov, limit_results);
+                if(!ok) return false;
+                //4. Going up in the tries by removing x_j = c
+                for (iter_ref_type &iter : itrs) {
+                    iter.up(x_j);
+                }
+                m_gao.up();
+                //5. Next constant for x_j
+                c = seek(x_j, c + 1);
+            }
+            m_gao.done();
+            return true;
+        }
+
+        /**
+         * Parallel version of join. The values of the first variable of the GAO are split into chunks
+         * that are solved by a pool of threads, each one with its own copy of the iterators and the GAO.
+         * Results are reported in the same order as join. If the search is interrupted the results are a
+         * prefix of the ones of join: the chunks solved after the first unfinished one are dropped.
+         *
+         * @param res               Results (a vector or a sink)
+         * @param threads           Number of threads
+         * @param limit_results     Limit of results
+         * @param timeout_seconds   Timeout in seconds
+         */
+        void join_parallel(std::vector<tuple_type> &res, const size_type threads,
+                           const size_type limit_results = 0, const size_type timeout_seconds = 0){
+            result_sink::vector_sink<tuple_type> sink(res);
+            join_parallel(sink, threads, limit_results, timeout_seconds);
+        }
+
+        template<class sink_t>
+        void join_parallel(sink_t &res, const size_type threads,
+                           const size_type limit_results = 0, const size_type timeout_seconds = 0){
+            query_governor gov(timeout_seconds);
+            join_parallel(res, threads, gov, limit_results);
+        }
+
+        /**
+         * Each thread works with a copy of the governor (see query_governor::fork), the copies are merged
+         * into gov at the end.
+         */
+        template<class sink_t>
+        void join_parallel(sink_t &res, const size_type threads, query_governor &gov,
+                           const size_type limit_results = 0){
+            if(m_is_empty){
+                gov.stop(true);
+                return;
+            }
+            if(threads <= 1 || m_gao.size() == 0){
+                join(res, gov, limit_results);
+                return;
+            }
+
+            //1. Domain of the first variable
+            var_type x_0 = m_gao.next();
+            std::vector<iter_ref_type>& itrs = m_var_to_refs[x_0];
+            bool lonely = (itrs.size() == 1 && itrs[0].in_last_level());
+            if(lonely){ //Nothing to split
+                m_gao.done();
+                join(res, gov, limit_results);
+                return;
+            }
+            value_type lo = seek(x_0);
+            if(lo == 0){
+                m_gao.done();
+                gov.stop(true);
+                return;
+            }
+
+            //2. Chunks of the first variable. The identifiers between its first value and the largest one
+            //   of the ring are probed at regular steps, and each probe starts a chunk at the next value
+            //   of the variable, so the domain is never enumerated. The chunks can be uneven, but there
+            //   are many more chunks than threads and they are taken dynamically, so a thread that finishes
+            //   early takes the next one while another is still solving a heavy value. The last chunk has
+            //   no upper bound (the delta can insert larger identifiers).
+            value_type hi = std::max<value_type>(lo, std::max(m_ptr_ring->max_s, std::max(m_ptr_ring->max_p,
+                                                                                          m_ptr_ring->max_o)));
+            size_type n_probes = threads * 64;
+            std::vector<value_type> bounds(1, lo);
+            for(size_type i = 1; i < n_probes; ++i){
+                value_type v = lo + (hi - lo + 1) * i / n_probes;
+                if(v <= bounds.back()) continue;
+                value_type c = seek(x_0, v);
+                if(c == 0) break;
+                if(c > bounds.back()) bounds.push_back(c);
+            }
+            m_gao.done();
+            bounds.push_back(std::numeric_limits<value_type>::max());
+            size_type n_chunks = bounds.size() - 1;
+            std::vector<result_sink::flat_sink<value_type>> chunk_res(n_chunks);
+            std::vector<std::unique_ptr<ltj_algorithm_similarity>> workers(threads);
+            //The limit of results of gov bounds the results of all the threads together
+            std::atomic<size_type> gov_results(gov.results());
+            std::vector<query_governor> govs;
+            for(size_type t = 0; t < threads; ++t){
+                govs.emplace_back(gov.fork(&gov_results));
+            }
+            std::atomic<size_type> last_chunk(n_chunks);
+            std::atomic<bool> stopped(false);
+
+            //3. The results of a chunk are kept in a flat buffer until the previous chunks have been
+            //   reported, then they go to res in order and the buffer is released
+            std::mutex flush_mutex;
+            std::vector<bool> done(n_chunks, false);
+            size_type next_flush = 0;
+            bool full = false;
+            tuple_type tuple(m_gao.size());
+            auto flush = [&](){
+                for(; next_flush < n_chunks && done[next_flush]; ++next_flush){
+                    auto &chunk = chunk_res[next_flush];
+                    for(size_type k = 0; k < chunk.size() && !full; ++k){
+                        if(limit_results > 0 && res.size() == limit_results){
+                            full = true;
+                            break;
+                        }
+                        std::copy(chunk.tuple(k), chunk.tuple(k) + tuple.size(), tuple.begin());
+                        res.add(tuple);
+                    }
+                    chunk = result_sink::flat_sink<value_type>();
+                }
+            };
+
+            parallel::for_each(n_chunks, threads, [&](size_type i, size_type t){
+                if(stopped.load() || i > last_chunk.load()) return;
+                if(!workers[t]){
+                    workers[t].reset(new ltj_algorithm_similarity(m_ptr_triple_patterns, m_ptr_ring, m_num_vars,
+                                                                  m_knn, m_delta));
+                }
+                value_type c_lo = bounds[i];
+                value_type c_hi = bounds[i + 1];
+                chunk_res[i] = result_sink::flat_sink<value_type>(m_gao.size());
+                bool ok = workers[t]->search_range(c_lo, c_hi, chunk_res[i], govs[t], limit_results);
+                if(!ok){
+                    //The state of the worker is not restored after an interruption
+                    workers[t].reset();
+                    if(limit_results > 0 && chunk_res[i].size() == limit_results){
+                        //The following chunks are not needed
+                        size_type cur = last_chunk.load();
+                        while(i < cur && !last_chunk.compare_exchange_weak(cur, i));
+                    }else{
+                        stopped.store(true);
+                    }
+                }
+                std::lock_guard<std::mutex> lock(flush_mutex);
+                done[i] = true;
+                flush();
+                if(full) stopped.store(true);
+            });
+            for(const auto &g : govs){
+                gov.merge(g);
+            }
+
+            //4. The chunks solved after the first unfinished one are dropped, so the results stay in the
+            //   order of join (flush already stopped there)
+            gov.stop(!full);
+        };
+
+
+        /**
+         *
+         * @param timeout_seconds   Timeout in seconds
+         * @return                  Number of results (partial if the timeout is reached)
+         */
+        size_type count(const size_type timeout_seconds = 0){
+            query_governor gov(timeout_seconds);
+            return count(gov);
+        };
+
+        /**
+         *
+         * @param gov               Governor of the query, its status tells if the count is complete
+         * @return                  Number of results (partial if the governor stopped it)
+         */
+        size_type count(query_governor &gov){
+            if(m_is_empty){
+                gov.stop(true);
+                return 0;
+            }
+            auto check = [&gov](){ return gov.step(); };
+            auto seek_fn = [this](const var_type x_j, value_type c){ return seek(x_j, c); };
+            bool ok = true;
+            size_type cnt = ltj_count::count_rec(0, m_gao, m_var_to_refs, seek_fn, check, ok);
+            gov.stop(ok);
+            return cnt;
+        };
+
+        /**
+         * Restores the iterators and the GAO after a cursor and starts it again from the first result.
+         */
+        void cursor_reset(){
+            while(!m_frames.empty()){
+                frame_type &f = m_frames.back();
+                for (iter_ref_type &iter : *f.itrs) {
+                    iter.up(f.var);
+                }
+                m_gao.up();
+                m_gao.done();
+                m_frames.pop_back();
+            }
+            m_cursor_tuple.assign(m_gao.size(), 0);
+            m_cursor_started = true;
+            m_cursor_open = true;
+            m_cursor_done = m_is_empty;
+        }
+
+        inline bool cursor_done() const {
+            return m_cursor_done;
+        }
+
+        /**
+         * Iterative version of search that can be suspended and resumed. The levels of the search are kept
+         * in an explicit stack, so each call continues from the last result reported by the previous one.
+         * The results are reported in the same order as join. While a cursor is active, join and count
+         * cannot be used until cursor_reset is called.
+         *
+         * @param sink              Sink of the results (see result_sink.hpp)
+         * @param n                 Maximum number of results of this call (0 for all of them)
+         * @param timeout_seconds   Timeout of this call in seconds, the cursor can be resumed after it
+         * @return                  Number of results reported (cursor_done tells if there are more)
+         */
+        template<class sink_t>
+        size_type next_batch(sink_t &sink, const size_type n = 0, const size_type timeout_seconds = 0){
+            query_governor gov(timeout_seconds);
+            return next_batch(sink, n, gov);
+        }
+
+        /**
+         * The cursor stops when the governor does, and it can be resumed later with another governor or
+         * with the same one after calling query_governor::resume (a stopped governor stops every step).
+         */
+        template<class sink_t>
+        size_type next_batch(sink_t &sink, const size_type n, query_governor &gov){
+            if(!m_cursor_started) cursor_reset();
+            size_type added = 0;
+            while(!m_cursor_done){
+                //(Optional) Check timeout and cancellation
+                if(!gov.step()) break;
+                if(m_cursor_open){
+                    if(m_frames.size() == m_gao.size()){
+                        //Report results
+                        sink.add(m_cursor_tuple);
+                        ++added;
+                        m_cursor_open = false;
+                        if(m_frames.empty()) m_cursor_done = true;
+                        if(!gov.add_result() || added == n) break;
+                        continue;
+                    }
+                    frame_type f;
+                    f.var = m_gao.next();
+                    f.itrs = &m_var_to_refs[f.var];
+                    f.lonely = (f.itrs->size() == 1 && (*f.itrs)[0].in_last_level());
+                    f.c = f.lonely ? (*f.itrs)[0].seek_last(f.var) : seek(f.var);
+                    if(f.c == 0){
+                        //Empty level, next value of the previous one
+                        m_gao.done();
+                        m_cursor_open = false;
+                        if(m_frames.empty()) m_cursor_done = true;
+                        continue;
+                    }
+                    m_frames.push_back(f);
+                }else{
+                    frame_type &f = m_frames.back();
+                    for (iter_ref_type &iter : *f.itrs) {
+                        iter.up(f.var);
+                    }
+                    m_gao.up();
+                    f.c = f.lonely ? (*f.itrs)[0].seek_last_next(f.var) : seek(f.var, f.c + 1);
+                    if(f.c == 0){
+                        m_gao.done();
+                        m_frames.pop_back();
+                        if(m_frames.empty()) m_cursor_done = true;
+                        continue;
+                    }
+                }
+                //Binds the last level to its current value and opens the next one
+                frame_type &f = m_frames.back();
+                m_cursor_tuple[f.var] = f.c;
+                for (iter_ref_type &iter : *f.itrs) {
+                    iter.down(f.var, f.c);
+                }
+                m_gao.down();
+                m_cursor_open = true;
+            }
+            if(m_cursor_done) gov.stop(true);
+            return added;
+        }
+
         /******** Basic functions *******/
 
         /**
@@ -461,15 +992,15 @@ namespace ring_ltj {
         }*/
 
        value_type seek(const var_type x_j, value_type c=-1){
-           std::vector<ltj_iter_type*>& itrs = m_var_to_iterators[x_j];
+           std::vector<iter_ref_type>& itrs = m_var_to_refs[x_j];
            value_type c_i, c_prev = 0, i = 0, n_ok = 0;
            while (true){
                //Compute leap for each triple that contains x_j
 
                if(c == -1){
-                   c_i = itrs[i]->leap(x_j);
+                   c_i = itrs[i].leap(x_j);
                }else{
-                   c_i = itrs[i]->leap(x_j, c);
+                   c_i = itrs[i].leap(x_j, c);
                }
                if(c_i == 0) return 0; //Empty intersection
                n_ok = (c_i == c_prev) ? n_ok + 1 : 1;
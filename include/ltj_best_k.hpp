@@ -0,0 +1,240 @@
+/*
+ * ltj_best_k.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_LTJ_BEST_K_HPP
+#define RING_LTJ_BEST_K_HPP
+
+#include <triple_pattern.hpp>
+#include <result_sink.hpp>
+#include <query_governor.hpp>
+#include <vector>
+#include <algorithm>
+
+namespace ring_ltj {
+
+    /**
+     * Solves queries with best-match patterns (?x b<k> ?y). The rank of a result is the largest position
+     * of its best-match pairs in the KNN lists (y is the rank-th nearest neighbour of x). Only the k_best
+     * results with the smallest ranks are reported, in increasing order of rank; ties keep the order in
+     * which the search finds them.
+     *
+     * The query is solved with the best-match patterns turned into similarity patterns with k_sim = r for
+     * r = 1, 2, 4, ..., max_k. The round r finds every result of rank <= r, and the results of rank <= r/2
+     * are already known from the previous round (there were fewer than k_best of them). The new results
+     * are kept in a heap with the best ones that are missing. A round stops as soon as the heap is full
+     * and its worst result has the smallest rank a new result can have, and the rounds stop at the first
+     * one that fills the heap. Only k_best tuples are kept.
+     */
+    template<class ltj_algorithm_t>
+    class ltj_best_k {
+
+    public:
+        typedef ltj_algorithm_t ltj_algorithm_type;
+        typedef typename ltj_algorithm_type::ring_type ring_type;
+        typedef typename ring_type::knn_ptr_type knn_ptr_type;
+        typedef typename ltj_algorithm_type::tuple_type tuple_type;
+        typedef typename ltj_algorithm_type::value_type value_type;
+        typedef typename ltj_algorithm_type::size_type size_type;
+
+    private:
+        //Result with its rank and the position in which it was found
+        struct candidate_type {
+            size_type rank;
+            size_type order;
+            tuple_type tuple;
+
+            inline bool operator<(const candidate_type &o) const {
+                return rank < o.rank || (rank == o.rank && order < o.order);
+            }
+        };
+
+        //Keeps the best new results of a round in a heap and stops the round when they cannot improve
+        class round_sink {
+        private:
+            const ltj_best_k* m_best;
+            const knn_ptr_type* m_knn;
+            std::vector<candidate_type>* m_heap;
+            query_governor* m_gov;
+            size_type m_known_rank; //results with rank <= m_known_rank are already known
+            size_type m_need;
+            size_type* m_order;
+            size_type m_size = 0;
+            bool m_proven = false;
+
+        public:
+            round_sink(const ltj_best_k &best, const knn_ptr_type &knn, std::vector<candidate_type> &heap,
+                       query_governor &gov, const size_type known_rank, const size_type need, size_type &order)
+                    : m_best(&best), m_knn(&knn), m_heap(&heap), m_gov(&gov), m_known_rank(known_rank),
+                      m_need(need), m_order(&order) {}
+
+            inline void add(const tuple_type &tuple){
+                ++m_size;
+                size_type r = m_best->rank(tuple, *m_knn);
+                if(r <= m_known_rank) return;
+                if(m_heap->size() < m_need){
+                    m_heap->push_back(candidate_type{r, (*m_order)++, tuple});
+                    std::push_heap(m_heap->begin(), m_heap->end());
+                }else if(r < m_heap->front().rank){
+                    std::pop_heap(m_heap->begin(), m_heap->end());
+                    m_heap->back() = candidate_type{r, (*m_order)++, tuple};
+                    std::push_heap(m_heap->begin(), m_heap->end());
+                }
+                //No new result has a rank below m_known_rank + 1, and the later ones lose the ties
+                if(m_heap->size() == m_need && m_heap->front().rank <= m_known_rank + 1){
+                    m_proven = true;
+                    m_gov->stop(false);
+                }
+            }
+
+            inline size_type size() const {
+                return m_size;
+            }
+
+            inline bool proven() const {
+                return m_proven;
+            }
+        };
+
+        const std::vector<triple_pattern>* m_ptr_triple_patterns;
+        ring_type* m_ptr_ring;
+        size_type m_num_vars;
+        size_type m_k_best = 0;
+        bool m_mixed_k = false;
+        std::vector<size_type> m_best_patterns;
+
+        inline value_type term_value(const term_pattern &term, const tuple_type &tuple) const {
+            return term.is_variable ? tuple[term.value] : term.value;
+        }
+
+        //Largest rank of the best-match pairs of a tuple
+        inline size_type rank(const tuple_type &tuple, const knn_ptr_type &knn) const {
+            size_type r = 0;
+            for(const auto &i : m_best_patterns){
+                const auto &triple = m_ptr_triple_patterns->at(i);
+                r = std::max(r, knn->rank(term_value(triple.term_s, tuple),
+                                          term_value(triple.term_o, tuple), triple.graph));
+            }
+            return r;
+        }
+
+    public:
+
+        ltj_best_k() = default;
+
+        ltj_best_k(const std::vector<triple_pattern>* triple_patterns, ring_type* ring, const size_type num_vars){
+            m_ptr_triple_patterns = triple_patterns;
+            m_ptr_ring = ring;
+            m_num_vars = num_vars;
+            for(size_type i = 0; i < m_ptr_triple_patterns->size(); ++i){
+                const auto &triple = m_ptr_triple_patterns->at(i);
+                if(triple.is_best()){
+                    if(!m_best_patterns.empty() && triple.k_best != m_k_best) m_mixed_k = true;
+                    m_best_patterns.push_back(i);
+                    m_k_best = triple.k_best;
+                }
+            }
+        }
+
+        inline bool has_best() const {
+            return !m_best_patterns.empty();
+        }
+
+        //False if the best-match patterns ask for different numbers of results (join reports nothing)
+        inline bool is_valid() const {
+            return !m_mixed_k;
+        }
+
+        inline size_type k_best() const {
+            return m_k_best;
+        }
+
+        /**
+         *
+         * @param sink              Sink of the results (see result_sink.hpp)
+         * @param timeout_seconds   Timeout in seconds (the ranks are not guaranteed if it is reached)
+         * @return                  Last k_sim used for the best-match patterns
+         */
+        template<class sink_t>
+        size_type join(sink_t &sink, const size_type timeout_seconds = 0){
+            query_governor gov(timeout_seconds);
+            return join(sink, gov);
+        }
+
+        /**
+         * Each round runs with a copy of the governor, whose counters are merged into gov. The rounds stop
+         * when one of them is interrupted, then the best results found so far are reported (the ranks are
+         * not guaranteed).
+         *
+         * @param sink              Sink of the results (see result_sink.hpp)
+         * @param gov               Governor of the query, its status tells if the ranks are complete
+         * @return                  Last k_sim used for the best-match patterns
+         */
+        template<class sink_t>
+        size_type join(sink_t &sink, query_governor &gov){
+            if(m_mixed_k){
+                gov.stop(true);
+                return 0;
+            }
+            std::vector<triple_pattern> patterns = *m_ptr_triple_patterns;
+            knn_ptr_type knn = m_ptr_ring->knn();
+            size_type max_k = 1;
+            for(const auto &i : m_best_patterns){
+                max_k = std::max<size_type>(max_k, knn->max_k(patterns[i].graph));
+            }
+            const query_governor base = gov;
+            std::vector<candidate_type> known; //every result of rank <= known_rank, sorted
+            std::vector<candidate_type> heap;
+            size_type known_rank = 0, order = 0, r = 1;
+            while(true){
+                for(const auto &i : m_best_patterns){
+                    patterns[i].k_sim = r;
+                }
+                heap.clear();
+                query_governor round = base;
+                round_sink round_res(*this, knn, heap, round, known_rank, m_k_best - known.size(), order);
+                ltj_algorithm_type ltj(&patterns, m_ptr_ring, m_num_vars);
+                ltj.join(round_res, round);
+                std::sort(heap.begin(), heap.end());
+                if(round_res.proven()){
+                    gov.merge_counters(round);
+                    break;
+                }
+                gov.merge(round);
+                if(!round.is_complete() || known.size() + heap.size() == m_k_best || r == max_k) break;
+                //The round found every result of rank <= r
+                known.insert(known.end(), heap.begin(), heap.end());
+                heap.clear();
+                known_rank = r;
+                r = std::min(2*r, max_k);
+            }
+            gov.stop(true);
+            for(const auto &c : known) sink.add(c.tuple);
+            for(const auto &c : heap) sink.add(c.tuple);
+            return r;
+        }
+
+        void join(std::vector<tuple_type> &res, const size_type timeout_seconds = 0){
+            result_sink::vector_sink<tuple_type> sink(res);
+            join(sink, timeout_seconds);
+        }
+    };
+}
+
+#endif //RING_LTJ_BEST_K_HPP
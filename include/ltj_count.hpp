@@ -0,0 +1,96 @@
+/*
+ * ltj_count.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_LTJ_COUNT_HPP
+#define RING_LTJ_COUNT_HPP
+
+#include <vector>
+#include <cstdint>
+
+namespace ring_ltj {
+
+    namespace ltj_count {
+
+        //The algorithms keep their iterators by pointer or by reference wrapper
+        template<class iter_t>
+        inline iter_t& deref(iter_t *it){
+            return *it;
+        }
+
+        template<class iter_t>
+        inline iter_t& deref(iter_t &it){
+            return it;
+        }
+
+        /**
+         * Counts the results of a LTJ search without enumerating the values of the lonely variables. A lonely
+         * variable does not constrain the rest of variables, so its number of values multiplies the count of
+         * the remaining ones.
+         *
+         * @param j         Index of the variable
+         * @param gao       GAO of the search
+         * @param var_iters Iterators of each variable
+         * @param seek      seek(x_j, c) of the algorithm, c = -1 for the first value
+         * @param check     Returns false when the count has to stop (timeout, cancellation)
+         * @param ok        False if the count was interrupted by check
+         * @return          Number of results
+         */
+        template<class gao_t, class var_iters_t, class seek_t, class check_t>
+        uint64_t count_rec(const uint64_t j, gao_t &gao, var_iters_t &var_iters, seek_t &seek,
+                           check_t &check, bool &ok){
+
+            if(!check()){
+                ok = false;
+                return 0;
+            }
+
+            if(j == gao.size()) return 1;
+
+            uint64_t cnt = 0;
+            auto x_j = gao.next();
+            auto &itrs = var_iters[x_j];
+            if(itrs.size() == 1 && deref(itrs[0]).in_last_level()) {//Lonely variables
+                uint64_t n = deref(itrs[0]).count_last(x_j);
+                if(n > 0){
+                    cnt = n * count_rec(j + 1, gao, var_iters, seek, check, ok);
+                }
+            }else {
+                uint64_t c = seek(x_j, -1);
+                while (c != 0) { //If empty c=0
+                    for (auto &iter : itrs) {
+                        deref(iter).down(x_j, c);
+                    }
+                    gao.down();
+                    cnt += count_rec(j + 1, gao, var_iters, seek, check, ok);
+                    if(!ok) return cnt;
+                    for (auto &iter : itrs) {
+                        deref(iter).up(x_j);
+                    }
+                    gao.up();
+                    c = seek(x_j, c + 1);
+                }
+            }
+            gao.done();
+            return cnt;
+        }
+    }
+}
+
+#endif //RING_LTJ_COUNT_HPP
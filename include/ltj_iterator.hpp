@@ -28,7 +28,7 @@
 namespace ring_ltj {
 
     template<class ring_t, class var_t, class cons_t>
-    class ltj_iterator : public ltj_iterator_base< var_t, cons_t>{
+    class ltj_iterator final : public ltj_iterator_base< var_t, cons_t>{
 
     public:
         typedef cons_t value_type;
@@ -473,6 +473,11 @@ namespace ring_ltj {
             return m_intervals[m_level];
         }
 
+        //The triples of the iterator are the ones of interval() (see ltj_iterator_delta)
+        inline bool in_ring_interval() const{
+            return true;
+        }
+
         value_type seek_last(var_type var){
             range_type range = {m_intervals[2].left(), m_intervals[2].right()};
             if(is_variable_predicate(var)){
@@ -495,6 +500,12 @@ namespace ring_ltj {
             }
         }
 
+        //In the last level the other two terms are bound, so each triple of the interval
+        //gives a different value of var
+        size_type count_last(var_type /*var*/){
+            return m_intervals[2].size();
+        }
+
         //Solo funciona en último nivel, en otro caso habría que reajustar
         std::vector<uint64_t> seek_all(var_type var){
             if (is_variable_subject(var)){
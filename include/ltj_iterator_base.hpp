@@ -51,6 +51,14 @@ namespace ring_ltj {
         //Solo funciona en último nivel, en otro caso habría que reajustar
         virtual value_type seek_last(var_type var) = 0;
         virtual value_type seek_last_next(var_type var) = 0;
+        //Number of values of var in the last level (by default it enumerates them)
+        virtual size_type count_last(var_type var){
+            size_type cnt = 0;
+            for(value_type c = seek_last(var); c != 0; c = seek_last_next(var)){
+                ++cnt;
+            }
+            return cnt;
+        }
         //virtual std::vector<uint64_t> seek_all(var_type var) = 0;
 
         virtual descriptor get_descriptor(var_type var) = 0;
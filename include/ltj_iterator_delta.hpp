@@ -0,0 +1,365 @@
+/*
+ * ltj_iterator_delta.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_LTJ_ITERATOR_DELTA_HPP
+#define RING_LTJ_ITERATOR_DELTA_HPP
+
+#include <memory>
+#include <ltj_iterator.hpp>
+#include <delta_store.hpp>
+
+namespace ring_ltj {
+
+    /**
+     * Iterator of a triple pattern over the triples of the ring plus the inserted triples of a delta minus
+     * its deleted ones (see delta_store). Without a delta every call goes to the iterator of the ring.
+     *
+     * The iterator of the ring follows the bound values while they are in the ring. When a value only
+     * comes from the delta the ring is left behind until the search goes up again. A value of the ring is
+     * skipped if all the triples of the ring below it are deleted, which is only checked when the delta has
+     * deleted triples with that prefix.
+     *
+     * interval(), state and get_descriptor() are the ones of the iterator of the ring, so they only describe
+     * the triples of the iterator when in_ring_interval() holds. Otherwise the weights have to come from
+     * interval_length() (see utils::trait_distinct).
+     */
+    template<class ring_t, class var_t, class cons_t>
+    class ltj_iterator_delta final : public ltj_iterator_base<var_t, cons_t> {
+
+    public:
+        typedef cons_t value_type;
+        typedef var_t var_type;
+        typedef ring_t ring_type;
+        typedef uint64_t size_type;
+        typedef ltj_iterator<ring_type, var_type, value_type> ltj_iter_ring_type;
+        typedef std::shared_ptr<const delta_store> delta_ptr_type;
+
+    private:
+        ltj_iter_ring_type m_ring_iter;
+        delta_ptr_type m_delta;
+        delta_store::bound_type m_bound; //constants and bound variables
+        std::array<descriptor_type, 3> m_state;
+        size_type m_level = 0;
+        bool m_in_ring = true; //the bound values are in the ring (m_ring_iter follows them)
+        size_type m_out_level = 0; //level where the values left the ring
+        value_type m_last_value = 0; //last value returned by leap, its variable and if it was in the ring
+        var_type m_last_var = 0;
+        bool m_last_in_ring = false;
+        value_type m_last = 0; //current value of seek_last
+        bool m_is_empty = false;
+
+        void copy(const ltj_iterator_delta &o) {
+            ptr_triple_pattern = o.ptr_triple_pattern;
+            m_ring_iter = o.m_ring_iter;
+            m_delta = o.m_delta;
+            m_bound = o.m_bound;
+            m_state = o.m_state;
+            m_level = o.m_level;
+            m_in_ring = o.m_in_ring;
+            m_out_level = o.m_out_level;
+            m_last_value = o.m_last_value;
+            m_last_var = o.m_last_var;
+            m_last_in_ring = o.m_last_in_ring;
+            m_last = o.m_last;
+            m_is_empty = o.m_is_empty;
+        }
+
+        //Term of the pattern where var is (the first one if it appears twice)
+        inline uint8_t term_of(var_type var) {
+            if(is_variable_subject(var)) return delta_store::subject;
+            if(is_variable_predicate(var)) return delta_store::predicate;
+            return delta_store::object;
+        }
+
+        inline void bind(var_type var, value_type c){
+            if(is_variable_subject(var)) m_bound.bind(delta_store::subject, c);
+            if(is_variable_predicate(var)) m_bound.bind(delta_store::predicate, c);
+            if(is_variable_object(var)) m_bound.bind(delta_store::object, c);
+        }
+
+        inline void unbind(var_type var){
+            if(is_variable_subject(var)) m_bound.unbind(delta_store::subject);
+            if(is_variable_predicate(var)) m_bound.unbind(delta_store::predicate);
+            if(is_variable_object(var)) m_bound.unbind(delta_store::object);
+        }
+
+        //Triples of the ring with the bound values that are not deleted
+        inline size_type ring_length() const {
+            if(!m_in_ring) return 0;
+            //The deleted triples are in the ring, so a fully bound one is the only triple
+            size_type n = (m_bound.size() == 3) ? 1 : m_ring_iter.interval_length();
+            return n - m_delta->count_deleted(m_bound);
+        }
+
+        //All the triples of the ring with the bound values and var = c are deleted
+        bool deleted(var_type var, value_type c){
+            delta_store::bound_type bound = m_bound;
+            bound.bind(term_of(var), c);
+            size_type n_deleted = m_delta->count_deleted(bound);
+            if(n_deleted == 0) return false;
+            //The deleted triples are in the ring, so a fully bound one is the only triple
+            if(m_level == 2) return true;
+            m_ring_iter.down(var, c);
+            size_type n = m_ring_iter.interval_length();
+            m_ring_iter.up(var);
+            return n == n_deleted;
+        }
+
+        value_type next(var_type var, value_type c){
+            uint8_t target = term_of(var);
+            while(true){
+                value_type r = 0;
+                if(m_in_ring){
+                    r = (c == 0) ? m_ring_iter.leap(var) : m_ring_iter.leap(var, c);
+                }
+                value_type d = m_delta->next_inserted(m_bound, target, c);
+                value_type v = (r == 0) ? d : ((d == 0) ? r : std::min(r, d));
+                if(v == 0) return 0;
+                m_last_value = v;
+                m_last_var = var;
+                m_last_in_ring = (v == r);
+                if(v == d || !deleted(var, v)) return v;
+                c = v + 1;
+            }
+        }
+
+    public:
+        const size_type& level = m_level;
+        const std::array<descriptor_type, 3>& state = m_state;
+        const triple_pattern *ptr_triple_pattern;
+
+        ltj_iterator_delta() = default;
+
+        ltj_iterator_delta(const triple_pattern *triple, ring_type *ring, delta_ptr_type delta = delta_ptr_type())
+                : m_ring_iter(triple, ring) {
+            ptr_triple_pattern = triple;
+            m_delta = (delta && !delta->empty()) ? std::move(delta) : delta_ptr_type();
+            m_state = m_ring_iter.state;
+            if(!m_delta){
+                m_level = m_ring_iter.level;
+                m_is_empty = m_ring_iter.is_empty();
+                return;
+            }
+            if(!triple->s_is_variable()) m_bound.bind(delta_store::subject, triple->term_s.value);
+            if(!triple->p_is_variable()) m_bound.bind(delta_store::predicate, triple->term_p.value);
+            if(!triple->o_is_variable()) m_bound.bind(delta_store::object, triple->term_o.value);
+            m_level = m_bound.size();
+            m_in_ring = !m_ring_iter.is_empty();
+            m_is_empty = (ring_length() == 0 && m_delta->count_inserted(m_bound) == 0);
+        }
+
+        //! Copy constructor
+        ltj_iterator_delta(const ltj_iterator_delta &o) {
+            copy(o);
+        }
+
+        //! Move constructor
+        ltj_iterator_delta(ltj_iterator_delta &&o) {
+            *this = std::move(o);
+        }
+
+        //! Copy Operator=
+        ltj_iterator_delta &operator=(const ltj_iterator_delta &o) {
+            if (this != &o) {
+                copy(o);
+            }
+            return *this;
+        }
+
+        //! Move Operator=
+        ltj_iterator_delta &operator=(ltj_iterator_delta &&o) {
+            if (this != &o) {
+                ptr_triple_pattern = o.ptr_triple_pattern;
+                m_ring_iter = std::move(o.m_ring_iter);
+                m_delta = std::move(o.m_delta);
+                m_bound = o.m_bound;
+                m_state = o.m_state;
+                m_level = o.m_level;
+                m_in_ring = o.m_in_ring;
+                m_out_level = o.m_out_level;
+                m_last_value = o.m_last_value;
+                m_last_var = o.m_last_var;
+                m_last_in_ring = o.m_last_in_ring;
+                m_last = o.m_last;
+                m_is_empty = o.m_is_empty;
+            }
+            return *this;
+        }
+
+        void swap(ltj_iterator_delta &o) {
+            std::swap(ptr_triple_pattern, o.ptr_triple_pattern);
+            m_ring_iter.swap(o.m_ring_iter);
+            std::swap(m_delta, o.m_delta);
+            std::swap(m_bound, o.m_bound);
+            std::swap(m_state, o.m_state);
+            std::swap(m_level, o.m_level);
+            std::swap(m_in_ring, o.m_in_ring);
+            std::swap(m_out_level, o.m_out_level);
+            std::swap(m_last_value, o.m_last_value);
+            std::swap(m_last_var, o.m_last_var);
+            std::swap(m_last_in_ring, o.m_last_in_ring);
+            std::swap(m_last, o.m_last);
+            std::swap(m_is_empty, o.m_is_empty);
+        }
+
+        inline bool is_variable_subject(var_type var) {
+            return ptr_triple_pattern->term_s.is_variable && var == ptr_triple_pattern->term_s.value;
+        }
+
+        inline bool is_variable_predicate(var_type var) {
+            return ptr_triple_pattern->term_p.is_variable && var == ptr_triple_pattern->term_p.value;
+        }
+
+        inline bool is_variable_object(var_type var) {
+            return ptr_triple_pattern->term_o.is_variable && var == ptr_triple_pattern->term_o.value;
+        }
+
+        inline bool is_empty(){
+            return m_is_empty;
+        }
+
+        void down(var_type var, size_type c) {
+            if(!m_delta){
+                m_ring_iter.down(var, c);
+                m_level = m_ring_iter.level;
+                m_state = m_ring_iter.state;
+                return;
+            }
+            if(m_level > 2) return;
+            if(m_in_ring){
+                bool in_ring = (c == m_last_value && var == m_last_var) ? m_last_in_ring : (m_ring_iter.leap(var, c) == c);
+                if(in_ring){
+                    m_ring_iter.down(var, c);
+                    m_state = m_ring_iter.state;
+                }else{
+                    m_in_ring = false;
+                    m_out_level = m_level;
+                }
+            }
+            bind(var, c);
+            ++m_level;
+        };
+
+        void down(var_type var, size_type c, size_type /*k*/){
+            down(var, c);
+        };
+
+        void up(var_type var) {
+            if(!m_delta){
+                m_ring_iter.up(var);
+                m_level = m_ring_iter.level;
+                return;
+            }
+            if(m_level == 0) return;
+            --m_level;
+            unbind(var);
+            if(m_in_ring){
+                m_ring_iter.up(var);
+            }else if(m_level == m_out_level){
+                m_in_ring = true;
+            }
+        };
+
+        value_type leap(var_type var) {
+            if(!m_delta) return m_ring_iter.leap(var);
+            return next(var, 0);
+        }
+
+        value_type leap(var_type var, size_type c) {
+            if(!m_delta) return m_ring_iter.leap(var, c);
+            return next(var, c);
+        }
+
+        inline bool in_last_level() const{
+            return m_level == 2;
+        }
+
+        //Triples with the bound values: the ones of the ring that are not deleted plus the inserted ones
+        inline size_type interval_length() const{
+            if(!m_delta) return m_ring_iter.interval_length();
+            return ring_length() + m_delta->count_inserted(m_bound);
+        }
+
+        //Interval of the ring, it may not match the bound values (see in_ring_interval)
+        inline const bwt_interval& interval() const{
+            return m_ring_iter.interval();
+        }
+
+        //The triples of the iterator are the ones of interval(), although some of them may be deleted
+        inline bool in_ring_interval() const{
+            return !m_delta || (m_in_ring && m_delta->count_inserted(m_bound) == 0);
+        }
+
+        value_type seek_last(var_type var){
+            if(!m_delta) return m_ring_iter.seek_last(var);
+            m_last = next(var, 0);
+            return m_last;
+        }
+
+        value_type seek_last_next(var_type var){
+            if(!m_delta) return m_ring_iter.seek_last_next(var);
+            if(m_last == 0) return 0;
+            m_last = next(var, m_last + 1);
+            return m_last;
+        }
+
+        size_type count_last(var_type var){
+            if(!m_delta) return m_ring_iter.count_last(var);
+            return ltj_iterator_base<var_t, cons_t>::count_last(var);
+        }
+
+        //Descriptor of the iterator of the ring (see in_ring_interval)
+        inline descriptor get_descriptor(var_type var){
+            return m_ring_iter.get_descriptor(var);
+        }
+
+        size_type is_similarity(){
+            return 0;
+        }
+
+        //Delta used by the iterator (null if there is none)
+        inline const delta_ptr_type& delta() const {
+            return m_delta;
+        }
+    };
+
+    /**
+     * Builds the basic iterators of a query (see ltj_algorithm_similarity). Only ltj_iterator_delta uses the
+     * delta of the ring; any other iterator only sees the triples of the ring.
+     */
+    template<class iterator_t>
+    struct basic_iterator_builder {
+        template<class ring_t>
+        static iterator_t build(const triple_pattern *triple, ring_t *ring, const std::shared_ptr<const delta_store> &){
+            return iterator_t(triple, ring);
+        }
+    };
+
+    template<class ring_t, class var_t, class cons_t>
+    struct basic_iterator_builder<ltj_iterator_delta<ring_t, var_t, cons_t>> {
+        static ltj_iterator_delta<ring_t, var_t, cons_t> build(const triple_pattern *triple, ring_t *ring,
+                                                               const std::shared_ptr<const delta_store> &delta){
+            return ltj_iterator_delta<ring_t, var_t, cons_t>(triple, ring, delta);
+        }
+    };
+
+}
+
+#endif //RING_LTJ_ITERATOR_DELTA_HPP
@@ -0,0 +1,60 @@
+/*
+ * ltj_iterator_ref.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_LTJ_ITERATOR_REF_HPP
+#define RING_LTJ_ITERATOR_REF_HPP
+
+#include <ltj_iterator_base.hpp>
+
+namespace ring_ltj {
+
+    /**
+     * Reference to an iterator through its base class. Every call is virtual.
+     */
+    template<class ring_t, class var_t, class cons_t>
+    class ltj_iterator_virtual_ref {
+
+    public:
+        typedef cons_t value_type;
+        typedef var_t var_type;
+        typedef uint64_t size_type;
+        typedef ltj_iterator_base<var_type, value_type> ltj_iter_type;
+
+    private:
+        ltj_iter_type* m_ptr;
+
+    public:
+        ltj_iterator_virtual_ref() = default;
+
+        template<class iterator_t>
+        ltj_iterator_virtual_ref(iterator_t* ptr) : m_ptr(ptr) {}
+
+        inline void down(const var_type var, const size_type c){ m_ptr->down(var, c); }
+        inline void up(const var_type var){ m_ptr->up(var); }
+        inline value_type leap(const var_type var){ return m_ptr->leap(var); }
+        inline value_type leap(const var_type var, const size_type c){ return m_ptr->leap(var, c); }
+        inline bool in_last_level() const { return m_ptr->in_last_level(); }
+        inline value_type seek_last(const var_type var){ return m_ptr->seek_last(var); }
+        inline value_type seek_last_next(const var_type var){ return m_ptr->seek_last_next(var); }
+        inline size_type count_last(const var_type var){ return m_ptr->count_last(var); }
+    };
+}
+
+#endif //RING_LTJ_ITERATOR_REF_HPP
@@ -28,7 +28,7 @@
 namespace ring_ltj {
 
     template<class ring_t, class var_t, class cons_t>
-    class ltj_iterator_similarity : public ltj_iterator_base<var_t, cons_t> {
+    class ltj_iterator_similarity final : public ltj_iterator_base<var_t, cons_t> {
 
     public:
         typedef cons_t value_type;
@@ -36,18 +36,23 @@ namespace ring_ltj {
         typedef ring_t ring_type;
         typedef typename ring_type::knn_intersection_iterator_type knn_iterator_type;
         typedef typename ring_type::knn_intersection_helper_type knn_helper_type;
+        typedef typename ring_type::knn_mutual_list_type knn_mutual_list_type;
+        typedef typename ring_type::knn_ptr_type knn_ptr_type;
         typedef uint64_t size_type;
         //enum state_type {s, p, o};
         //std::vector<value_type> leap_result_type;
 
     private:
         ring_type *m_ptr_ring; //TODO: should be const
+        knn_ptr_type m_knn; //KNN component taken when the iterator is built (see ring_similarity::knn)
         bwt_interval m_i;
         std::array<value_type, 2> m_consts;
         std::array<descriptor_type, 2> m_state;
         size_type m_level = 0;
         knn_iterator_type m_knn_iter;
         knn_helper_type m_knn_help;
+        knn_mutual_list_type m_knn_last; //Precomputed list of the last level (if any)
+        size_type m_knn_last_pos = 0;
         bool m_is_empty = false;
         //std::stack<state_type> m_states;
 
@@ -55,15 +60,45 @@ namespace ring_ltj {
         void copy(const ltj_iterator_similarity &o) {
             ptr_triple_patterns = o.ptr_triple_patterns;
             m_ptr_ring = o.m_ptr_ring;
+            m_knn = o.m_knn;
             m_i = o.m_i;
             m_consts = o.m_consts;
             m_state = o.m_state;
             m_level = o.m_level;
             m_knn_iter = o.m_knn_iter;
             m_knn_help = o.m_knn_help;
+            m_knn_last = o.m_knn_last;
+            m_knn_last_pos = o.m_knn_last_pos;
             m_is_empty = o.m_is_empty;
         }
 
+        //KNN graph of the pair (both patterns use the same one, see ltj_algorithm_similarity::make_plan)
+        inline size_type graph() const {
+            return ptr_triple_patterns[0]->graph;
+        }
+
+        //Distance threshold of the pair, the smallest one of both patterns (negative if there is none)
+        inline double threshold() const {
+            double t = -1;
+            for(const auto &triple : ptr_triple_patterns){
+                if(triple->has_threshold() && (t < 0 || triple->d_max < t)) t = triple->d_max;
+            }
+            return t;
+        }
+
+        //k of the list of x restricted to the neighbours below the threshold. The distance is symmetric,
+        //so the pairs of the reverse list are also pruned by the threshold of the list of x.
+        inline size_type forward_k(const value_type x, const size_type k){
+            double t = threshold();
+            if(t < 0) return k;
+            return m_knn->k_within(x, k, t, graph());
+        }
+
+        //k of the reverse list (patterns with only a threshold take every neighbour)
+        inline size_type reverse_k(const size_type k){
+            return std::min<size_type>(k, m_knn->max_k(graph()));
+        }
+
     public:
         //const value_type &cur_s = m_cur_s;
         //const value_type &cur_o = m_cur_o;
@@ -71,10 +106,19 @@ namespace ring_ltj {
 
         ltj_iterator_similarity() = default;
 
-        ltj_iterator_similarity(const triple_pattern *triple1, const triple_pattern *triple2, ring_type *ring) {
+        /**
+         *
+         * @param triple1   Similarity pattern
+         * @param triple2   Pattern with the subject and the object of triple1 swapped
+         * @param ring      Index
+         * @param knn       KNN component of the query (the current one of the index if it is empty)
+         */
+        ltj_iterator_similarity(const triple_pattern *triple1, const triple_pattern *triple2, ring_type *ring,
+                                knn_ptr_type knn = knn_ptr_type()) {
             ptr_triple_patterns[0] = triple1;
             ptr_triple_patterns[1] = triple2;
             m_ptr_ring = ring;
+            m_knn = knn ? std::move(knn) : ring->knn();
             m_i = m_ptr_ring->open_POS();
             //Init current values and intervals according to the triple
             if (!ptr_triple_patterns[0]->s_is_variable() && !ptr_triple_patterns[0]->o_is_variable()) {
@@ -90,8 +134,8 @@ namespace ring_ltj {
                 m_consts[0] = ptr_triple_patterns[0]->term_s.value;
                 m_state[0] = s;
 
-                m_ptr_ring->knn_intersection_helper(m_consts[0], ptr_triple_patterns[0]->k_sim,
-                                                  ptr_triple_patterns[1]->k_sim, m_knn_help);
+                m_knn->intersection_helper(m_consts[0], forward_k(m_consts[0], ptr_triple_patterns[0]->k_sim),
+                                                  reverse_k(ptr_triple_patterns[1]->k_sim), m_knn_help, graph());
                 if(m_knn_help.is_empty()){
                     m_is_empty = true;
                     return;
@@ -117,8 +161,8 @@ namespace ring_ltj {
                 }*/
 
                 m_consts[0] = ptr_triple_patterns[0]->term_s.value;
-                m_ptr_ring->knn_intersection_helper(m_consts[0], ptr_triple_patterns[0]->k_sim,
-                                                  ptr_triple_patterns[1]->k_sim, m_knn_help);
+                m_knn->intersection_helper(m_consts[0], forward_k(m_consts[0], ptr_triple_patterns[0]->k_sim),
+                                                  reverse_k(ptr_triple_patterns[1]->k_sim), m_knn_help, graph());
                 if(m_knn_help.is_empty()){
                     m_is_empty = true;
                     return;
@@ -136,10 +180,10 @@ namespace ring_ltj {
                     return;
                 }*/
                 m_consts[0] = ptr_triple_patterns[0]->term_o.value;
-                //m_ptr_ring->knn_intersection_iter(m_consts[0], ptr_triple_patterns[0]->k_sim,
+                //m_knn->intersection_iter(m_consts[0], ptr_triple_patterns[0]->k_sim,
                 //                                  ptr_triple_patterns[1]->k_sim, m_knn_iter);
-                m_ptr_ring->knn_intersection_helper(m_consts[0], ptr_triple_patterns[1]->k_sim,
-                                                  ptr_triple_patterns[0]->k_sim, m_knn_help);
+                m_knn->intersection_helper(m_consts[0], forward_k(m_consts[0], ptr_triple_patterns[1]->k_sim),
+                                                  reverse_k(ptr_triple_patterns[0]->k_sim), m_knn_help, graph());
                 if(m_knn_help.is_empty()){
                     m_is_empty = true;
                     return;
@@ -172,12 +216,15 @@ namespace ring_ltj {
             if (this != &o) {
                 ptr_triple_patterns = std::move(o.ptr_triple_patterns);
                 m_ptr_ring = std::move(o.m_ptr_ring);
+                m_knn = std::move(o.m_knn);
                 m_i = std::move(o.m_i);
                 m_consts = std::move(o.m_consts);
                 m_state = std::move(o.m_state);
                 m_level = o.m_level;
                 m_knn_iter = std::move(o.m_knn_iter);
                 m_knn_help = std::move(o.m_knn_help);
+                m_knn_last = o.m_knn_last;
+                m_knn_last_pos = o.m_knn_last_pos;
                 m_is_empty = o.m_is_empty;
             }
             return *this;
@@ -187,12 +234,15 @@ namespace ring_ltj {
             // m_bp.swap(bp_support.m_bp); use set_vector to set the supported bit_vector
             std::swap(ptr_triple_patterns, o.ptr_triple_patterns);
             std::swap(m_ptr_ring, o.m_ptr_ring);
+            std::swap(m_knn, o.m_knn);
             m_i.swap(o.m_i);
             std::swap(m_consts, o.m_consts);
             std::swap(m_state, o.m_state);
             std::swap(m_level, o.m_level);
             std::swap(m_knn_iter, o.m_knn_iter);
             std::swap(m_knn_help, o.m_knn_help);
+            std::swap(m_knn_last, o.m_knn_last);
+            std::swap(m_knn_last_pos, o.m_knn_last_pos);
             std::swap(m_is_empty, o.m_is_empty);
         }
 
@@ -213,16 +263,17 @@ namespace ring_ltj {
         void down(var_type var, size_type c) { //Go down in the trie
             if (m_level > 1) return;
             if (m_level == 0) {
-                //m_ptr_ring->knn_intersection_iter(c, ptr_triple_patterns[0]->k_sim,
+                //The anchors come one by one, m_knn_help reuses its stack (no allocation per anchor)
+                //m_knn->intersection_iter(c, ptr_triple_patterns[0]->k_sim,
                 //                                  ptr_triple_patterns[1]->k_sim, m_knn_iter);
                 if(is_variable_subject(var)){
                     m_state[m_level] = s;
-                    m_ptr_ring->knn_intersection_helper(c, ptr_triple_patterns[0]->k_sim,
-                                                      ptr_triple_patterns[1]->k_sim, m_knn_help);
+                    m_knn->intersection_helper(c, forward_k(c, ptr_triple_patterns[0]->k_sim),
+                                                      reverse_k(ptr_triple_patterns[1]->k_sim), m_knn_help, graph());
                 }else{
                     m_state[m_level] = o;
-                    m_ptr_ring->knn_intersection_helper(c, ptr_triple_patterns[1]->k_sim,
-                                                      ptr_triple_patterns[0]->k_sim, m_knn_help);
+                    m_knn->intersection_helper(c, forward_k(c, ptr_triple_patterns[1]->k_sim),
+                                                      reverse_k(ptr_triple_patterns[0]->k_sim), m_knn_help, graph());
                 }
             }else{
                 if(is_variable_subject(var)){
@@ -238,7 +289,7 @@ namespace ring_ltj {
         void down(var_type var, size_type c, size_type k) { //Go down in the trie
             if (m_level > 1) return;
             if (m_level == 0) {
-                m_ptr_ring->knn_intersection_helper(c, k, k, m_knn_help);
+                m_knn->intersection_helper(c, k, k, m_knn_help, graph());
             }
             if(is_variable_subject(var)){
                 m_state[m_level] = s;
@@ -298,7 +349,7 @@ namespace ring_ltj {
                 }
             }*/
             if(m_level == 0) {
-                if(c > m_ptr_ring->knn_nodes) return 0;
+                if(c > m_knn->nodes(graph())) return 0;
                 return c;
             }
             //std::cout << "LEAP" << std::endl;
@@ -313,17 +364,42 @@ namespace ring_ltj {
             return m_knn_help.distinct();
         }
 
+        //Nodes of the KNN graph of the iterator, the values its variables can take
+        inline size_type nodes() const{
+            return m_knn->nodes(graph());
+        }
+
 
         value_type seek_last(var_type var){
-            m_ptr_ring->knn_intersection_iter(m_consts[0], ptr_triple_patterns[0]->k_sim,
-                                                ptr_triple_patterns[1]->k_sim, m_knn_iter);
+            size_type k1 = forward_k(m_consts[0], ptr_triple_patterns[0]->k_sim);
+            size_type k2 = reverse_k(ptr_triple_patterns[1]->k_sim);
+            if(m_knn->mutual(m_consts[0], k1, k2, m_knn_last, graph())){
+                m_knn_last_pos = 0;
+                return seek_last_next(var);
+            }
+            m_knn->intersection_iter(m_consts[0], k1, k2, m_knn_iter, graph());
             return m_knn_iter.next();
         }
 
         value_type seek_last_next(var_type var){
+            if(m_knn_last.is_valid()){
+                if(m_knn_last_pos == m_knn_last.size()) return 0;
+                return m_knn_last[m_knn_last_pos++];
+            }
             return m_knn_iter.next();
         }
 
+        size_type count_last(var_type var){
+            size_type k1 = forward_k(m_consts[0], ptr_triple_patterns[0]->k_sim);
+            size_type k2 = reverse_k(ptr_triple_patterns[1]->k_sim);
+            if(m_knn->mutual(m_consts[0], k1, k2, m_knn_last, graph())) return m_knn_last.size();
+            size_type cnt = 0;
+            for(value_type c = seek_last(var); c != 0; c = seek_last_next(var)){
+                ++cnt;
+            }
+            return cnt;
+        }
+
         inline descriptor get_descriptor(var_type var){
             descriptor desc;
             return desc;
@@ -28,7 +28,7 @@
 namespace ring_ltj {
 
     template<class ring_t, class var_t, class cons_t>
-    class ltj_iterator_uni_similarity : public ltj_iterator_base<var_t, cons_t> {
+    class ltj_iterator_uni_similarity final : public ltj_iterator_base<var_t, cons_t> {
 
     public:
         typedef cons_t value_type;
@@ -36,12 +36,14 @@ namespace ring_ltj {
         typedef ring_t ring_type;
         typedef typename ring_type::knn_range_iterator_type knn_iterator_type;
         typedef typename ring_type::knn_range_helper_type   knn_helper_type;
+        typedef typename ring_type::knn_ptr_type knn_ptr_type;
         typedef uint64_t size_type;
         //enum state_type {s, p, o};
         //std::vector<value_type> leap_result_type;
 
     private:
         ring_type *m_ptr_ring; //TODO: should be const
+        knn_ptr_type m_knn; //KNN component taken when the iterator is built (see ring_similarity::knn)
         bwt_interval m_i;
         std::array<value_type, 2> m_consts;
         std::array<descriptor_type, 2> m_state;
@@ -55,6 +57,7 @@ namespace ring_ltj {
         void copy(const ltj_iterator_uni_similarity &o) {
             ptr_triple_pattern = o.ptr_triple_pattern;
             m_ptr_ring = o.m_ptr_ring;
+            m_knn = o.m_knn;
             m_i = o.m_i;
             m_consts = o.m_consts;
             m_state = o.m_state;
@@ -64,6 +67,31 @@ namespace ring_ltj {
             m_is_empty = o.m_is_empty;
         }
 
+        //KNN graph of the pattern
+        inline size_type graph() const {
+            return ptr_triple_pattern->graph;
+        }
+
+        //k of the list of the subject x restricted to the neighbours below the distance threshold
+        inline size_type forward_k(const value_type x){
+            if(!ptr_triple_pattern->has_threshold()) return ptr_triple_pattern->k_sim;
+            return m_knn->k_within(x, ptr_triple_pattern->k_sim, ptr_triple_pattern->d_max, graph());
+        }
+
+        //k of the reverse list of the object (patterns with only a threshold take every neighbour)
+        inline size_type reverse_k(){
+            return std::min<size_type>(ptr_triple_pattern->k_sim, m_knn->max_k(graph()));
+        }
+
+        //The reverse lists are not sorted by distance, their subjects are checked one by one
+        inline value_type below_threshold(value_type c){
+            if(m_state[0] != o || !ptr_triple_pattern->has_threshold()) return c;
+            while(c != 0 && !m_knn->distance_below(c, m_consts[0], ptr_triple_pattern->d_max, graph())){
+                c = m_knn_help.next(c + 1);
+            }
+            return c;
+        }
+
     public:
         //const value_type &cur_s = m_cur_s;
         //const value_type &cur_o = m_cur_o;
@@ -71,9 +99,17 @@ namespace ring_ltj {
 
         ltj_iterator_uni_similarity() = default;
 
-        ltj_iterator_uni_similarity(const triple_pattern *triple, ring_type *ring) {
+        /**
+         *
+         * @param triple    Similarity pattern
+         * @param ring      Index
+         * @param knn       KNN component of the query (the current one of the index if it is empty)
+         */
+        ltj_iterator_uni_similarity(const triple_pattern *triple, ring_type *ring,
+                                    knn_ptr_type knn = knn_ptr_type()) {
             ptr_triple_pattern = triple;
             m_ptr_ring = ring;
+            m_knn = knn ? std::move(knn) : ring->knn();
             m_i = m_ptr_ring->open_POS();
             //Init current values and intervals according to the triple
             if (!ptr_triple_pattern->s_is_variable() && !ptr_triple_pattern->o_is_variable()) {
@@ -89,7 +125,7 @@ namespace ring_ltj {
                 m_consts[0] = ptr_triple_pattern->term_s.value;
                 m_state[0] = s;
 
-                m_ptr_ring->knn_range_helper(m_consts[0], ptr_triple_pattern->k_sim, true, m_knn_help);
+                m_knn->range_helper(m_consts[0], forward_k(m_consts[0]), true, m_knn_help, graph());
                 if(m_knn_help.is_empty()){
                     m_is_empty = true;
                     return;
@@ -114,7 +150,7 @@ namespace ring_ltj {
                     return;
                 }*/
                 m_consts[0] = ptr_triple_pattern->term_s.value;
-                m_ptr_ring->knn_range_helper(m_consts[0], ptr_triple_pattern->k_sim, true, m_knn_help);
+                m_knn->range_helper(m_consts[0], forward_k(m_consts[0]), true, m_knn_help, graph());
                 if(m_knn_help.is_empty()){
                     m_is_empty = true;
                     return;
@@ -132,7 +168,7 @@ namespace ring_ltj {
                     return;
                 }*/
                 m_consts[0] = ptr_triple_pattern->term_o.value;
-                m_ptr_ring->knn_range_helper(m_consts[0], ptr_triple_pattern->k_sim, false, m_knn_help);
+                m_knn->range_helper(m_consts[0], reverse_k(), false, m_knn_help, graph());
                 if(m_knn_help.is_empty()){
                     m_is_empty = true;
                     return;
@@ -165,6 +201,7 @@ namespace ring_ltj {
             if (this != &o) {
                 ptr_triple_pattern = std::move(o.ptr_triple_pattern);
                 m_ptr_ring = std::move(o.m_ptr_ring);
+                m_knn = std::move(o.m_knn);
                 m_i = std::move(o.m_i);
                 m_consts = std::move(o.m_consts);
                 m_state = std::move(o.m_state);
@@ -180,6 +217,7 @@ namespace ring_ltj {
             // m_bp.swap(bp_support.m_bp); use set_vector to set the supported bit_vector
             std::swap(ptr_triple_pattern, o.ptr_triple_pattern);
             std::swap(m_ptr_ring, o.m_ptr_ring);
+            std::swap(m_knn, o.m_knn);
             m_i.swap(o.m_i);
             std::swap(m_consts, o.m_consts);
             std::swap(m_state, o.m_state);
@@ -204,7 +242,11 @@ namespace ring_ltj {
         void down(var_type var, size_type c) { //Go down in the trie
             if (m_level > 1) return;
             if (m_level == 0) {
-                m_ptr_ring->knn_range_helper(c, ptr_triple_pattern->k_sim, is_variable_subject(var), m_knn_help);
+                if(is_variable_subject(var)){
+                    m_knn->range_helper(c, forward_k(c), true, m_knn_help, graph());
+                }else{
+                    m_knn->range_helper(c, reverse_k(), false, m_knn_help, graph());
+                }
             }
             if(is_variable_subject(var)){
                 m_state[m_level] = s;
@@ -218,7 +260,7 @@ namespace ring_ltj {
         void down(var_type var, size_type c, size_type k) { //Go down in the trie
             if (m_level > 1) return;
             if (m_level == 0) {
-                m_ptr_ring->knn_range_helper(c, k, is_variable_subject(var), m_knn_help);
+                m_knn->range_helper(c, k, is_variable_subject(var), m_knn_help, graph());
             }
             if(is_variable_subject(var)){
                 m_state[m_level] = s;
@@ -244,7 +286,7 @@ namespace ring_ltj {
                 }
             }*/
             if(m_level == 0) return 1;
-            return m_knn_help.next();
+            return below_threshold(m_knn_help.next());
         };
 
         value_type leap(var_type var, size_type c) { //Return the next value greater or equal than c in the range
@@ -256,10 +298,10 @@ namespace ring_ltj {
                 }
             }*/
             if(m_level == 0) {
-                if(c > m_ptr_ring->knn_nodes) return 0;
+                if(c > m_knn->nodes(graph())) return 0;
                 return c;
             }
-            return m_knn_help.next(c);
+            return below_threshold(m_knn_help.next(c));
         }
 
         bool in_last_level() const{
@@ -270,13 +312,28 @@ namespace ring_ltj {
             return m_knn_help.distinct();
         }
 
+        //Nodes of the KNN graph of the iterator, the values its variables can take
+        inline size_type nodes() const{
+            return m_knn->nodes(graph());
+        }
+
         value_type seek_last(var_type var){
-            m_ptr_ring->knn_range_iter(m_consts[0], ptr_triple_pattern->k_sim, m_state[0] == s, m_knn_iter);
-            return m_knn_iter.next();
+            if(m_state[0] == s){
+                m_knn->range_iter(m_consts[0], forward_k(m_consts[0]), true, m_knn_iter, graph());
+                return m_knn_iter.next();
+            }
+            m_knn->range_iter(m_consts[0], reverse_k(), false, m_knn_iter, graph());
+            return seek_last_next(var);
         }
 
         value_type seek_last_next(var_type var){
-            return m_knn_iter.next();
+            value_type c = m_knn_iter.next();
+            if(m_state[0] == o && ptr_triple_pattern->has_threshold()){
+                while(c != 0 && !m_knn->distance_below(c, m_consts[0], ptr_triple_pattern->d_max, graph())){
+                    c = m_knn_iter.next();
+                }
+            }
+            return c;
         }
 
         inline descriptor get_descriptor(var_type var){
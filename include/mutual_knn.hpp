@@ -0,0 +1,233 @@
+/*
+ * mutual_knn.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_MUTUAL_KNN_HPP
+#define RING_MUTUAL_KNN_HPP
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <sdsl/int_vector.hpp>
+#include <sdsl/io.hpp>
+
+namespace ring_ltj {
+
+    /**
+     * Mutual neighbours of every node for a few values of k: y is in the list of x if it is one of the k
+     * nearest neighbours of x and x is one of the k nearest neighbours of y. These are the intersections
+     * that the bidirectional similarity patterns (?x k ?y . ?y k ?x) compute at query time.
+     *
+     * The lists of each k are stored in CSR form: the sorted lists one after another and the offset of each
+     * node, both bit-compressed.
+     */
+    class mutual_knn {
+
+    public:
+        typedef uint64_t size_type;
+        typedef uint64_t value_type;
+
+        //Sorted list of mutual neighbours of a node
+        struct list_type {
+            const sdsl::int_vector<>* values = nullptr;
+            size_type beg = 0;
+            size_type end = 0;
+
+            inline bool is_valid() const {
+                return values != nullptr;
+            }
+
+            inline size_type size() const {
+                return end - beg;
+            }
+
+            inline value_type operator[](const size_type i) const {
+                return (*values)[beg + i];
+            }
+
+            //Smallest value greater than or equal to c (0 if there is none)
+            inline value_type next(const value_type c) const {
+                size_type lo = beg, hi = end;
+                while(lo < hi){
+                    size_type mid = (lo + hi) / 2;
+                    if((*values)[mid] < c){
+                        lo = mid + 1;
+                    }else{
+                        hi = mid;
+                    }
+                }
+                return (lo == end) ? 0 : (*values)[lo];
+            }
+        };
+
+    private:
+        size_type m_nodes = 0;
+        sdsl::int_vector<64> m_ks;
+        std::vector<sdsl::int_vector<>> m_offsets;
+        std::vector<sdsl::int_vector<>> m_values;
+
+        void copy(const mutual_knn &o) {
+            m_nodes = o.m_nodes;
+            m_ks = o.m_ks;
+            m_offsets = o.m_offsets;
+            m_values = o.m_values;
+        }
+
+    public:
+
+        mutual_knn() = default;
+
+        /**
+         * Computes the mutual lists with the intersections of the KNN graph (see
+         * knn_graph_cds::batch_intersection). The anchors are processed in blocks to bound the memory, and the
+         * buffers of the traversal are reused by all of them.
+         *
+         * @param g     KNN graph
+         * @param ks    Values of k
+         * @param block Number of anchors of each block
+         */
+        template<class knn_graph_t>
+        mutual_knn(knn_graph_t &g, std::vector<size_type> ks, const size_type block = 1 << 16){
+            std::sort(ks.begin(), ks.end());
+            ks.erase(std::unique(ks.begin(), ks.end()), ks.end());
+            ks.erase(std::remove_if(ks.begin(), ks.end(), [&g](size_type k){ return k == 0 || k > g.max_k; }),
+                     ks.end());
+            m_nodes = g.nodes;
+            m_ks = sdsl::int_vector<64>(ks.size());
+            m_offsets.resize(ks.size());
+            m_values.resize(ks.size());
+            std::vector<value_type> anchors;
+            std::vector<std::vector<value_type>> out;
+            typename knn_graph_t::batch_buffers_type buffers;
+            for(size_type i = 0; i < ks.size(); ++i){
+                m_ks[i] = ks[i];
+                std::vector<value_type> values;
+                sdsl::int_vector<> offsets(m_nodes + 2, 0);
+                for(size_type first = 1; first <= m_nodes; first += block){
+                    size_type last = std::min(m_nodes, first + block - 1);
+                    anchors.resize(last - first + 1);
+                    for(size_type x = first; x <= last; ++x) anchors[x - first] = x;
+                    g.batch_intersection(anchors, ks[i], ks[i], out, buffers);
+                    for(size_type x = first; x <= last; ++x){
+                        offsets[x] = values.size();
+                        const auto &list = out[x - first];
+                        values.insert(values.end(), list.begin(), list.end());
+                    }
+                }
+                offsets[m_nodes + 1] = values.size();
+                m_values[i] = sdsl::int_vector<>(values.size(), 0, 64);
+                for(size_type j = 0; j < values.size(); ++j){
+                    m_values[i][j] = values[j];
+                }
+                sdsl::util::bit_compress(m_values[i]);
+                sdsl::util::bit_compress(offsets);
+                m_offsets[i] = std::move(offsets);
+            }
+        }
+
+        //! Copy constructor
+        mutual_knn(const mutual_knn &o) {
+            copy(o);
+        }
+
+        //! Move constructor
+        mutual_knn(mutual_knn &&o) {
+            *this = std::move(o);
+        }
+
+        //! Copy Operator=
+        mutual_knn &operator=(const mutual_knn &o) {
+            if (this != &o) {
+                copy(o);
+            }
+            return *this;
+        }
+
+        //! Move Operator=
+        mutual_knn &operator=(mutual_knn &&o) {
+            if (this != &o) {
+                m_nodes = o.m_nodes;
+                m_ks = std::move(o.m_ks);
+                m_offsets = std::move(o.m_offsets);
+                m_values = std::move(o.m_values);
+            }
+            return *this;
+        }
+
+        void swap(mutual_knn &o) {
+            std::swap(m_nodes, o.m_nodes);
+            m_ks.swap(o.m_ks);
+            std::swap(m_offsets, o.m_offsets);
+            std::swap(m_values, o.m_values);
+        }
+
+        inline bool empty() const {
+            return m_ks.size() == 0;
+        }
+
+        inline std::vector<size_type> ks() const {
+            return std::vector<size_type>(m_ks.begin(), m_ks.end());
+        }
+
+        /**
+         * Mutual neighbours of x when k1 and k2 are one of the precomputed values of k.
+         *
+         * @return  False if there is no list for k1 and k2 (then l is not valid)
+         */
+        inline bool list(const value_type x, const size_type k1, const size_type k2, list_type &l) const {
+            l.values = nullptr;
+            if(k1 != k2) return false;
+            for(size_type i = 0; i < m_ks.size(); ++i){
+                if(m_ks[i] != k1) continue;
+                l.values = &m_values[i];
+                if(x == 0 || x > m_nodes){
+                    l.beg = l.end = 0;
+                }else{
+                    l.beg = m_offsets[i][x];
+                    l.end = m_offsets[i][x + 1];
+                }
+                return true;
+            }
+            return false;
+        }
+
+        //! Serializes the data structure into the given ostream
+        size_type serialize(std::ostream &out, sdsl::structure_tree_node *v = nullptr, std::string name = "") const {
+            sdsl::structure_tree_node *child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
+            size_type written_bytes = 0;
+            written_bytes += sdsl::write_member(m_nodes, out, child, "nodes");
+            written_bytes += m_ks.serialize(out, child, "ks");
+            written_bytes += sdsl::serialize_vector(m_offsets, out, child, "offsets");
+            written_bytes += sdsl::serialize_vector(m_values, out, child, "values");
+            sdsl::structure_tree::add_size(child, written_bytes);
+            return written_bytes;
+        }
+
+        void load(std::istream &in) {
+            sdsl::read_member(m_nodes, in);
+            m_ks.load(in);
+            m_offsets.resize(m_ks.size());
+            m_values.resize(m_ks.size());
+            sdsl::load_vector(m_offsets, in);
+            sdsl::load_vector(m_values, in);
+        }
+    };
+}
+
+#endif //RING_MUTUAL_KNN_HPP
@@ -0,0 +1,101 @@
+/*
+ * parallel.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_PARALLEL_HPP
+#define RING_PARALLEL_HPP
+
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <sdsl/int_vector_buffer.hpp>
+#include <sdsl/construct.hpp>
+
+namespace ring_ltj {
+
+    namespace parallel {
+
+        /**
+         * Number of hardware threads (at least 1)
+         */
+        inline uint64_t hardware_threads(){
+            uint64_t n = std::thread::hardware_concurrency();
+            return (n == 0) ? 1 : n;
+        }
+
+        /**
+         * Runs f(i, t) for every i in [0, n) using a pool of threads. Tasks are handed out
+         * dynamically through a shared counter, so long tasks do not stall the rest.
+         *
+         * @param n         Number of tasks
+         * @param threads   Number of threads (0 means hardware threads)
+         * @param f         Function called as f(task_id, thread_id)
+         */
+        template<class Function>
+        void for_each(const uint64_t n, uint64_t threads, Function f){
+            if(threads == 0) threads = hardware_threads();
+            if(threads > n) threads = n;
+            if(threads <= 1){
+                for(uint64_t i = 0; i < n; ++i){
+                    f(i, (uint64_t) 0);
+                }
+                return;
+            }
+            std::atomic<uint64_t> next(0);
+            std::vector<std::thread> pool;
+            pool.reserve(threads);
+            for(uint64_t t = 0; t < threads; ++t){
+                pool.emplace_back([&next, &f, n, t](){
+                    uint64_t i;
+                    while((i = next.fetch_add(1, std::memory_order_relaxed)) < n){
+                        f(i, t);
+                    }
+                });
+            }
+            for(auto &th : pool){
+                th.join();
+            }
+        }
+
+        /**
+         * Same as sdsl::construct_im(t, data) for the structures built from an int_vector_buffer
+         * (wavelet trees and matrices), but it can be called from several threads at the same time:
+         * each call uses its own temporary file in memory.
+         *
+         * @param t     Structure to build
+         * @param data  Input sequence
+         */
+        template<class t_index>
+        void construct_im(t_index &t, const sdsl::int_vector<> &data){
+            static std::atomic<uint64_t> id(0);
+            std::string tmp_file = sdsl::ram_file_name("construct_im_" + std::to_string(sdsl::util::pid()) + "_"
+                                                       + std::to_string(id.fetch_add(1)));
+            sdsl::store_to_file(data, tmp_file);
+            {
+                sdsl::int_vector_buffer<> buf(tmp_file);
+                t = t_index(buf, buf.size());
+            }
+            sdsl::ram_fs::remove(tmp_file);
+        }
+    }
+}
+
+#endif //RING_PARALLEL_HPP
@@ -0,0 +1,192 @@
+/*
+ * prepared_query.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_PREPARED_QUERY_HPP
+#define RING_PREPARED_QUERY_HPP
+
+#include <triple_pattern.hpp>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+namespace ring_ltj {
+
+    /**
+     * Query template whose constants are parameters. The template is analyzed once: the iterator of each
+     * triple pattern is decided and the structure of the GAO (linked variables, SCCs of the similarity
+     * graph) is computed. Each execution binds new constants, which only rebuilds the iterators in place
+     * and recomputes the weights of the GAO.
+     *
+     * Two queries share a template when they are equal after replacing their constants by parameters,
+     * where equal constants of a query are the same parameter (see shape and parameters).
+     */
+    template<class ltj_algorithm_t>
+    class prepared_query {
+
+    public:
+        typedef ltj_algorithm_t ltj_algorithm_type;
+        typedef typename ltj_algorithm_type::ring_type ring_type;
+        typedef typename ltj_algorithm_type::plan_type plan_type;
+        typedef uint64_t size_type;
+        typedef std::vector<uint64_t> params_type;
+
+    private:
+        typedef std::pair<size_type, uint8_t> slot_type; //triple pattern and term (0=s, 1=p, 2=o)
+
+        std::vector<triple_pattern> m_patterns;
+        std::vector<std::vector<slot_type>> m_slots; //terms of each parameter
+        std::unique_ptr<ltj_algorithm_type> m_ptr_ltj;
+        bool m_fresh = true; //The iterators were built with the constants of the template
+
+        static inline bool const_p(const triple_pattern &triple){
+            return !triple.p_is_variable() && !triple.is_similarity() && !triple.is_best();
+        }
+
+        template<class F>
+        static void for_each_constant(const std::vector<triple_pattern> &patterns, F f){
+            for(size_type i = 0; i < patterns.size(); ++i){
+                const auto &triple = patterns[i];
+                if(!triple.s_is_variable()) f(i, 0, triple.term_s.value);
+                if(const_p(triple)) f(i, 1, triple.term_p.value);
+                if(!triple.o_is_variable()) f(i, 2, triple.term_o.value);
+            }
+        }
+
+        //Exact representation of a threshold
+        static inline uint64_t bits(const double d){
+            uint64_t b;
+            std::memcpy(&b, &d, sizeof(b));
+            return b;
+        }
+
+        static inline std::string term(const term_pattern &t, std::unordered_map<uint64_t, size_type> &params){
+            if(t.is_variable) return "?" + std::to_string(t.value);
+            return "$" + std::to_string(params.insert({t.value, params.size()}).first->second);
+        }
+
+    public:
+
+        /**
+         *
+         * @param patterns  Triple patterns of the template with the constants of its first query
+         * @param ring      Index
+         * @param num_vars  Number of variables
+         */
+        prepared_query(const std::vector<triple_pattern> &patterns, ring_type* ring, const size_type num_vars){
+            m_patterns = patterns;
+            std::unordered_map<uint64_t, size_type> params;
+            for_each_constant(m_patterns, [&](size_type i, uint8_t t, uint64_t value){
+                auto it = params.insert({value, params.size()}).first;
+                if(it->second == m_slots.size()) m_slots.emplace_back();
+                m_slots[it->second].emplace_back(i, t);
+            });
+            m_ptr_ltj.reset(new ltj_algorithm_type(&m_patterns, ring, num_vars,
+                                                   ltj_algorithm_type::make_plan(m_patterns)));
+        }
+
+        //! The algorithm keeps pointers to the patterns
+        prepared_query(const prepared_query &o) = delete;
+        prepared_query &operator=(const prepared_query &o) = delete;
+
+        //! Move constructor
+        prepared_query(prepared_query &&o) = default;
+
+        //! Move Operator=
+        prepared_query &operator=(prepared_query &&o) = default;
+
+        /**
+         * Key of the template of a query: the patterns with their constants replaced by parameters.
+         */
+        static std::string shape(const std::vector<triple_pattern> &patterns){
+            std::unordered_map<uint64_t, size_type> params;
+            std::string key;
+            for(const auto &triple : patterns){
+                key += term(triple.term_s, params) + " ";
+                if(triple.is_best()){
+                    key += "b" + std::to_string(triple.k_best);
+                }else if(triple.is_similarity()){
+                    key += "k" + std::to_string(triple.k_sim);
+                    if(triple.has_threshold()) key += "d" + std::to_string(bits(triple.d_max));
+                }else{
+                    key += term(triple.term_p, params);
+                }
+                if((triple.is_best() || triple.is_similarity()) && triple.graph > 0){
+                    key += "@" + std::to_string(triple.graph);
+                }
+                key += " " + term(triple.term_o, params) + " . ";
+            }
+            return key;
+        }
+
+        /**
+         * Constants of a query in the order of its parameters.
+         */
+        static params_type parameters(const std::vector<triple_pattern> &patterns){
+            std::unordered_map<uint64_t, size_type> params;
+            params_type values;
+            for_each_constant(patterns, [&](size_type, uint8_t, uint64_t value){
+                if(params.insert({value, params.size()}).second) values.push_back(value);
+            });
+            return values;
+        }
+
+        inline size_type size() const {
+            return m_slots.size();
+        }
+
+        /**
+         * Replaces the parameters of the template.
+         *
+         * @param values    Constants of the query (see parameters)
+         * @return          False if the number of constants does not match the template
+         */
+        bool bind(const params_type &values){
+            if(values.size() != m_slots.size()) return false;
+            bool changed = false;
+            for(size_type i = 0; i < m_slots.size(); ++i){
+                for(const auto &slot : m_slots[i]){
+                    auto &triple = m_patterns[slot.first];
+                    term_pattern &t = (slot.second == 0) ? triple.term_s :
+                                      ((slot.second == 1) ? triple.term_p : triple.term_o);
+                    changed = changed || (t.value != values[i]);
+                    t.value = values[i];
+                }
+            }
+            if(changed || !m_fresh){
+                m_ptr_ltj->rebind(&m_patterns);
+            }
+            m_fresh = false;
+            return true;
+        }
+
+        inline const std::vector<triple_pattern>& patterns() const {
+            return m_patterns;
+        }
+
+        //Algorithm with the last constants bound
+        inline ltj_algorithm_type& algorithm() {
+            return *m_ptr_ltj;
+        }
+    };
+}
+
+#endif //RING_PREPARED_QUERY_HPP
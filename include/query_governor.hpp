@@ -0,0 +1,256 @@
+/*
+ * query_governor.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_QUERY_GOVERNOR_HPP
+#define RING_QUERY_GOVERNOR_HPP
+
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+
+namespace ring_ltj {
+
+    /**
+     * Flag shared by the queries that can be cancelled from outside (another thread or a signal
+     * handler). Copies of a token share the flag. A default constructed token is empty: it has no flag,
+     * costs nothing to copy and is never cancelled. Use create for a token that can be cancelled.
+     */
+    class cancel_token {
+
+    private:
+        std::shared_ptr<std::atomic<bool>> m_flag;
+
+    public:
+        cancel_token() = default;
+
+        static cancel_token create() {
+            cancel_token t;
+            t.m_flag = std::make_shared<std::atomic<bool>>(false);
+            return t;
+        }
+
+        //The token has a flag (see create)
+        inline bool valid() const {
+            return m_flag != nullptr;
+        }
+
+        inline void cancel() {
+            if(m_flag) m_flag->store(true, std::memory_order_relaxed);
+        }
+
+        inline void reset() {
+            if(m_flag) m_flag->store(false, std::memory_order_relaxed);
+        }
+
+        inline bool is_cancelled() const {
+            return m_flag && m_flag->load(std::memory_order_relaxed);
+        }
+
+        //Address of the flag, it can be set from a signal handler (null if the token is empty)
+        inline std::atomic<bool>* flag() const {
+            return m_flag.get();
+        }
+    };
+
+    /**
+     * Limits of a query and its progress. The search calls step once per binding, but the clock and the
+     * cancellation token are only checked every check_every steps. The results can be bounded by the
+     * number of bytes they would take.
+     *
+     * A copy shares the deadline and the token but has its own counters, so each thread of a parallel
+     * join works with a copy that is merged at the end. The copies made by fork also share a counter of
+     * results, so the limit of results bounds all of them together.
+     */
+    class query_governor {
+
+    public:
+        typedef uint64_t size_type;
+        typedef std::chrono::high_resolution_clock clock_type;
+        typedef clock_type::time_point time_point_type;
+        enum status_type {running, finished, timeout, cancelled, memory_limit, result_limit};
+
+    private:
+        time_point_type m_start;
+        time_point_type m_deadline;
+        bool m_has_deadline = false;
+        cancel_token m_token; //empty unless set_cancel_token is called
+        size_type m_mask = 1023;
+        size_type m_steps = 0;
+        size_type m_results = 0;
+        size_type m_max_results = 0; //0 means no limit
+        std::atomic<size_type>* m_shared_results = nullptr; //results of all the copies (see share_results)
+        status_type m_status = running;
+
+        bool check(){
+            if(m_shared_results != nullptr && m_max_results > 0
+               && m_shared_results->load(std::memory_order_relaxed) >= m_max_results){
+                m_status = memory_limit;
+                return false;
+            }
+            if(m_token.is_cancelled()){
+                m_status = cancelled;
+                return false;
+            }
+            if(m_has_deadline && clock_type::now() > m_deadline){
+                m_status = timeout;
+                return false;
+            }
+            return true;
+        }
+
+    public:
+
+        /**
+         *
+         * @param timeout_seconds   Timeout in seconds (0 means no timeout)
+         * @param check_every       Steps between two checks of the clock and the token (rounded up to a
+         *                          power of two)
+         */
+        explicit query_governor(const size_type timeout_seconds = 0, const size_type check_every = 1024){
+            m_start = clock_type::now();
+            if(timeout_seconds > 0){
+                m_has_deadline = true;
+                m_deadline = m_start + std::chrono::seconds(timeout_seconds);
+            }
+            size_type c = 1;
+            while(c < check_every) c <<= 1;
+            m_mask = c - 1;
+        }
+
+        inline void set_cancel_token(const cancel_token &token){
+            m_token = token;
+        }
+
+        /**
+         * Bounds the memory of the results.
+         *
+         * @param bytes         Maximum number of bytes of the results
+         * @param tuple_bytes   Bytes of a result
+         */
+        inline void set_memory_limit(const size_type bytes, const size_type tuple_bytes){
+            m_max_results = (tuple_bytes == 0) ? 0 : std::max<size_type>(1, bytes / tuple_bytes);
+        }
+
+        /**
+         * Copy for another thread, merged back with merge. Its counters start from 0 and its results are
+         * also added to counter, which is shared by all the copies: the limit of results applies to the
+         * counter, and a copy stops at its next check once the others reached it.
+         *
+         * @param counter   Results of all the copies, it starts with results() and outlives the copies
+         */
+        query_governor fork(std::atomic<size_type>* counter) const {
+            query_governor g(*this);
+            g.m_steps = 0;
+            g.m_results = 0;
+            g.m_shared_results = counter;
+            return g;
+        }
+
+        //False if the search has to stop
+        inline bool step(){
+            if(m_status != running) return false;
+            if((++m_steps & m_mask) != 0) return true;
+            return check();
+        }
+
+        //False if the search has to stop after this result
+        inline bool add_result(){
+            ++m_results;
+            size_type total = m_results;
+            if(m_shared_results != nullptr){
+                total = m_shared_results->fetch_add(1, std::memory_order_relaxed) + 1;
+            }
+            if(m_max_results > 0 && total >= m_max_results){
+                m_status = memory_limit;
+                return false;
+            }
+            return true;
+        }
+
+        /**
+         * Lets a stopped governor run again, e.g. to resume a cursor after a timeout or a full page. The
+         * counter of results starts again from 0. A cancelled governor keeps stopping until its token is reset.
+         *
+         * @param timeout_seconds   New timeout from now in seconds (0 keeps the current deadline)
+         */
+        void resume(const size_type timeout_seconds = 0){
+            if(timeout_seconds > 0){
+                m_has_deadline = true;
+                m_deadline = clock_type::now() + std::chrono::seconds(timeout_seconds);
+            }
+            m_results = 0;
+            m_status = running;
+        }
+
+        //The search stopped by itself: it finished or reached the limit of results
+        inline void stop(const bool complete){
+            if(m_status == running) m_status = complete ? finished : result_limit;
+        }
+
+        //Adds the counters of a copy, but not its status (e.g. a copy that was stopped on purpose)
+        void merge_counters(const query_governor &o){
+            m_steps += o.m_steps;
+            m_results += o.m_results;
+        }
+
+        //Adds the counters of a copy used by another thread
+        void merge(const query_governor &o){
+            merge_counters(o);
+            if(m_status == running || m_status == finished) {
+                if(o.m_status != running && o.m_status != finished) m_status = o.m_status;
+            }
+        }
+
+        inline status_type status() const {
+            return m_status;
+        }
+
+        inline bool is_complete() const {
+            return m_status == finished;
+        }
+
+        inline size_type steps() const {
+            return m_steps;
+        }
+
+        inline size_type results() const {
+            return m_results;
+        }
+
+        inline size_type elapsed_ms() const {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now() - m_start).count();
+        }
+
+        static const char* status_name(const status_type s){
+            switch (s) {
+                case running: return "running";
+                case finished: return "finished";
+                case timeout: return "timeout";
+                case cancelled: return "cancelled";
+                case memory_limit: return "memory_limit";
+                default: return "result_limit";
+            }
+        }
+    };
+}
+
+#endif //RING_QUERY_GOVERNOR_HPP
@@ -0,0 +1,374 @@
+/*
+ * result_cache.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_RESULT_CACHE_HPP
+#define RING_RESULT_CACHE_HPP
+
+#include <triple_pattern.hpp>
+#include <result_sink.hpp>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <list>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <unordered_map>
+
+namespace ring_ltj {
+
+    /**
+     * LRU cache of the results of the queries. The key of a query is its canonical form: the triple
+     * patterns are sorted and the variables are renamed in their order of appearance, so two queries that
+     * only differ in the names of their variables or in the order of their patterns share the entry.
+     * The k values, the distance thresholds and the KNN graphs of the similarity patterns are part of the key.
+     *
+     * The tuples are stored with the canonical variables and translated back on a hit. A result cut by
+     * a limit is stored as partial and answers the requests with the same or a smaller limit. Results
+     * interrupted by a timeout are not stored.
+     *
+     * All the operations take a lock, so the cache can be shared by several threads. Every clear starts a
+     * new generation: a query that read the generation before the clear (and may have used the data of
+     * the index before it changed) cannot store its results afterwards.
+     */
+    class result_cache {
+
+    public:
+        typedef uint64_t size_type;
+        typedef uint64_t value_type;
+        typedef std::vector<value_type> tuple_type;
+        typedef std::chrono::high_resolution_clock::time_point time_point_type;
+
+        struct canonical_type {
+            std::string key;
+            std::vector<size_type> var_map; //canonical variable of each variable of the query
+        };
+
+    private:
+        struct entry_type {
+            std::string key;
+            std::vector<value_type> values; //tuples one after another (canonical variables)
+            size_type width = 0;
+            size_type count = 0;
+            size_type limit = 0; //0 if the result is complete
+        };
+        typedef std::list<entry_type> list_type;
+        typedef typename list_type::iterator list_iterator_type;
+
+        size_type m_budget = 0;
+        size_type m_bytes = 0;
+        size_type m_hits = 0;
+        size_type m_misses = 0;
+        size_type m_evictions = 0;
+        size_type m_generation = 0;
+        list_type m_lru; //most recently used first
+        std::unordered_map<std::string, list_iterator_type> m_table;
+        mutable std::mutex m_mutex;
+
+        //Exact representation of a threshold
+        static inline uint64_t bits(const double d){
+            uint64_t b;
+            std::memcpy(&b, &d, sizeof(b));
+            return b;
+        }
+
+        static std::string predicate(const triple_pattern &triple){
+            std::string p;
+            if(triple.is_best()){
+                p = "b" + std::to_string(triple.k_best);
+            }else if(triple.is_similarity()){
+                p = "k" + std::to_string(triple.k_sim);
+                if(triple.has_threshold()) p += "d" + std::to_string(bits(triple.d_max));
+            }
+            if(!p.empty() && triple.graph > 0) p += "@" + std::to_string(triple.graph);
+            return p;
+        }
+
+        static inline std::string term(const term_pattern &t, const std::vector<size_type> &var_map){
+            if(!t.is_variable) return std::to_string(t.value);
+            if(var_map.empty()) return "?";
+            return "?" + std::to_string(var_map[t.value]);
+        }
+
+        static std::string pattern(const triple_pattern &triple, const std::vector<size_type> &var_map){
+            std::string p = predicate(triple);
+            if(p.empty()) p = term(triple.term_p, var_map);
+            return term(triple.term_s, var_map) + " " + p + " " + term(triple.term_o, var_map);
+        }
+
+        static inline size_type bytes(const entry_type &e){
+            //Key, tuples and the nodes of the list and the table
+            return 2 * e.key.size() + e.values.size() * sizeof(value_type) + sizeof(entry_type) + 64;
+        }
+
+        void evict(){
+            while(m_bytes > m_budget && !m_lru.empty()){
+                auto &e = m_lru.back();
+                m_bytes -= bytes(e);
+                m_table.erase(e.key);
+                m_lru.pop_back();
+                ++m_evictions;
+            }
+        }
+
+        //Entry of a key that answers a request with the given limit (or nullptr)
+        entry_type* find(const std::string &key, const size_type limit){
+            auto it = m_table.find(key);
+            if(it == m_table.end() || (it->second->limit > 0 && (limit == 0 || limit > it->second->limit))){
+                ++m_misses;
+                return nullptr;
+            }
+            ++m_hits;
+            m_lru.splice(m_lru.begin(), m_lru, it->second);
+            return &(*it->second);
+        }
+
+        void insert(entry_type &&e, const size_type generation){
+            if(generation != -1ULL && generation != m_generation) return;
+            size_type b = bytes(e);
+            if(b > m_budget) return;
+            auto it = m_table.find(e.key);
+            if(it != m_table.end()){
+                m_bytes -= bytes(*it->second);
+                m_lru.erase(it->second);
+                m_table.erase(it);
+            }
+            m_lru.emplace_front(std::move(e));
+            m_table.insert({m_lru.front().key, m_lru.begin()});
+            m_bytes += b;
+            evict();
+        }
+
+    public:
+
+        //Whether a result computed from start may have been interrupted by the timeout
+        static inline bool timed_out(const time_point_type start, const size_type timeout_seconds){
+            if(timeout_seconds == 0) return false;
+            auto sec = std::chrono::duration_cast<std::chrono::seconds>(
+                    std::chrono::high_resolution_clock::now() - start).count();
+            return (size_type) sec >= timeout_seconds;
+        }
+
+        result_cache() = default;
+
+        /**
+         *
+         * @param budget    Maximum number of bytes of the entries
+         */
+        explicit result_cache(const size_type budget) : m_budget(budget) {}
+
+        /**
+         * Canonical form of a query. The patterns are sorted ignoring the names of the variables, the
+         * variables are renamed in their order of appearance and the renamed patterns are sorted again.
+         */
+        static canonical_type canonicalize(const std::vector<triple_pattern> &patterns){
+            canonical_type c;
+            std::vector<std::pair<std::string, size_type>> order;
+            order.reserve(patterns.size());
+            size_type max_var = 0;
+            for(size_type i = 0; i < patterns.size(); ++i){
+                order.emplace_back(pattern(patterns[i], c.var_map), i);
+                const auto &t = patterns[i];
+                if(t.s_is_variable()) max_var = std::max<size_type>(max_var, t.term_s.value + 1);
+                if(t.p_is_variable() && predicate(t).empty()) max_var = std::max<size_type>(max_var, t.term_p.value + 1);
+                if(t.o_is_variable()) max_var = std::max<size_type>(max_var, t.term_o.value + 1);
+            }
+            std::stable_sort(order.begin(), order.end());
+
+            c.var_map.assign(max_var, -1ULL);
+            size_type next = 0;
+            auto rename = [&](const term_pattern &t){
+                if(t.is_variable && c.var_map[t.value] == -1ULL) c.var_map[t.value] = next++;
+            };
+            for(const auto &o : order){
+                const auto &t = patterns[o.second];
+                rename(t.term_s);
+                if(predicate(t).empty()) rename(t.term_p);
+                rename(t.term_o);
+            }
+
+            std::vector<std::string> keys;
+            keys.reserve(patterns.size());
+            for(const auto &t : patterns){
+                keys.emplace_back(pattern(t, c.var_map));
+            }
+            std::sort(keys.begin(), keys.end());
+            for(const auto &k : keys){
+                c.key += k + " . ";
+            }
+            return c;
+        }
+
+        /**
+         * Reports the cached results of a query.
+         *
+         * @param c         Canonical form of the query
+         * @param sink      Sink of the results (see result_sink.hpp)
+         * @param limit     Limit of results (0 for all of them)
+         * @return          False if the results are not in the cache
+         */
+        template<class sink_t>
+        bool get(const canonical_type &c, sink_t &sink, const size_type limit = 0){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            entry_type* e = find(c.key, limit);
+            if(e == nullptr) return false;
+            tuple_type tuple(c.var_map.size());
+            size_type n = (limit > 0) ? std::min(limit, e->count) : e->count;
+            for(size_type i = 0; i < n; ++i){
+                const value_type* values = e->values.data() + i * e->width;
+                for(size_type v = 0; v < tuple.size(); ++v){
+                    if(c.var_map[v] < e->width) tuple[v] = values[c.var_map[v]];
+                }
+                sink.add(tuple);
+            }
+            return true;
+        }
+
+        /**
+         * Stores the results of a query.
+         *
+         * @param c         Canonical form of the query
+         * @param tuples    Results
+         * @param limit     Limit used to compute them (0 if there was none)
+         * @param generation Generation read before solving the query (-1 for the current one)
+         */
+        void put(const canonical_type &c, const std::vector<tuple_type> &tuples, const size_type limit = 0,
+                 const size_type generation = -1ULL){
+            entry_type e;
+            e.key = c.key;
+            e.width = 0;
+            for(const auto &m : c.var_map){
+                if(m != -1ULL) e.width = std::max(e.width, m + 1);
+            }
+            e.count = tuples.size();
+            e.limit = (limit > 0 && tuples.size() >= limit) ? limit : 0;
+            e.values.resize(e.count * e.width);
+            for(size_type i = 0; i < tuples.size(); ++i){
+                for(size_type v = 0; v < c.var_map.size() && v < tuples[i].size(); ++v){
+                    if(c.var_map[v] != -1ULL) e.values[i * e.width + c.var_map[v]] = tuples[i][v];
+                }
+            }
+            std::lock_guard<std::mutex> lock(m_mutex);
+            insert(std::move(e), generation);
+        }
+
+        /**
+         * Cached number of results of a query (see ltj_algorithm_similarity::count).
+         *
+         * @return  False if the number is not in the cache
+         */
+        bool get_count(const canonical_type &c, size_type &count){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            entry_type* e = find("#" + c.key, 0);
+            if(e == nullptr) return false;
+            count = e->count;
+            return true;
+        }
+
+        void put_count(const canonical_type &c, const size_type count, const size_type generation = -1ULL){
+            entry_type e;
+            e.key = "#" + c.key;
+            e.count = count;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            insert(std::move(e), generation);
+        }
+
+        /**
+         * Join through the cache: the query is solved with ltj_algorithm_t only if its results are not
+         * cached, and then they are stored (unless the timeout is reached).
+         */
+        template<class ltj_algorithm_t, class sink_t>
+        void join(const std::vector<triple_pattern>* patterns, typename ltj_algorithm_t::ring_type* ring,
+                  const size_type num_vars, sink_t &sink,
+                  const size_type limit_results = 0, const size_type timeout_seconds = 0){
+            auto c = canonicalize(*patterns);
+            if(get(c, sink, limit_results)) return;
+            size_type gen = generation();
+            time_point_type start = std::chrono::high_resolution_clock::now();
+            std::vector<tuple_type> res;
+            ltj_algorithm_t ltj(patterns, ring, num_vars);
+            ltj.join(res, limit_results, timeout_seconds);
+            bool complete = (limit_results > 0 && res.size() >= limit_results) || !timed_out(start, timeout_seconds);
+            if(complete) put(c, res, limit_results, gen);
+            for(const auto &t : res){
+                sink.add(t);
+            }
+        }
+
+        /**
+         * Count through the cache (see join).
+         */
+        template<class ltj_algorithm_t>
+        size_type count(const std::vector<triple_pattern>* patterns, typename ltj_algorithm_t::ring_type* ring,
+                        const size_type num_vars, const size_type timeout_seconds = 0){
+            auto c = canonicalize(*patterns);
+            size_type n;
+            if(get_count(c, n)) return n;
+            size_type gen = generation();
+            time_point_type start = std::chrono::high_resolution_clock::now();
+            ltj_algorithm_t ltj(patterns, ring, num_vars);
+            n = ltj.count(timeout_seconds);
+            if(!timed_out(start, timeout_seconds)) put_count(c, n, gen);
+            return n;
+        }
+
+        inline size_type hits() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_hits;
+        }
+
+        inline size_type misses() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_misses;
+        }
+
+        inline size_type evictions() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_evictions;
+        }
+
+        inline size_type entries() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_lru.size();
+        }
+
+        inline size_type size_in_bytes() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_bytes;
+        }
+
+        //Current generation, read it before taking the data of the index a query uses
+        inline size_type generation() const {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_generation;
+        }
+
+        //Drops the entries and starts a new generation
+        void clear(){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_lru.clear();
+            m_table.clear();
+            m_bytes = 0;
+            ++m_generation;
+        }
+    };
+}
+
+#endif //RING_RESULT_CACHE_HPP
@@ -0,0 +1,190 @@
+/*
+ * result_sink.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_RESULT_SINK_HPP
+#define RING_RESULT_SINK_HPP
+
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+namespace ring_ltj {
+
+    /**
+     * Sinks receive the tuples reported by the join algorithms. Every sink offers:
+     *   - add(tuple): reports a new tuple (the tuple is reused by the caller, it must be copied if needed)
+     *   - size():     number of tuples reported so far (used to check the limit of results)
+     */
+    namespace result_sink {
+
+        //Stores the tuples in a vector of tuples (the classical behaviour of join)
+        template<class tuple_t>
+        class vector_sink {
+        public:
+            typedef uint64_t size_type;
+            typedef tuple_t tuple_type;
+
+        private:
+            std::vector<tuple_type>* m_ptr_res;
+
+        public:
+            vector_sink(std::vector<tuple_type> &res) : m_ptr_res(&res) {}
+
+            inline void add(const tuple_type &tuple){
+                m_ptr_res->emplace_back(tuple);
+            }
+
+            inline size_type size() const {
+                return m_ptr_res->size();
+            }
+        };
+
+        //Only counts the tuples
+        class count_sink {
+        public:
+            typedef uint64_t size_type;
+
+        private:
+            size_type m_size = 0;
+
+        public:
+            count_sink() = default;
+
+            template<class tuple_t>
+            inline void add(const tuple_t &){
+                ++m_size;
+            }
+
+            inline size_type size() const {
+                return m_size;
+            }
+
+            inline void clear(){
+                m_size = 0;
+            }
+        };
+
+        //Calls f(tuple) with every tuple
+        template<class function_t>
+        class callback_sink {
+        public:
+            typedef uint64_t size_type;
+
+        private:
+            function_t m_f;
+            size_type m_size = 0;
+
+        public:
+            callback_sink(function_t f) : m_f(f) {}
+
+            template<class tuple_t>
+            inline void add(const tuple_t &tuple){
+                m_f(tuple);
+                ++m_size;
+            }
+
+            inline size_type size() const {
+                return m_size;
+            }
+        };
+
+        template<class function_t>
+        callback_sink<function_t> make_callback_sink(function_t f){
+            return callback_sink<function_t>(f);
+        }
+
+        //Stores the tuples one after the other in a single buffer of width values per tuple
+        template<class value_t = uint64_t>
+        class flat_sink {
+        public:
+            typedef uint64_t size_type;
+            typedef value_t value_type;
+
+        private:
+            size_type m_width = 0;
+            std::vector<value_type> m_data;
+
+        public:
+            flat_sink() = default;
+
+            flat_sink(const size_type width, const size_type reserve = 0) : m_width(width) {
+                m_data.reserve(reserve * width);
+            }
+
+            template<class tuple_t>
+            inline void add(const tuple_t &tuple){
+                m_data.insert(m_data.end(), tuple.begin(), tuple.end());
+            }
+
+            inline size_type size() const {
+                return (m_width == 0) ? 0 : m_data.size() / m_width;
+            }
+
+            inline size_type width() const {
+                return m_width;
+            }
+
+            //Pointer to the first value of the i-th tuple
+            inline const value_type* tuple(const size_type i) const {
+                return m_data.data() + i * m_width;
+            }
+
+            inline const std::vector<value_type>& data() const {
+                return m_data;
+            }
+
+            inline void clear(){
+                m_data.clear();
+            }
+        };
+
+        //Writes a line per tuple with its values separated by spaces
+        class ostream_sink {
+        public:
+            typedef uint64_t size_type;
+
+        private:
+            std::ostream* m_ptr_out;
+            size_type m_size = 0;
+
+        public:
+            ostream_sink(std::ostream &out) : m_ptr_out(&out) {}
+
+            template<class tuple_t>
+            inline void add(const tuple_t &tuple){
+                auto it = tuple.begin();
+                if(it != tuple.end()){
+                    *m_ptr_out << *it;
+                    for(++it; it != tuple.end(); ++it){
+                        *m_ptr_out << ' ' << *it;
+                    }
+                }
+                *m_ptr_out << '\n';
+                ++m_size;
+            }
+
+            inline size_type size() const {
+                return m_size;
+            }
+        };
+    }
+}
+
+#endif //RING_RESULT_SINK_HPP
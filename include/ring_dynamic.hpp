@@ -0,0 +1,290 @@
+/*
+ * ring_dynamic.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_DYNAMIC_HPP
+#define RING_DYNAMIC_HPP
+
+#include <ring_similarity.hpp>
+#include <triple_pattern.hpp>
+#include <delta_store.hpp>
+#include <ltj_iterator.hpp>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <condition_variable>
+
+namespace ring_ltj {
+
+    /**
+     * Index that accepts inserted and deleted triples. The updates go to the delta of the ring (see
+     * ring_similarity::delta), which is copied on every write, so the queries running on the ring keep
+     * the triples they started with. The copy shares most of the triples of the delta (see delta_store),
+     * but every write still publishes a new one, so the writers with many triples should use apply.
+     * When the delta reaches the threshold a background thread rebuilds the BWTs with the updated
+     * triples and publishes the new ring; the updates made during the rebuild stay in the delta of the
+     * new ring.
+     *
+     * A query takes the current ring with ring() and keeps the pointer until it ends. The writers are
+     * serialized, the queries never wait for them nor for the merge.
+     */
+    template<class ring_t = ring_similarity<>>
+    class ring_dynamic {
+
+    public:
+        typedef uint64_t size_type;
+        typedef uint64_t value_type;
+        typedef ring_t ring_type;
+        typedef std::shared_ptr<ring_type> ring_ptr_type;
+        typedef typename ring_type::delta_ptr_type delta_ptr_type;
+        typedef typename ring_type::knn_index_type knn_index_type;
+        typedef delta_store::triple_type triple_type;
+
+    private:
+        ring_ptr_type m_ring;
+        size_type m_threshold;
+        size_type m_threads;
+        std::atomic<size_type> m_version{0}; //changes with every update and merge
+        size_type m_merges = 0;
+
+        std::mutex m_mutex; //writers and the publication of a merged ring
+        std::mutex m_merge_mutex; //one merge at a time
+        std::condition_variable m_cv;
+        std::thread m_merger;
+        bool m_stop = false;
+
+        //The triple is in the BWTs of the ring (the delta is not checked)
+        static bool in_ring(ring_type &ring, const triple_type &t){
+            if(t[0] > ring.max_s || t[1] > ring.max_p || t[2] > ring.max_o) return false;
+            triple_pattern tp;
+            tp.const_s(t[0]);
+            tp.const_p(t[1]);
+            tp.const_o(t[2]);
+            ltj_iterator<ring_type, uint8_t, uint64_t> it(&tp, &ring);
+            return !it.is_empty();
+        }
+
+        static inline bool is_valid(const triple_type &t){
+            return t[0] > 0 && t[1] > 0 && t[2] > 0;
+        }
+
+        inline size_type delta_size() const {
+            delta_ptr_type d = ring()->delta();
+            return d ? d->size() : 0;
+        }
+
+        //A rebuild would leave some triple (it cannot build an empty ring)
+        static inline bool mergeable(const ring_type &r, const delta_ptr_type &d){
+            if(!d || d->empty()) return false;
+            return d->inserted_size() > 0 || d->deleted_size() < r.n_triples();
+        }
+
+        //Applies the updates on a copy of the delta of the current ring and publishes it
+        template<class update_t>
+        void update(update_t apply){
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ring_ptr_type r = ring();
+            delta_ptr_type d = r->delta();
+            std::shared_ptr<delta_store> nd = d ? std::make_shared<delta_store>(*d) : std::make_shared<delta_store>();
+            apply(*r, *nd);
+            r->replace_delta(nd->empty() ? delta_ptr_type() : delta_ptr_type(nd));
+            ++m_version;
+            if(m_threshold > 0 && nd->size() >= m_threshold) m_cv.notify_one();
+        }
+
+        void run(){
+            std::unique_lock<std::mutex> lock(m_mutex);
+            while(true){
+                //When every triple is deleted it waits for an insertion
+                m_cv.wait(lock, [this]{
+                    ring_ptr_type r = ring();
+                    return m_stop || (delta_size() >= m_threshold && mergeable(*r, r->delta()));
+                });
+                if(m_stop) return;
+                lock.unlock();
+                merge();
+                lock.lock();
+            }
+        }
+
+    public:
+
+        /**
+         *
+         * @param ring      Index with the initial triples
+         * @param threshold Number of inserted and deleted triples that starts a merge in the background
+         *                  (0 means that the delta is only merged by calling merge)
+         * @param threads   Threads used to rebuild the BWTs
+         */
+        explicit ring_dynamic(ring_ptr_type ring, const size_type threshold = 1 << 16, const size_type threads = 1)
+                : m_ring(std::move(ring)), m_threshold(threshold), m_threads(threads) {
+            if(m_threshold > 0){
+                m_merger = std::thread(&ring_dynamic::run, this);
+            }
+        }
+
+        ring_dynamic(const ring_dynamic &o) = delete;
+        ring_dynamic &operator=(const ring_dynamic &o) = delete;
+
+        ~ring_dynamic(){
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+            m_cv.notify_one();
+            if(m_merger.joinable()) m_merger.join();
+        }
+
+        //Ring of a query, with its delta. A merge publishes a new ring but does not change this one.
+        inline ring_ptr_type ring() const {
+            return std::atomic_load(&m_ring);
+        }
+
+        /**
+         * Inserts a triple. Every call publishes a new delta, use apply for many triples.
+         *
+         * @return  False if a term is 0 (not a valid identifier)
+         */
+        bool insert(const triple_type &t){
+            if(!is_valid(t)) return false;
+            update([&t](ring_type &r, delta_store &d){
+                d.insert(t, in_ring(r, t));
+            });
+            return true;
+        }
+
+        /**
+         * Deletes a triple, nothing changes if it is not in the index.
+         *
+         * @return  False if a term is 0 (not a valid identifier)
+         */
+        bool remove(const triple_type &t){
+            if(!is_valid(t)) return false;
+            update([&t](ring_type &r, delta_store &d){
+                d.remove(t, in_ring(r, t));
+            });
+            return true;
+        }
+
+        /**
+         * Deletes and then inserts several triples, the queries see all the changes or none of them.
+         *
+         * @return  Number of triples skipped because one of their terms is 0
+         */
+        size_type apply(const std::vector<triple_type> &inserts, const std::vector<triple_type> &deletes){
+            size_type skipped = 0;
+            update([&](ring_type &r, delta_store &d){
+                for(const auto &t : deletes){
+                    if(is_valid(t)) d.remove(t, in_ring(r, t)); else ++skipped;
+                }
+                for(const auto &t : inserts){
+                    if(is_valid(t)) d.insert(t, in_ring(r, t)); else ++skipped;
+                }
+            });
+            return skipped;
+        }
+
+        /**
+         * Rebuilds the BWTs with the triples of the current ring and its delta, and publishes the new ring.
+         * The queries keep running on the old one meanwhile. The new ring shares the KNN component of the
+         * old one. It is called by the background thread, and it can be called to empty the delta before
+         * storing the index.
+         *
+         * @return  False if there was nothing to merge or no triple would be left (the delta is kept)
+         */
+        bool merge(){
+            std::lock_guard<std::mutex> merge_lock(m_merge_mutex);
+            ring_ptr_type old;
+            delta_ptr_type snapshot;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                old = ring();
+                snapshot = old->delta();
+            }
+            if(!mergeable(*old, snapshot)) return false;
+
+            //1. Triples of the BWTs (sorted in SPO) minus the deleted ones, plus the inserted ones
+            std::vector<spo_triple> D;
+            D.reserve(old->n_triples() + snapshot->inserted_size());
+            const auto inserted = snapshot->inserted();
+            auto it_ins = inserted.begin();
+            auto push = [&D](const triple_type &t){
+                D.emplace_back(t[0], t[1], t[2]);
+            };
+            triple_pattern tp;
+            tp.var_s(0);
+            tp.var_p(1);
+            tp.var_o(2);
+            ltj_iterator<ring_type, uint8_t, uint64_t> it(&tp, old.get());
+            for(value_type s = it.leap(0); s != 0; s = it.leap(0, s + 1)){
+                it.down(0, s);
+                for(value_type p = it.leap(1); p != 0; p = it.leap(1, p + 1)){
+                    it.down(1, p);
+                    for(value_type o = it.leap(2); o != 0; o = it.leap(2, o + 1)){
+                        triple_type t{{s, p, o}};
+                        while(it_ins != inserted.end() && *it_ins < t) push(*it_ins++);
+                        if(!snapshot->is_deleted(t)) push(t);
+                    }
+                    it.up(1);
+                }
+                it.up(0);
+            }
+            while(it_ins != inserted.end()) push(*it_ins++);
+            if(D.empty()) return false;
+
+            //2. New BWTs with the identifiers and the KNN component of the old ring (no graph is built)
+            ring_ptr_type fresh = std::make_shared<ring_type>(D, *old, m_threads);
+            std::vector<spo_triple>().swap(D);
+
+            //3. The updates made during the rebuild are kept in the delta of the new ring
+            std::lock_guard<std::mutex> lock(m_mutex);
+            delta_ptr_type current = ring()->delta();
+            if(current){
+                auto rebased = std::make_shared<delta_store>(current->rebase(*snapshot));
+                if(!rebased->empty()) fresh->replace_delta(rebased);
+            }
+            std::atomic_store(&m_ring, fresh);
+            ++m_version;
+            ++m_merges;
+            return true;
+        }
+
+        //Number of updates and merges, a cache of results is valid while it does not change
+        inline size_type version() const {
+            return m_version.load();
+        }
+
+        inline size_type merges() {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            return m_merges;
+        }
+
+        inline size_type threshold() const {
+            return m_threshold;
+        }
+
+        //Number of inserted and deleted triples waiting to be merged
+        inline size_type pending() const {
+            return delta_size();
+        }
+    };
+}
+
+#endif //RING_DYNAMIC_HPP
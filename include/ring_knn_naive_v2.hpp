@@ -237,7 +237,7 @@ namespace ring_ltj {
             for(size_type p = 0; p < g.size(); ++p){
                 for(size_type j = 0; j < g[p].size(); ++j){
                     m_knn_lists.emplace_back(g[p][j].id);
-                    knn_item_type inv_item{p+1, g[p][j].k};
+                    knn_item_type inv_item{p+1, g[p][j].k, 0};
                     inv_g[g[p][j].id-1].push_back(inv_item);
                 }
             }
@@ -25,6 +25,12 @@
 #include "bwt_interval.hpp"
 #include "muthu.hpp"
 #include <knn_graph_cds.hpp>
+#include <knn_cache.hpp>
+#include <knn_index.hpp>
+#include <delta_store.hpp>
+#include <external_sort.hpp>
+#include <dataset_io.hpp>
+#include <sdsl/int_vector_buffer.hpp>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,22 +46,42 @@ namespace ring_ltj {
         typedef bwt_p_t bwt_p_type;
         typedef std::tuple<uint32_t, uint32_t, uint32_t> spo_triple_type;
         typedef knn_graph_cds<> knn_graph_cds_type;
-        typedef typename knn_graph_cds_type::intersection_iterator_type knn_intersection_iterator_type;
-        typedef typename knn_graph_cds_type::range_iterator_type knn_range_iterator_type;
-        typedef typename knn_graph_cds_type::intersection_helper_type knn_intersection_helper_type;
-        typedef typename knn_graph_cds_type::range_helper_type knn_range_helper_type;
+        typedef knn_index<knn_graph_cds_type> knn_index_type;
+        typedef std::shared_ptr<knn_index_type> knn_ptr_type;
+        typedef typename knn_index_type::stamp_type knn_stamp_type;
+        typedef typename knn_index_type::intersection_iterator_type knn_intersection_iterator_type;
+        typedef typename knn_index_type::range_iterator_type knn_range_iterator_type;
+        typedef typename knn_index_type::intersection_helper_type knn_intersection_helper_type;
+        typedef typename knn_index_type::range_helper_type knn_range_helper_type;
+        typedef typename knn_index_type::mutual_list_type knn_mutual_list_type;
+        typedef std::shared_ptr<const delta_store> delta_ptr_type;
 
     private:
         bwt_type m_bwt_s; //POS
         bwt_p_type m_bwt_p; //OSP
         bwt_type m_bwt_o; //SPO
-        knn_graph_cds_type m_knn_graph_cds;
+        //KNN graphs, read and replaced atomically (see knn and replace_knn)
+        knn_ptr_type m_knn = std::make_shared<knn_index_type>();
+        size_type m_knn_cache_budget = 0; //Cache given to the KNN components (see set_knn_cache)
+        size_type m_knn_cache_shards = 16;
+        //Triples inserted and deleted after building the BWTs, read and replaced atomically (see delta)
+        delta_ptr_type m_delta;
 
 
         size_type m_max_s;
         size_type m_max_p;
         size_type m_max_o;
         size_type m_n_triples;  // number of triples
+        uint64_t m_id_space = 0; //hash of the identifiers of subjects and objects, the stamp of the KNN components
+
+        //Distinct counts (optional): m_muthu_xy_z counts the distinct values of z in the triples sorted by x, y, z
+        bool m_has_distinct = false;
+        muthu m_muthu_sp_o;
+        muthu m_muthu_os_p;
+        muthu m_muthu_po_s;
+        muthu m_muthu_ps_o;
+        muthu m_muthu_so_p;
+        muthu m_muthu_op_s;
 
         void copy(const ring_similarity &o) {
             m_bwt_s = o.m_bwt_s;
@@ -64,14 +90,200 @@ namespace ring_ltj {
             m_max_s = o.m_max_s;
             m_max_p = o.m_max_p;
             m_max_o = o.m_max_o;
-            m_knn_graph_cds = o.m_knn_graph_cds;
+            m_knn = std::make_shared<knn_index_type>(*o.knn());
+            m_knn_cache_budget = o.m_knn_cache_budget;
+            m_knn_cache_shards = o.m_knn_cache_shards;
+            m_delta = o.delta();
             m_n_triples = o.m_n_triples;
-            /*m_muthu_sp_o = o.m_muthu_sp_o;
+            m_id_space = o.m_id_space;
+            m_has_distinct = o.m_has_distinct;
+            m_muthu_sp_o = o.m_muthu_sp_o;
             m_muthu_os_p = o.m_muthu_os_p;
             m_muthu_po_s = o.m_muthu_po_s;
             m_muthu_ps_o = o.m_muthu_ps_o;
             m_muthu_so_p = o.m_muthu_so_p;
-            m_muthu_op_s = o.m_muthu_op_s;*/
+            m_muthu_op_s = o.m_muthu_op_s;
+        }
+
+        /**
+         * Builds the muthu structure over the column val of the triples sorted by (first, second, val).
+         */
+        template<uint8_t first, uint8_t second, uint8_t val>
+        static void build_muthu(muthu &m, vector<spo_triple_type> &D){
+            sort(D.begin(), D.end(), [](const spo_triple_type& a, const spo_triple_type& b) {
+                return std::tie(std::get<first>(a), std::get<second>(a), std::get<val>(a))
+                       < std::tie(std::get<first>(b), std::get<second>(b), std::get<val>(b));});
+            uint64_t n = D.size();
+            int_vector<> new_L(n+1);
+            new_L[0] = 0;
+            for (uint64_t i=1; i<=n; i++)
+                new_L[i] = std::get<val>(D[i-1]);
+            util::bit_compress(new_L);
+            m = muthu(new_L);
+        }
+
+        /**
+         * Builds the structures counting the distinct values of a term in the interval of another one.
+         * Every range of triples with the same first term has the same positions in all the orders starting
+         * with that term, so the counts are valid for the intervals of one and two bound terms.
+         */
+        void build_distinct(vector<spo_triple_type> &D){
+            std::cout << "Building Muthus..." << std::flush;
+            build_muthu<0, 1, 2>(m_muthu_sp_o, D);
+            build_muthu<0, 2, 1>(m_muthu_so_p, D);
+            build_muthu<1, 0, 2>(m_muthu_ps_o, D);
+            build_muthu<1, 2, 0>(m_muthu_po_s, D);
+            build_muthu<2, 0, 1>(m_muthu_os_p, D);
+            build_muthu<2, 1, 0>(m_muthu_op_s, D);
+            m_has_distinct = true;
+            std::cout << " Done." << std::endl;
+        }
+
+        /**
+         * Builds the BWT whose column stores the term val of each triple. The triples of D have to be sorted
+         * by the order of that BWT, and key is the term used to compute the array C.
+         *
+         * @param b         BWT to build
+         * @param D         Triples
+         * @param alphabet  Maximum value of key
+         */
+        template<uint8_t key, uint8_t val, class bwt_t>
+        static void build_bwt(bwt_t &b, const vector<spo_triple_type> &D, const uint64_t alphabet){
+            uint64_t i, c, n = D.size();
+            std::vector<uint32_t> M(alphabet+1, 0);
+            for (i = 0; i < n; i++)
+                M[std::get<key>(D[i])]++;
+
+            vector<uint64_t> new_C;
+            uint64_t cur_pos = 1;
+            new_C.push_back(0); // Dummy value
+            new_C.push_back(cur_pos);
+            for (c = 2; c <= alphabet; c++) {
+                cur_pos += M[c-1];
+                new_C.push_back(cur_pos);
+            }
+            new_C.push_back(n+1);
+            new_C.shrink_to_fit();
+
+            M.clear();
+            M.shrink_to_fit();
+
+            int_vector<> new_L(n+1);
+            new_L[0] = 0;
+            for (i=1; i<=n; i++)
+                new_L[i] = std::get<val>(D[i-1]);
+            util::bit_compress(new_L);
+            b = bwt_t(new_L, new_C);
+        }
+
+        //Marks an identifier in the bitmap of the space of identifiers (see knn_stamp_type::of_ids)
+        static inline void mark_id(std::vector<uint64_t> &ids, const uint64_t id){
+            if(id / 64 >= ids.size()) ids.resize(id / 64 + 1, 0);
+            ids[id / 64] |= (1ULL << (id % 64));
+        }
+
+        //KNN component of the triples of the index
+        void build_knn(const knn_graph_type &g, const size_type max_k){
+            m_knn = std::make_shared<knn_index_type>(g, max_k);
+            m_knn->set_stamp(knn_stamp());
+        }
+
+        /**
+         * Parallel construction: each BWT sorts its own copy of the triples (SPO, OSP and POS)
+         * and builds its wavelet matrix while the KNN graph is built by another thread.
+         */
+        void build_parallel(vector<spo_triple_type> &D, knn_graph_type &g, const size_type max_k,
+                            const uint64_t alphabet_SO, const size_type threads){
+
+            std::cout << "Building BWT_O, BWT_P, BWT_S and KNN (nodes=" << g.size() << ", max_k=" << max_k
+                      << ") with " << threads << " threads..." << std::flush;
+            vector<spo_triple_type> D_osp(D), D_pos(D);
+            parallel::for_each(4, threads, [&](uint64_t task, uint64_t){
+                switch (task) {
+                    case 0: {
+                        sort(D.begin(), D.end());
+                        build_bwt<0, 2>(m_bwt_o, D, alphabet_SO);
+                        break;
+                    }
+                    case 1: {
+                        sort(D_osp.begin(), D_osp.end(), [](const spo_triple& a, const spo_triple& b) {
+                            return std::tie(std::get<2>(a), std::get<0>(a), std::get<1>(a))
+                                   < std::tie(std::get<2>(b), std::get<0>(b), std::get<1>(b));});
+                        build_bwt<2, 1>(m_bwt_p, D_osp, alphabet_SO);
+                        vector<spo_triple_type>().swap(D_osp);
+                        break;
+                    }
+                    case 2: {
+                        sort(D_pos.begin(), D_pos.end(), [](const spo_triple& a, const spo_triple& b) {
+                            return std::tie(std::get<1>(a), std::get<2>(a), std::get<0>(a))
+                                   < std::tie(std::get<1>(b), std::get<2>(b), std::get<0>(b));});
+                        build_bwt<1, 0>(m_bwt_s, D_pos, m_max_p);
+                        vector<spo_triple_type>().swap(D_pos);
+                        break;
+                    }
+                    default: {
+                        build_knn(g, max_k);
+                    }
+                }
+            });
+            std::cout << " Done." << std::endl;
+        }
+
+        /**
+         * Builds a BWT from a file of triples without keeping them in memory. The triples are sorted with
+         * an external sorter and the column of the BWT is streamed to disk before building its wavelet matrix.
+         * Each triple is permuted by perm so that its order is the lexicographic one; then, the first term
+         * is the key used to compute C and the last one is stored in the column.
+         *
+         * @param b             BWT to build
+         * @param file          Triples (binary or text file, see dataset_io::scan_triples)
+         * @param perm          Permutation of the terms of each triple
+         * @param alphabet      Maximum value of the first term after the permutation
+         * @param max_val       Maximum value of the last term after the permutation
+         * @param ram_budget    Maximum number of bytes used to sort
+         * @param tmp_prefix    Prefix of the temporary files
+         */
+        template<class bwt_t>
+        static void build_bwt_external(bwt_t &b, const std::string &file, const std::array<uint8_t, 3> &perm,
+                                       const uint64_t alphabet, const uint64_t max_val,
+                                       const size_type ram_budget, const std::string &tmp_prefix){
+            typedef std::array<uint32_t, 3> triple_type;
+            external_sorter<triple_type> sorter(tmp_prefix, ram_budget);
+            dataset_io::scan_triples(file, [&](uint64_t s, uint64_t p, uint64_t o){
+                uint64_t t[3] = {s, p, o};
+                sorter.push_back({(uint32_t) t[perm[0]], (uint32_t) t[perm[1]], (uint32_t) t[perm[2]]});
+            });
+            uint64_t n = sorter.size();
+            std::vector<uint32_t> M(alphabet+1, 0);
+            std::string column_file = tmp_prefix + ".column";
+            {
+                int_vector_buffer<> L(column_file, std::ios::out, 1024*1024, sdsl::bits::hi(max_val)+1);
+                L.push_back(0);
+                sorter.merge([&](const triple_type &t){
+                    M[t[0]]++;
+                    L.push_back(t[2]);
+                });
+                L.close();
+            }
+
+            vector<uint64_t> new_C;
+            uint64_t cur_pos = 1;
+            new_C.push_back(0); // Dummy value
+            new_C.push_back(cur_pos);
+            for (uint64_t c = 2; c <= alphabet; c++) {
+                cur_pos += M[c-1];
+                new_C.push_back(cur_pos);
+            }
+            new_C.push_back(n+1);
+            new_C.shrink_to_fit();
+            M.clear();
+            M.shrink_to_fit();
+
+            {
+                int_vector_buffer<> L(column_file);
+                b = bwt_t(L, new_C);
+            }
+            std::remove(column_file.c_str());
         }
 
     public:
@@ -83,17 +295,17 @@ namespace ring_ltj {
         const size_type& max_s = m_max_s;
         const size_type& max_p = m_max_p;
         const size_type& max_o = m_max_o;
-        const size_type &max_k = m_knn_graph_cds.max_k;
-        const size_type &knn_nodes = m_knn_graph_cds.nodes;
 
         ring_similarity() = default;
 
         // Assumes the triples have been stored in a vector<spo_triple>
+        // With threads > 1 the three BWTs and the KNN graph are built at the same time
+        // With distinct = true the structures counting distinct values (used by the GAO) are also built
         ring_similarity(vector<spo_triple_type> &D, knn_graph_type &g,
-                        size_type max_k) {
+                        size_type max_k, const size_type threads = 1, const bool distinct = false) {
 
-            uint64_t i, pos_c;
-            vector<spo_triple>::iterator it, triple_begin = D.begin(), triple_end = D.end();
+            uint64_t i;
+            vector<spo_triple>::iterator triple_begin = D.begin(), triple_end = D.end();
             uint64_t U, n = m_n_triples = D.size();
 
             {
@@ -115,165 +327,190 @@ namespace ring_ltj {
             }
             uint64_t alphabet_SO = U;
             m_max_s = m_max_o = alphabet_SO;
+            {
+                std::vector<uint64_t> ids(U / 64 + 1, 0);
+                for (i = 0; i < n; i++) {
+                    mark_id(ids, std::get<0>(D[i]));
+                    mark_id(ids, std::get<2>(D[i]));
+                }
+                m_id_space = knn_stamp_type::of_ids(ids);
+            }
 
-            std::vector<uint32_t> M_O, M_S, M_P;
-
-            for (i = 1; i <= alphabet_SO; i++)
-                M_S.push_back(0);
-            M_S.shrink_to_fit();
-
-            for (it = triple_begin, i=0; i<n; i++, it++)
-                M_S[std::get<0>(*it)]++;
+            if(threads > 1){
+                build_parallel(D, g, max_k, alphabet_SO, threads);
+                if(distinct) build_distinct(D);
+                cout << "-- Index constructed successfully" << endl; fflush(stdout);
+                return;
+            }
 
             // Sorts the triples lexycographically
             sort(triple_begin, triple_end);
 
             // First O
             std::cout << "Building BWT_O..." << std::flush;
-            {
-                uint64_t i, c;
-                vector<uint64_t> new_C_O;
-                uint64_t cur_pos = 1;
-                new_C_O.push_back(0); // Dummy value
-                new_C_O.push_back(cur_pos);
-                for (c = 2; c <= alphabet_SO; c++) {
-                    cur_pos += M_S[c-1];
-                    new_C_O.push_back(cur_pos);
-                }
-                new_C_O.push_back(n+1);
-                new_C_O.shrink_to_fit();
-
-                M_S.clear();
-                M_S.shrink_to_fit();
-
-                int_vector<> new_O(n+1);
-                new_O[0] = 0;
-                for (i=1; i<=n; i++)
-                    new_O[i] = std::get<2>(D[i-1]);
-                //m_muthu_sp_o = muthu(new_O);
-                util::bit_compress(new_O);
-                // builds the WT for BWT(O)
-                m_bwt_o = bwt_type(new_O, new_C_O);
-            }
+            build_bwt<0, 2>(m_bwt_o, D, alphabet_SO);
             std::cout << " Done." << std::endl;
 
-            M_O.resize(alphabet_SO+1, 0);
-            M_O.shrink_to_fit();
-
-            for (it = triple_begin, i=0; i<n; i++, it++)
-                M_O[std::get<2>(*it)]++;
-
             std::cout << "Building BWT_P..." << std::flush;
             stable_sort(D.begin(), D.end(), [](const spo_triple& a,
                     const spo_triple& b) {return std::get<2>(a) < std::get<2>(b);});
-            {
-                uint64_t c, i;
-                vector<uint64_t> new_C_P;
-
-                uint64_t cur_pos = 1;
-                new_C_P.push_back(0);  // Dummy value
-                new_C_P.push_back(cur_pos);
-                for (c = 2; c <= alphabet_SO; c++) {
-                    cur_pos += M_O[c-1];
-                    new_C_P.push_back(cur_pos);
-                }
-                new_C_P.push_back(n+1);
-                new_C_P.shrink_to_fit();
-
-                M_O.clear();
-
-                int_vector<> new_P(n+1);
-                new_P[0] = 0;
-                for (i=1; i<=n; i++)
-                    new_P[i] = std::get<1>(D[i-1]);
-
-
-                //m_muthu_os_p = muthu(new_P);
-                util::bit_compress(new_P);
-                m_bwt_p = bwt_p_type(new_P, new_C_P);
-            }
+            build_bwt<2, 1>(m_bwt_p, D, alphabet_SO);
             std::cout << " Done." << std::endl;
 
-            M_P.resize(m_max_p+1, 0);
-            M_P.shrink_to_fit();
-
-            for (it = triple_begin, i=0; i<n; i++, it++)
-                M_P[std::get<1>(*it)]++;
-
-
             std::cout << "Building BWT_S..." << std::flush;
             stable_sort(D.begin(), D.end(), [](const spo_triple& a,
                     const spo_triple& b) {return std::get<1>(a) < std::get<1>(b); });
-            // Builds BWT_S
-            {
-                uint64_t i, c;
-                vector<uint64_t> new_C_S;
-
-                uint64_t cur_pos = 1;
-                new_C_S.push_back(0);  // Dummy value
-                new_C_S.push_back(cur_pos);
-                for (c = 2; c <= m_max_p; c++) {
-                    cur_pos += M_P[c-1];
-                    new_C_S.push_back(cur_pos);
-                }
-                new_C_S.push_back(n+1);
-                new_C_S.shrink_to_fit();
+            build_bwt<1, 0>(m_bwt_s, D, m_max_p);
+            std::cout << " Done." << std::endl;
 
-                M_P.clear();
 
-                int_vector<> new_S(n+1);
-                new_S[0] = 0;
-                for (i=1; i<=n; i++)
-                    new_S[i] = std::get<0>(D[i-1]);
-                //m_muthu_po_s = muthu(new_S);
-                util::bit_compress(new_S);
+            if(distinct) build_distinct(D);
 
-                m_bwt_s = bwt_type(new_S, new_C_S);
-            }
+            std::cout << "Building KNN with nodes=" << g.size() << " and max_k=" << max_k << std::endl;
+            build_knn(g, max_k);
             std::cout << " Done." << std::endl;
 
+            cout << "-- Index constructed successfully" << endl; fflush(stdout);
+        };
 
-            /*std::cout << "Building Muthus..." << std::flush;
-            sort(D.begin(), D.end(), [](const spo_triple& a,
-                    const spo_triple& b) { return std::tie(std::get<2>(a), std::get<1>(a), std::get<0>(a))
-                    < std::tie(std::get<2>(b), std::get<1>(b), std::get<0>(b));});
-            {
-                int_vector<> new_S(n+1);
-                new_S[0] = 0;
-                for (i=1; i<=n; i++)
-                    new_S[i] = std::get<0>(D[i-1]);
-                m_muthu_op_s = muthu(new_S);
+        /**
+         * Rebuilds the BWTs of an index with its updated triples (see ring_dynamic). The triples use the
+         * identifiers of o, so the new index keeps its space of identifiers and shares its KNN component
+         * and its cache instead of building a graph. The distinct structures are built if o has them.
+         *
+         * @param D         Triples sorted in SPO, without repetitions
+         * @param o         Index whose triples were updated
+         * @param threads   With threads > 1 the three BWTs are built at the same time
+         */
+        ring_similarity(vector<spo_triple_type> &D, const ring_similarity &o, const size_type threads = 1) {
+
+            uint64_t U = 0, n = m_n_triples = D.size();
+            m_max_p = 0;
+            for (uint64_t i = 0; i < n; i++) {
+                if (std::get<1>(D[i]) > m_max_p) m_max_p = std::get<1>(D[i]);
+                if (std::get<0>(D[i]) > U) U = std::get<0>(D[i]);
+                if (std::get<2>(D[i]) > U) U = std::get<2>(D[i]);
             }
+            uint64_t alphabet_SO = U;
+            m_max_s = m_max_o = alphabet_SO;
+            m_id_space = o.m_id_space;
+            m_knn = o.knn();
+            m_knn_cache_budget = o.m_knn_cache_budget;
+            m_knn_cache_shards = o.m_knn_cache_shards;
+
+            //D is already sorted for BWT_O, the other orders come from their own copies
+            vector<spo_triple_type> D_osp, D_pos;
+            parallel::for_each(3, threads, [&](uint64_t task, uint64_t){
+                switch (task) {
+                    case 0: {
+                        build_bwt<0, 2>(m_bwt_o, D, alphabet_SO);
+                        break;
+                    }
+                    case 1: {
+                        D_osp = D;
+                        stable_sort(D_osp.begin(), D_osp.end(), [](const spo_triple& a,
+                                const spo_triple& b) {return std::get<2>(a) < std::get<2>(b);});
+                        build_bwt<2, 1>(m_bwt_p, D_osp, alphabet_SO);
+                        vector<spo_triple_type>().swap(D_osp);
+                        break;
+                    }
+                    default: {
+                        D_pos = D;
+                        sort(D_pos.begin(), D_pos.end(), [](const spo_triple& a, const spo_triple& b) {
+                            return std::tie(std::get<1>(a), std::get<2>(a), std::get<0>(a))
+                                   < std::tie(std::get<1>(b), std::get<2>(b), std::get<0>(b));});
+                        build_bwt<1, 0>(m_bwt_s, D_pos, m_max_p);
+                        vector<spo_triple_type>().swap(D_pos);
+                    }
+                }
+            });
 
+            if(o.m_has_distinct) build_distinct(D);
+        };
 
-            stable_sort(D.begin(), D.end(), [](const spo_triple& a,
-                                        const spo_triple& b) {return std::get<0>(a) < std::get<0>(b);});
-            {
-                int_vector<> new_P(n+1);
-                new_P[0] = 0;
-                for (i=1; i<=n; i++)
-                    new_P[i] = std::get<1>(D[i-1]);
-                m_muthu_so_p = muthu(new_P);
-            }
 
-            stable_sort(D.begin(), D.end(), [](const spo_triple& a,
-                                               const spo_triple& b) {return std::get<1>(a) < std::get<1>(b);});
-            {
-                int_vector<> new_O(n+1);
-                new_O[0] = 0;
-                for (i=1; i<=n; i++)
-                    new_O[i] = std::get<2>(D[i-1]);
-                m_muthu_ps_o = muthu(new_O);
+        /**
+         * Builds the index from a file of triples (binary or text, see dataset_io) bounding the memory used to sort
+         * them. The triples of each BWT are sorted on disk. With threads > 1 the three BWTs and the KNN graph
+         * are built at the same time and the budget is split among the BWTs being sorted.
+         *
+         * @param file          Triples
+         * @param g             KNN graph
+         * @param max_k         Maximum k of the graph
+         * @param ram_budget    Maximum number of bytes used to sort the triples
+         * @param tmp_prefix    Prefix of the temporary files
+         * @param threads       Number of threads
+         */
+        ring_similarity(const std::string &file, knn_graph_type &g, size_type max_k,
+                        const size_type ram_budget, const std::string &tmp_prefix, const size_type threads = 1) {
+
+            uint64_t U = 0;
+            m_max_p = 0;
+            m_n_triples = 0;
+            std::vector<uint64_t> ids;
+            dataset_io::scan_triples(file, [&](uint64_t s, uint64_t p, uint64_t o){
+                if(p > m_max_p) m_max_p = p;
+                if(s > U) U = s;
+                if(o > U) U = o;
+                mark_id(ids, s);
+                mark_id(ids, o);
+                ++m_n_triples;
+            });
+            ids.resize(U / 64 + 1, 0);
+            m_id_space = knn_stamp_type::of_ids(ids);
+            std::vector<uint64_t>().swap(ids);
+            uint64_t alphabet_SO = U;
+            m_max_s = m_max_o = alphabet_SO;
+
+            if(threads > 1){
+                std::cout << "Building BWT_O, BWT_P, BWT_S and KNN (nodes=" << g.size() << ", max_k=" << max_k
+                          << ") with " << threads << " threads..." << std::flush;
+                size_type budget = ram_budget / std::min<size_type>(threads, 3);
+                parallel::for_each(4, threads, [&](uint64_t task, uint64_t){
+                    switch (task) {
+                        case 0: {
+                            build_bwt_external(m_bwt_o, file, {0, 1, 2}, alphabet_SO, alphabet_SO,
+                                               budget, tmp_prefix + ".spo"); //SPO
+                            break;
+                        }
+                        case 1: {
+                            build_bwt_external(m_bwt_p, file, {2, 0, 1}, alphabet_SO, m_max_p,
+                                               budget, tmp_prefix + ".osp"); //OSP
+                            break;
+                        }
+                        case 2: {
+                            build_bwt_external(m_bwt_s, file, {1, 2, 0}, m_max_p, alphabet_SO,
+                                               budget, tmp_prefix + ".pos"); //POS
+                            break;
+                        }
+                        default: {
+                            build_knn(g, max_k);
+                        }
+                    }
+                });
+                std::cout << " Done." << std::endl;
+                cout << "-- Index constructed successfully" << endl; fflush(stdout);
+                return;
             }
-            std::cout << " Done." << std::endl;*/
+
+            std::cout << "Building BWT_O..." << std::flush;
+            build_bwt_external(m_bwt_o, file, {0, 1, 2}, alphabet_SO, alphabet_SO, ram_budget, tmp_prefix); //SPO
+            std::cout << " Done." << std::endl;
+
+            std::cout << "Building BWT_P..." << std::flush;
+            build_bwt_external(m_bwt_p, file, {2, 0, 1}, alphabet_SO, m_max_p, ram_budget, tmp_prefix); //OSP
+            std::cout << " Done." << std::endl;
+
+            std::cout << "Building BWT_S..." << std::flush;
+            build_bwt_external(m_bwt_s, file, {1, 2, 0}, m_max_p, alphabet_SO, ram_budget, tmp_prefix); //POS
+            std::cout << " Done." << std::endl;
 
             std::cout << "Building KNN with nodes=" << g.size() << " and max_k=" << max_k << std::endl;
-            m_knn_graph_cds = knn_graph_cds_type(g, max_k);
+            build_knn(g, max_k);
             std::cout << " Done." << std::endl;
 
             cout << "-- Index constructed successfully" << endl; fflush(stdout);
-        };
-
+        }
 
         //! Copy constructor
         ring_similarity(const ring_similarity &o) {
@@ -303,13 +540,18 @@ namespace ring_ltj {
                 m_max_p = o.m_max_p;
                 m_max_o = o.m_max_o;
                 m_n_triples = o.m_n_triples;
-                m_knn_graph_cds = std::move(o.m_knn_graph_cds);
-               /*m_muthu_sp_o = std::move(o.m_muthu_sp_o);
+                m_id_space = o.m_id_space;
+                m_knn = std::move(o.m_knn);
+                m_knn_cache_budget = o.m_knn_cache_budget;
+                m_knn_cache_shards = o.m_knn_cache_shards;
+                m_delta = std::move(o.m_delta);
+                m_has_distinct = o.m_has_distinct;
+                m_muthu_sp_o = std::move(o.m_muthu_sp_o);
                 m_muthu_os_p = std::move(o.m_muthu_os_p);
                 m_muthu_po_s = std::move(o.m_muthu_po_s);
                 m_muthu_ps_o = std::move(o.m_muthu_ps_o);
                 m_muthu_so_p = std::move(o.m_muthu_so_p);
-                m_muthu_op_s = std::move(o.m_muthu_op_s);*/
+                m_muthu_op_s = std::move(o.m_muthu_op_s);
             }
             return *this;
         }
@@ -323,33 +565,76 @@ namespace ring_ltj {
             std::swap(m_max_p, o.m_max_p);
             std::swap(m_max_o, o.m_max_o);
             std::swap(m_n_triples, o.m_n_triples);
-            std::swap(m_knn_graph_cds, o.m_knn_graph_cds);
-            /*m_muthu_sp_o.swap(o.m_muthu_sp_o);
+            std::swap(m_id_space, o.m_id_space);
+            std::swap(m_knn, o.m_knn);
+            std::swap(m_knn_cache_budget, o.m_knn_cache_budget);
+            std::swap(m_knn_cache_shards, o.m_knn_cache_shards);
+            std::swap(m_delta, o.m_delta);
+            std::swap(m_has_distinct, o.m_has_distinct);
+            m_muthu_sp_o.swap(o.m_muthu_sp_o);
             m_muthu_os_p.swap(o.m_muthu_os_p);
             m_muthu_po_s.swap(o.m_muthu_po_s);
             m_muthu_ps_o.swap(o.m_muthu_ps_o);
             m_muthu_so_p.swap(o.m_muthu_so_p);
-            m_muthu_op_s.swap(o.m_muthu_op_s);*/
+            m_muthu_op_s.swap(o.m_muthu_op_s);
         }
 
+    private:
+
+        //Sections after the number of triples, older indexes end before some of them
+        void load_optional(std::istream &in) {
+            if(in.peek() == std::char_traits<char>::eof()){
+                in.clear();
+                return;
+            }
+            sdsl::read_member(m_has_distinct, in);
+            if(m_has_distinct){
+                m_muthu_sp_o.load(in);
+                m_muthu_os_p.load(in);
+                m_muthu_po_s.load(in);
+                m_muthu_ps_o.load(in);
+                m_muthu_so_p.load(in);
+                m_muthu_op_s.load(in);
+            }
+            if(in.peek() == std::char_traits<char>::eof()){
+                in.clear();
+                return;
+            }
+            m_knn->load_named(in);
+            if(in.peek() == std::char_traits<char>::eof()){
+                in.clear();
+                return;
+            }
+            sdsl::read_member(m_id_space, in);
+        }
+
+    public:
+
         //! Serializes the data structure into the given ostream
         size_type serialize(std::ostream &out, sdsl::structure_tree_node *v = nullptr, std::string name = "") const {
             sdsl::structure_tree_node *child = sdsl::structure_tree::add_child(v, name, sdsl::util::class_name(*this));
             size_type written_bytes = 0;
+            knn_ptr_type knn_snapshot = knn();
             written_bytes += m_bwt_s.serialize(out, child, "bwt_s");
             written_bytes += m_bwt_p.serialize(out, child, "bwt_p");
             written_bytes += m_bwt_o.serialize(out, child, "bwt_o");
-            written_bytes += m_knn_graph_cds.serialize(out, child, "knn_graph_cds");
-            /*written_bytes += m_muthu_sp_o.serialize(out, child, "muthu_sp_o");
-            written_bytes += m_muthu_os_p.serialize(out, child, "muthu_os_p");
-            written_bytes += m_muthu_po_s.serialize(out, child, "muthu_po_s");
-            written_bytes += m_muthu_ps_o.serialize(out, child, "muthu_ps_o");
-            written_bytes += m_muthu_so_p.serialize(out, child, "muthu_so_p");
-            written_bytes += m_muthu_op_s.serialize(out, child, "muthu_op_s");*/
+            written_bytes += knn_snapshot->graph(0).serialize(out, child, "knn_graph_cds");
             written_bytes += sdsl::write_member(m_max_s, out, child, "max_s");
             written_bytes += sdsl::write_member(m_max_p, out, child, "max_p");
             written_bytes += sdsl::write_member(m_max_o, out, child, "max_o");
             written_bytes += sdsl::write_member(m_n_triples, out, child, "n_triples");
+            //Optional sections, the indexes stored before them end here
+            written_bytes += sdsl::write_member(m_has_distinct, out, child, "has_distinct");
+            if(m_has_distinct){
+                written_bytes += m_muthu_sp_o.serialize(out, child, "muthu_sp_o");
+                written_bytes += m_muthu_os_p.serialize(out, child, "muthu_os_p");
+                written_bytes += m_muthu_po_s.serialize(out, child, "muthu_po_s");
+                written_bytes += m_muthu_ps_o.serialize(out, child, "muthu_ps_o");
+                written_bytes += m_muthu_so_p.serialize(out, child, "muthu_so_p");
+                written_bytes += m_muthu_op_s.serialize(out, child, "muthu_op_s");
+            }
+            written_bytes += knn_snapshot->serialize_named(out, child);
+            written_bytes += sdsl::write_member(m_id_space, out, child, "id_space");
             sdsl::structure_tree::add_size(child, written_bytes);
             return written_bytes;
         }
@@ -358,17 +643,18 @@ namespace ring_ltj {
             m_bwt_s.load(in);
             m_bwt_p.load(in);
             m_bwt_o.load(in);
-            m_knn_graph_cds.load(in);
-            /*m_muthu_sp_o.load(in);
-            m_muthu_os_p.load(in);
-            m_muthu_po_s.load(in);
-            m_muthu_ps_o.load(in);
-            m_muthu_so_p.load(in);
-            m_muthu_op_s.load(in);*/
+            m_knn = std::make_shared<knn_index_type>();
+            m_knn->graph(0).load(in);
             sdsl::read_member(m_max_s, in);
             sdsl::read_member(m_max_p, in);
             sdsl::read_member(m_max_o, in);
             sdsl::read_member(m_n_triples, in);
+            m_delta.reset();
+            m_has_distinct = false;
+            //Indexes stored before the space of identifiers was recorded
+            m_id_space = knn_stamp_type::legacy(m_n_triples, m_max_s, m_max_p, m_max_o);
+            load_optional(in);
+            m_knn->set_stamp(knn_stamp());
         }
 
 
@@ -771,54 +1057,199 @@ namespace ring_ltj {
 
 
 
-        /*size_type distinct_PO_S(const bwt_interval &I){
+        inline bool has_distinct() const {
+            return m_has_distinct;
+        }
+
+        /*
+         * Number of distinct values of the last term in the interval I of the first term (or of the
+         * first two terms). Without the distinct structures the length of the interval is returned.
+         */
+        size_type distinct_PO_S(const bwt_interval &I){
+            if(!m_has_distinct) return I.size();
             return m_muthu_po_s.count_distinct(I.left(), I.right());
         }
 
         size_type distinct_OP_S(const bwt_interval &I){
+            if(!m_has_distinct) return I.size();
             return m_muthu_op_s.count_distinct(I.left(), I.right());
         }
 
         size_type distinct_OS_P(const bwt_interval &I){
+            if(!m_has_distinct) return I.size();
             return m_muthu_os_p.count_distinct(I.left(), I.right());
         }
 
         size_type distinct_SO_P(const bwt_interval &I){
+            if(!m_has_distinct) return I.size();
             return m_muthu_so_p.count_distinct(I.left(), I.right());
         }
 
         size_type distinct_SP_O(const bwt_interval &I){
+            if(!m_has_distinct) return I.size();
             return m_muthu_sp_o.count_distinct(I.left(), I.right());
         }
 
         size_type distinct_PS_O(const bwt_interval &I){
+            if(!m_has_distinct) return I.size();
             return m_muthu_ps_o.count_distinct(I.left(), I.right());
-        }*/
+        }
 
         /******SIMILARITY*****/
 
-        inline void knn_intersection_iter(value_type x, size_type k1, size_type k2,
-                                          knn_intersection_iterator_type &it){
-            m_knn_graph_cds.beg_intersection_iterator(x, k1, k2, it);
+        /**
+         * KNN component used by the queries. A query takes it once and keeps using it even if it is
+         * replaced in the meantime (see replace_knn).
+         */
+        inline knn_ptr_type knn() const {
+            return std::atomic_load(&m_knn);
+        }
+
+        //Space of identifiers of the index, a KNN component is only accepted if it was built for the same one
+        inline knn_stamp_type knn_stamp() const {
+            knn_stamp_type stamp;
+            stamp.id_space = m_id_space;
+            return stamp;
+        }
+
+        /**
+         * Gives the index the space of identifiers of another one. An index rebuilt with the updates of
+         * another one uses its identifiers, so it keeps its stamp and accepts its KNN components.
+         */
+        inline void set_id_space(const knn_stamp_type &stamp){
+            m_id_space = stamp.id_space;
+            knn()->set_stamp(stamp);
+        }
+
+        inline size_type n_triples() const {
+            return m_n_triples;
+        }
+
+        /**
+         * Replaces the KNN component while the index is in use. The running queries finish with the old
+         * one, which is released when the last of them ends. The new component gets its own cache of
+         * decoded lists (see set_knn_cache).
+         *
+         * @return  False if the component was built for other triples (the index is not changed)
+         */
+        bool replace_knn(knn_ptr_type knn){
+            if(!knn || knn->stamp() != knn_stamp()) return false;
+            knn->set_cache(m_knn_cache_budget, m_knn_cache_shards);
+            std::atomic_store(&m_knn, knn);
+            return true;
+        }
+
+        /**
+         * Replaces the KNN component with the one stored in a file (see store_knn).
+         *
+         * @return  False if the file cannot be read or it was built for other triples
+         */
+        bool load_knn(const std::string &file){
+            knn_ptr_type knn = std::make_shared<knn_index_type>();
+            if(!knn->load_from_file(file)) return false;
+            return replace_knn(knn);
+        }
+
+        //Stores the KNN component in its own file
+        bool store_knn(const std::string &file) const {
+            return knn()->store_to_file(file);
+        }
+
+        /**
+         * Removes the KNN component (it keeps a graph without neighbours), so the index can be stored
+         * without it and the component in its own file.
+         *
+         * @return  The removed component
+         */
+        knn_ptr_type detach_knn(){
+            knn_ptr_type empty = std::make_shared<knn_index_type>(knn_index_type::empty(knn_stamp()));
+            return std::atomic_exchange(&m_knn, empty);
+        }
+
+        /**
+         * Adds a named KNN graph (another embedding space) that shares the triples of the index. The
+         * similarity patterns choose it with k<k>@name (see knn_graph_id). It modifies the current
+         * component, so it is not meant to be used while there are queries running.
+         *
+         * @param name  Name of the graph
+         * @param g     KNN graph
+         * @param max_k Maximum k of the graph
+         */
+        void add_knn_graph(const std::string &name, const knn_graph_type &g, const size_type max_k){
+            knn()->add_graph(name, g, max_k);
+        }
+
+        //Precomputes the mutual neighbours of every graph for the given values of k (see knn_index::build_mutual)
+        inline void build_knn_mutual(const std::vector<size_type> &ks){
+            knn()->build_mutual(ks);
+        }
+
+        //Number of KNN graphs, the default one included
+        inline size_type knn_graphs() const {
+            return knn()->graphs();
+        }
+
+        //Identifier of a KNN graph for the queries: 0 for the default one ("") and -1ULL if there is none
+        inline size_type knn_graph_id(const std::string &name) const {
+            return knn()->graph_id(name);
+        }
+
+        inline std::vector<std::string> knn_graph_names() const {
+            return knn()->names();
+        }
+
+        inline size_type knn_max_k(const size_type graph) const {
+            return knn()->max_k(graph);
         }
 
-        inline void knn_range_iter(value_type x, size_type k, bool subject,
-                                   knn_range_iterator_type &it){
-            m_knn_graph_cds.beg_range_iterator(x, k, subject, it);
+        inline size_type knn_nodes_of(const size_type graph) const {
+            return knn()->nodes(graph);
         }
 
-        inline void knn_intersection_helper(value_type x, size_type k1, size_type k2,
-                                          knn_intersection_helper_type &it){
-            m_knn_graph_cds.beg_intersection_helper(x, k1, k2, it);
+        /**
+         * Keeps the decoded lists of the KNN graphs in a cache shared by all the queries (and threads) on
+         * this index. The cache is not part of the index file, it is set after loading it.
+         *
+         * @param budget    Maximum number of bytes of the cache (0 removes it)
+         * @param shards    Number of shards of the cache, each one with its own lock
+         */
+        void set_knn_cache(const size_type budget, const size_type shards = 16){
+            m_knn_cache_budget = budget;
+            m_knn_cache_shards = shards;
+            knn()->set_cache(budget, shards);
         }
 
-        inline void knn_range_helper(value_type x, size_type k, bool subject,
-                                   knn_range_helper_type &it){
-            m_knn_graph_cds.beg_range_helper(x, k, subject, it);
+        //Cache of the current KNN component (it is replaced with the component)
+        inline const knn_cache* get_knn_cache() const {
+            return knn()->cache();
         }
 
         void print_knngraph(){
-            m_knn_graph_cds.print_structure();
+            knn()->print();
+        }
+
+        /******UPDATES*****/
+
+        /**
+         * Triples inserted and deleted since the BWTs were built (null if there are none). The iterators
+         * ltj_iterator_delta see the triples of the BWTs plus the inserted ones minus the deleted ones, the
+         * plain ltj_iterator only sees the triples of the BWTs.
+         * A query takes the delta once, so it does not see the updates made while it runs.
+         *
+         * The delta is not part of the index file, it has to be merged before storing the index (see
+         * ring_dynamic). The similarity patterns and the KNN graphs only see the triples of the BWTs.
+         */
+        inline delta_ptr_type delta() const {
+            return std::atomic_load(&m_delta);
+        }
+
+        /**
+         * Replaces the delta while the index is in use, the running queries finish with the old one.
+         *
+         * @param delta Inserted triples, which are not in the BWTs, and deleted ones, which are
+         */
+        inline void replace_delta(delta_ptr_type delta){
+            std::atomic_store(&m_delta, std::move(delta));
         }
 
 
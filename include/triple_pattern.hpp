@@ -67,6 +67,8 @@ namespace ring_ltj {
         term_pattern term_o;
         uint64_t k_sim = 0;
         uint64_t k_best = 0;
+        double d_max = -1; //Distance threshold of a similarity pattern (negative if there is none)
+        uint64_t graph = 0; //KNN graph of a similarity pattern (see ring_similarity::knn_graph_id)
 
         void const_s(uint64_t s){
             term_s.is_variable = false;
@@ -104,12 +106,24 @@ namespace ring_ltj {
             k_sim = k;
         }
 
+        //Neighbours whose distance is below t (all the neighbours if there is no k)
+        void distance(double t){
+            term_p.is_variable = false;
+            if(k_sim == 0) k_sim = -1ULL;
+            d_max = t;
+        }
+
         void best(uint64_t k){
             term_p.is_variable = false;
             k_sim = 1;
             k_best = k;
         }
 
+        //Similarity in the KNN graph g instead of the default one
+        void in_graph(uint64_t g){
+            graph = g;
+        }
+
         bool s_is_variable() const {
             return term_s.is_variable;
         }
@@ -130,6 +144,10 @@ namespace ring_ltj {
             return k_best > 0;
         }
 
+        bool has_threshold() const {
+            return d_max >= 0;
+        }
+
 
         void print(std::unordered_map<uint8_t, std::string> &ht) const {
             if(s_is_variable()){
@@ -144,10 +162,18 @@ namespace ring_ltj {
                 }else{
                     std::cout << term_p.value << " ";
                 }
-            }else if (is_best()){
-                std::cout << "b" << k_best << " ";
             }else{
-                std::cout << "k" << k_sim << " ";
+                if (is_best()){
+                    std::cout << "b" << k_best;
+                }else if (has_threshold() && k_sim == -1ULL){
+                    std::cout << "d" << d_max;
+                }else if (has_threshold()){
+                    std::cout << "k" << k_sim << "d" << d_max;
+                }else{
+                    std::cout << "k" << k_sim;
+                }
+                if(graph > 0) std::cout << "@" << graph;
+                std::cout << " ";
             }
 
             if(o_is_variable()){
@@ -52,13 +52,14 @@ namespace ring_ltj {
                     return iter.interval_length();
                 }
 
+                //Before its last level a similarity variable can take any node of the KNN graph of the pattern
                 template<class Iterator, class Ring>
                 static uint64_t subject_sim(Ring* ptr_ring, const Iterator &iter) {
                     if (iter.in_last_level()) {
                         //return iter.distinct();
                         return iter.distinct();
                     }
-                    return ptr_ring->max_s;
+                    return iter.nodes();
                 }
 
                 template<class Iterator, class Ring>
@@ -67,11 +68,54 @@ namespace ring_ltj {
                         return iter.distinct();
                         //return 0;
                     }
-                    return ptr_ring->max_o;
+                    return iter.nodes();
                 }
 
         };
 
+        /*
+         * Weights of the basic iterators with the number of distinct values of the variable (see
+         * ring_similarity::distinct_*). With one bound term the interval length can be much larger than the
+         * number of candidates, with two bound terms both are equal. The similarity iterators are weighted as
+         * in trait_size, and so are the iterators whose triples are not an interval of the ring (see
+         * ltj_iterator_delta::in_ring_interval).
+         */
+        struct trait_distinct : public trait_size {
+
+                template<class Iterator, class Ring>
+                static uint64_t subject(Ring* ptr_ring, const Iterator &iter){
+                    if(!iter.in_ring_interval()) return iter.interval_length();
+                    if(iter.level == 0 || (iter.level == 1 && iter.state[0] == p)){
+                        return ptr_ring->distinct_PO_S(iter.interval());
+                    }else if(iter.level == 1 && iter.state[0] == o){
+                        return ptr_ring->distinct_OP_S(iter.interval());
+                    }
+                    return iter.interval_length();
+                }
+
+                template<class Iterator, class Ring>
+                static uint64_t predicate(Ring* ptr_ring, const Iterator &iter){
+                    if(!iter.in_ring_interval()) return iter.interval_length();
+                    if(iter.level == 0 || (iter.level == 1 && iter.state[0] == s)){
+                        return ptr_ring->distinct_SO_P(iter.interval());
+                    }else if(iter.level == 1 && iter.state[0] == o){
+                        return ptr_ring->distinct_OS_P(iter.interval());
+                    }
+                    return iter.interval_length();
+                }
+
+                template<class Iterator, class Ring>
+                static uint64_t object(Ring* ptr_ring, const Iterator &iter) {
+                    if(!iter.in_ring_interval()) return iter.interval_length();
+                    if(iter.level == 0 || (iter.level == 1 && iter.state[0] == s)){
+                        return ptr_ring->distinct_SP_O(iter.interval());
+                    }else if(iter.level == 1 && iter.state[0] == p){
+                        return ptr_ring->distinct_PS_O(iter.interval());
+                    }
+                    return iter.interval_length();
+                }
+        };
+
     }
 
 }
@@ -0,0 +1,440 @@
+/*
+ * wt_intersection_pair.hpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef RING_WT_INTERSECTION_PAIR_HPP
+#define RING_WT_INTERSECTION_PAIR_HPP
+
+#include <array>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <sdsl/wt_helper.hpp>
+
+namespace sdsl {
+
+    /**
+     * Stack of the traversal of the intersection of two wavelet trees (or matrices) on the same alphabet.
+     * Each entry keeps the two nodes and the two ranges inline. A depth-first traversal has at most one
+     * pending entry per level plus the current one, so the stack is allocated once with max_level+1
+     * entries and it is never resized while traversing.
+     */
+    template<class wt_t>
+    class wt_intersection_pair_stack {
+    public:
+        typedef wt_t wt_type;
+        typedef typename wt_type::size_type size_type;
+        typedef typename wt_type::value_type value_type;
+        typedef typename wt_type::node_type node_type;
+        typedef struct {
+            std::array<node_type, 2> nodes;
+            std::array<range_type, 2> ranges;
+        } frame_type;
+
+    private:
+        std::vector<frame_type> m_frames;
+        size_type m_top = 0;
+
+    public:
+
+        inline void init(const size_type max_level){
+            if(m_frames.size() < max_level + 1){
+                m_frames.resize(max_level + 1);
+            }
+            m_top = 0;
+        }
+
+        inline void clear(){
+            m_top = 0;
+        }
+
+        inline bool empty() const {
+            return m_top == 0;
+        }
+
+        inline void push(const frame_type &f){
+            m_frames[m_top++] = f;
+        }
+
+        inline void pop(){
+            --m_top;
+        }
+
+        inline const frame_type &top() const {
+            return m_frames[m_top-1];
+        }
+
+        /**
+         * Replaces the top of the stack with its children whose ranges are not empty in both trees
+         * and whose symbols are not smaller than min_sym. The left child ends up on top.
+         */
+        inline void expand_top(const std::vector<wt_type>* ptr_wts, const value_type min_sym){
+            const frame_type x = top();
+            pop();
+            frame_type left, right;
+            size_type rnk;
+            auto child0 = (*ptr_wts)[0].my_expand(x.nodes[0], x.ranges[0], left.ranges[0], right.ranges[0], rnk);
+            bool has_left = !sdsl::empty(left.ranges[0]) && child0[0].sym >= min_sym;
+            bool has_right = !sdsl::empty(right.ranges[0]) && child0[1].sym >= min_sym;
+            if(!has_left && !has_right) return;
+            auto child1 = (*ptr_wts)[1].my_expand(x.nodes[1], x.ranges[1], left.ranges[1], right.ranges[1], rnk);
+            if(has_right && !sdsl::empty(right.ranges[1]) && child1[1].sym >= min_sym){
+                right.nodes[0] = child0[1];
+                right.nodes[1] = child1[1];
+                push(right);
+            }
+            if(has_left && !sdsl::empty(left.ranges[1]) && child1[0].sym >= min_sym){
+                left.nodes[0] = child0[0];
+                left.nodes[1] = child1[0];
+                push(left);
+            }
+        }
+
+        wt_intersection_pair_stack() = default;
+
+        //! Copy constructor
+        wt_intersection_pair_stack(const wt_intersection_pair_stack &o) = default;
+
+        //! Move constructor
+        wt_intersection_pair_stack(wt_intersection_pair_stack &&o) = default;
+
+        //! Copy Operator=
+        wt_intersection_pair_stack &operator=(const wt_intersection_pair_stack &o) = default;
+
+        //! Move Operator=
+        wt_intersection_pair_stack &operator=(wt_intersection_pair_stack &&o) = default;
+
+        void swap(wt_intersection_pair_stack &o) {
+            std::swap(m_frames, o.m_frames);
+            std::swap(m_top, o.m_top);
+        }
+    };
+
+    /**
+     * Same as wt_intersection_helper for exactly two wavelet trees (the graph and the reverse graph of
+     * knn_graph_cds). Every call to next restarts from the root, but the traversal does not allocate:
+     * nodes and ranges are stored inline and the stack is reused.
+     */
+    template<class wt_t>
+    class wt_intersection_pair_helper {
+    public:
+        typedef wt_t wt_type;
+        typedef typename wt_type::size_type size_type;
+        typedef typename wt_type::value_type value_type;
+        typedef typename wt_type::node_type node_type;
+        typedef wt_intersection_pair_stack<wt_type> stack_type;
+        typedef typename stack_type::frame_type frame_type;
+
+    private:
+        const std::vector<wt_type>* m_ptr_wts = nullptr;
+        std::array<range_type, 2> m_ranges;
+        size_type m_size = 0;
+        size_type m_max_level = 0;
+        stack_type m_stack;
+
+        inline value_type c_sym(value_type c, size_type level){
+            return (c >> (m_max_level - level));
+        }
+
+        inline void push_root(){
+            frame_type root;
+            root.nodes[0] = (*m_ptr_wts)[0].root();
+            root.nodes[1] = (*m_ptr_wts)[1].root();
+            root.ranges = m_ranges;
+            m_stack.clear();
+            m_stack.push(root);
+        }
+
+        void copy(const wt_intersection_pair_helper &o) {
+            m_ptr_wts = o.m_ptr_wts;
+            m_ranges = o.m_ranges;
+            m_size = o.m_size;
+            m_max_level = o.m_max_level;
+            m_stack = o.m_stack;
+        }
+
+    public:
+
+        const std::array<range_type, 2>& ranges = m_ranges;
+
+        wt_intersection_pair_helper() = default;
+
+        wt_intersection_pair_helper(const std::vector<wt_type>* ptr_wts, const range_type &r0, const range_type &r1){
+            reset(ptr_wts, r0, r1);
+        }
+
+        //Starts a new intersection reusing the memory of the stack
+        inline void reset(const std::vector<wt_type>* ptr_wts, const range_type &r0, const range_type &r1){
+            m_ptr_wts = ptr_wts;
+            m_ranges[0] = r0;
+            m_ranges[1] = r1;
+            m_size = 2;
+            m_max_level = (*m_ptr_wts)[0].max_level;
+            m_stack.init(m_max_level);
+        }
+
+        //Empty intersection
+        inline void reset(){
+            m_size = 0;
+            m_stack.clear();
+        }
+
+        /***
+         * Smallest value of the intersection
+         */
+        value_type next(){
+            if(m_size == 0) return 0;
+            push_root();
+            while (!m_stack.empty()) {
+                const frame_type &x = m_stack.top();
+                if ((*m_ptr_wts)[0].is_leaf(x.nodes[0])) {
+                    return value_type(x.nodes[0].sym);
+                }
+                m_stack.expand_top(m_ptr_wts, 0);
+            }
+            return 0; //No intersection
+        }
+
+        /***
+         * Smallest value of the intersection greater or equal than c
+         */
+        value_type next(value_type c){
+            if(m_size == 0) return 0;
+            push_root();
+            while (!m_stack.empty()) {
+                const frame_type &x = m_stack.top();
+                if ((*m_ptr_wts)[0].is_leaf(x.nodes[0])) {
+                    return value_type(x.nodes[0].sym);
+                }
+                //+1 because we check next level nodes
+                m_stack.expand_top(m_ptr_wts, c_sym(c, x.nodes[0].level + 1));
+            }
+            return 0; //No intersection
+        }
+
+        size_type distinct() const {
+            if(m_size == 0) return 0;
+            return std::min(sdsl::size(m_ranges[0]), sdsl::size(m_ranges[1]));
+        }
+
+        bool is_empty() const {
+            return m_size == 0;
+        }
+
+        //! Copy constructor
+        wt_intersection_pair_helper(const wt_intersection_pair_helper &o) {
+            copy(o);
+        }
+
+        //! Move constructor
+        wt_intersection_pair_helper(wt_intersection_pair_helper &&o) {
+            *this = std::move(o);
+        }
+
+        //! Copy Operator=
+        wt_intersection_pair_helper &operator=(const wt_intersection_pair_helper &o) {
+            if (this != &o) {
+                copy(o);
+            }
+            return *this;
+        }
+
+        //! Move Operator=
+        wt_intersection_pair_helper &operator=(wt_intersection_pair_helper &&o) {
+            if (this != &o) {
+                m_ptr_wts = o.m_ptr_wts;
+                m_ranges = o.m_ranges;
+                m_size = o.m_size;
+                m_max_level = o.m_max_level;
+                m_stack = std::move(o.m_stack);
+            }
+            return *this;
+        }
+
+        void swap(wt_intersection_pair_helper &o) {
+            std::swap(m_ptr_wts, o.m_ptr_wts);
+            std::swap(m_ranges, o.m_ranges);
+            std::swap(m_size, o.m_size);
+            std::swap(m_max_level, o.m_max_level);
+            m_stack.swap(o.m_stack);
+        }
+    };
+
+    /**
+     * Same as wt_intersection_iterator for exactly two wavelet trees. The state of the traversal is kept
+     * between calls in a stack of max_level+1 inline entries that is reused when the iterator is reset.
+     */
+    template<class wt_t>
+    class wt_intersection_pair_iterator {
+    public:
+        typedef wt_t wt_type;
+        typedef typename wt_type::size_type size_type;
+        typedef typename wt_type::value_type value_type;
+        typedef typename wt_type::node_type node_type;
+        typedef wt_intersection_pair_stack<wt_type> stack_type;
+        typedef typename stack_type::frame_type frame_type;
+
+    private:
+        const std::vector<wt_type>* m_ptr_wts = nullptr;
+        std::array<range_type, 2> m_ranges;
+        size_type m_size = 0;
+        size_type m_max_level = 0;
+        stack_type m_stack;
+
+        inline value_type c_sym(value_type c, size_type level){
+            return (c >> (m_max_level - level));
+        }
+
+        void copy(const wt_intersection_pair_iterator &o) {
+            m_ptr_wts = o.m_ptr_wts;
+            m_ranges = o.m_ranges;
+            m_size = o.m_size;
+            m_max_level = o.m_max_level;
+            m_stack = o.m_stack;
+        }
+
+    public:
+
+        const std::array<range_type, 2>& ranges = m_ranges;
+
+        wt_intersection_pair_iterator() = default;
+
+        wt_intersection_pair_iterator(const std::vector<wt_type>* ptr_wts, const range_type &r0, const range_type &r1){
+            reset(ptr_wts, r0, r1);
+        }
+
+        //Starts a new intersection reusing the memory of the stack
+        inline void reset(const std::vector<wt_type>* ptr_wts, const range_type &r0, const range_type &r1){
+            m_ptr_wts = ptr_wts;
+            m_ranges[0] = r0;
+            m_ranges[1] = r1;
+            m_size = 2;
+            m_max_level = (*m_ptr_wts)[0].max_level;
+            m_stack.init(m_max_level);
+            frame_type root;
+            root.nodes[0] = (*m_ptr_wts)[0].root();
+            root.nodes[1] = (*m_ptr_wts)[1].root();
+            root.ranges = m_ranges;
+            m_stack.push(root);
+        }
+
+        //Empty intersection
+        inline void reset(){
+            m_size = 0;
+            m_stack.clear();
+        }
+
+        /***
+         * Next value of the intersection
+         */
+        value_type next(){
+            while (!m_stack.empty()) {
+                const frame_type &x = m_stack.top();
+                if ((*m_ptr_wts)[0].is_leaf(x.nodes[0])) {
+                    auto r = value_type(x.nodes[0].sym);
+                    m_stack.pop();
+                    return r;
+                }
+                m_stack.expand_top(m_ptr_wts, 0);
+            }
+            return 0; //No intersection
+        }
+
+        /***
+         * Next value of the intersection greater or equal than c
+         * @pre In each iteration c has to be greater or equal than the previous c.
+         */
+        value_type next(value_type c){
+            while (!m_stack.empty()) {
+                const frame_type &x = m_stack.top();
+                if ((*m_ptr_wts)[0].is_leaf(x.nodes[0])) {
+                    auto r = value_type(x.nodes[0].sym);
+                    m_stack.pop();
+                    if(r < c) continue;
+                    return r;
+                }
+                //+1 because we check next level nodes
+                m_stack.expand_top(m_ptr_wts, c_sym(c, x.nodes[0].level + 1));
+            }
+            return 0; //No intersection
+        }
+
+        /***
+         * Remaining elements of the intersection
+         */
+        std::vector<value_type> all(){
+            std::vector<value_type> res;
+            value_type v;
+            while((v = next()) != 0){
+                res.emplace_back(v);
+            }
+            return res;
+        }
+
+        size_type distinct() const {
+            if(m_size == 0) return 0;
+            return std::min(sdsl::size(m_ranges[0]), sdsl::size(m_ranges[1]));
+        }
+
+        bool is_empty() const {
+            return m_size == 0;
+        }
+
+        //! Copy constructor
+        wt_intersection_pair_iterator(const wt_intersection_pair_iterator &o) {
+            copy(o);
+        }
+
+        //! Move constructor
+        wt_intersection_pair_iterator(wt_intersection_pair_iterator &&o) {
+            *this = std::move(o);
+        }
+
+        //! Copy Operator=
+        wt_intersection_pair_iterator &operator=(const wt_intersection_pair_iterator &o) {
+            if (this != &o) {
+                copy(o);
+            }
+            return *this;
+        }
+
+        //! Move Operator=
+        wt_intersection_pair_iterator &operator=(wt_intersection_pair_iterator &&o) {
+            if (this != &o) {
+                m_ptr_wts = o.m_ptr_wts;
+                m_ranges = o.m_ranges;
+                m_size = o.m_size;
+                m_max_level = o.m_max_level;
+                m_stack = std::move(o.m_stack);
+            }
+            return *this;
+        }
+
+        void swap(wt_intersection_pair_iterator &o) {
+            std::swap(m_ptr_wts, o.m_ptr_wts);
+            std::swap(m_ranges, o.m_ranges);
+            std::swap(m_size, o.m_size);
+            std::swap(m_max_level, o.m_max_level);
+            m_stack.swap(o.m_stack);
+        }
+    };
+
+}
+
+#endif //RING_WT_INTERSECTION_PAIR_HPP
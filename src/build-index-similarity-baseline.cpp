@@ -63,7 +63,7 @@ uint64_t read_graph(std::ifstream &ifs, knn_graph_type &knn_graph){
         vector<uint64_t> terms = tokenizer(line, ' ');
         std::vector<knn_item_type> list;
         for(uint64_t i = 0; i < terms.size(); ++i){
-            knn_item_type item{terms[i], i+1};
+            knn_item_type item{terms[i], i+1, 0};
             list.emplace_back(item);
             if(max_k < item.k) max_k = item.k;
         }
@@ -20,7 +20,9 @@
 
 #include <iostream>
 #include "ring_similarity.hpp"
+#include "dataset_io.hpp"
 #include <fstream>
+#include <sstream>
 #include <sdsl/construct.hpp>
 #include <vector>
 
@@ -29,82 +31,82 @@ using namespace std;
 using namespace std::chrono;
 using timer = std::chrono::high_resolution_clock;
 
-std::string ltrim(const std::string &s)
-{
-    size_t start = s.find_first_not_of(' ');
-    return (start == std::string::npos) ? "" : s.substr(start);
-}
-
-std::string rtrim(const std::string &s)
-{
-    size_t end = s.find_last_not_of(' ');
-    return (end == std::string::npos) ? "" : s.substr(0, end + 1);
-}
-
-std::string trim(const std::string &s) {
-    return rtrim(ltrim(s));
-}
-
-std::vector<uint64_t> tokenizer(const std::string &input, const char &delimiter){
-    std::stringstream stream(input);
-    std::string token;
-    std::vector<uint64_t> res;
-    while(getline(stream, token, delimiter)){
-        std::string str = trim(token);
-        uint64_t val = stoull(str);
-        res.emplace_back(val);
-    }
-    return res;
-}
-
-uint64_t read_graph(std::ifstream &ifs, knn_graph_type &knn_graph){
-    std::string line;
-    uint64_t max_k = 0;
-    while(std::getline(ifs, line)){
-        vector<uint64_t> terms = tokenizer(line, ' ');
-        std::vector<knn_item_type> list;
-        for(uint64_t i = 0; i < terms.size(); ++i){
-            knn_item_type item{terms[i], i+1};
-            list.emplace_back(item);
-            if(max_k < item.k) max_k = item.k;
-        }
-        knn_graph.push_back(list);
-    }
-    return max_k;
-}
+struct build_options {
+    uint64_t threads = 1; //Threads used to parse the input and build the index
+    uint64_t ram_budget = 0; //MB used to sort the triples on disk (0 means in memory)
+    bool distinct = false; //Builds the distinct counts used by the GAO
+    std::vector<uint64_t> mutual; //Values of k whose mutual neighbours are precomputed
+    std::vector<std::pair<std::string, std::string>> graphs; //Name and dataset of the additional KNN graphs
+    bool knn_file = false; //The KNN graphs are stored in <index>.knn instead of the index (see build-knn-index)
+};
 
 template<class ring>
-void build_index(const std::string &dataset, const std::string &output){
-    vector<spo_triple> D, E;
-
-    std::string data = dataset + ".dat";
-    std::string dir = dataset + "-knn-dir.dat";
-    std::ifstream ifs_data(data);
-    uint64_t s, p , o;
-    do {
-        ifs_data >> s >> p >> o;
-        D.push_back(spo_triple(s, p, o));
-    } while (!ifs_data.eof());
-    D.shrink_to_fit();
+void build_index(const std::string &dataset, const std::string &output, const build_options &opts){
+    std::string data = ring_ltj::dataset_io::triples_file(dataset);
 
+    //Binary files (see convert-dataset) are used when they exist
     knn_graph_type g;
-    std::ifstream ifs_dir(dir);
-    auto max_k = read_graph(ifs_dir, g);
+    auto max_k = ring_ltj::dataset_io::read_knn(dataset, g, opts.threads);
     //auto max_k_g_inv = read_graph(ifs_inv, g_inv);
 
     //uint64_t max_k = std::max(max_k_g, max_k_g_inv);
-    cout << "--Indexing " << D.size() << " triples" << endl;
-    memory_monitor::start();
-    auto start = timer::now();
+    ring A;
+    timer::time_point start;
+    if(opts.ram_budget > 0){
+        //The triples are sorted on disk, they are never loaded at once
+        if(!ring_ltj::dataset_io::file_exists(data)){
+            cout << "Cannot read the triples of " << data << endl;
+            exit(1);
+        }
+        cout << "--Indexing " << data << " with a RAM budget of " << opts.ram_budget << " MB and "
+             << opts.threads << " threads" << endl;
+        if(opts.distinct){
+            cout << "  --distinct is not supported with --ram-budget, the distinct counts are not built" << endl;
+        }
+        memory_monitor::start();
+        start = timer::now();
+        A = ring(data, g, max_k, opts.ram_budget * 1024 * 1024, output, opts.threads);
+    }else{
+        vector<spo_triple> D;
+        if(!ring_ltj::dataset_io::read_triples(dataset, D, opts.threads) || D.empty()){
+            cout << "Cannot read the triples of " << data << endl;
+            exit(1);
+        }
 
-    ring A(D, g, max_k);
+        cout << "--Indexing " << D.size() << " triples with " << opts.threads << " threads" << endl;
+        memory_monitor::start();
+        start = timer::now();
+        A = ring(D, g, max_k, opts.threads, opts.distinct);
+    }
+    for(const auto &named : opts.graphs){
+        knn_graph_type g2;
+        auto max_k2 = ring_ltj::dataset_io::read_knn(named.second, g2, opts.threads);
+        if(max_k2 == 0){
+            cout << "  Cannot read the KNN graph of " << named.second << ", " << named.first << " is not built" << endl;
+            continue;
+        }
+        A.add_knn_graph(named.first, g2, max_k2);
+    }
+    if(!opts.mutual.empty()){
+        cout << "  Building mutual neighbours..." << flush;
+        A.build_knn_mutual(opts.mutual);
+        cout << " Done." << endl;
+    }
     auto stop = timer::now();
     memory_monitor::stop();
     cout << "  Index built  " << sdsl::size_in_bytes(A) << " bytes" << endl;
 
+    if(opts.knn_file){
+        auto knn = A.detach_knn();
+        if(!knn->store_to_file(output + ".knn")){
+            cout << "Cannot write " << output << ".knn" << endl;
+            return;
+        }
+        cout << "KNN saved in " << output << ".knn" << endl;
+    }
     sdsl::store_to_file(A, output);
     cout << "Index saved" << endl;
-    cout << duration_cast<seconds>(stop-start).count() << " seconds." << endl;
+    cout << duration_cast<seconds>(stop-start).count() << " seconds (" << opts.threads << " threads)." << endl;
     cout << memory_monitor::peak() << " bytes." << endl;
 
 }
@@ -112,22 +114,53 @@ void build_index(const std::string &dataset, const std::string &output){
 int main(int argc, char **argv)
 {
 
-    if(argc != 3){
-        std::cout << "Usage: " << argv[0] << " <dataset> [ring|c-ring|ring-sel]" << std::endl;
+    if(argc < 3){
+        std::cout << "Usage: " << argv[0] << " <dataset> [ring|c-ring|ring-sel] [--threads N] [--ram-budget MB] [--distinct] [--mutual k1,k2,...] [--graph name=dataset]... [--knn-file]" << std::endl;
         return 0;
     }
 
     std::string dataset = argv[1];
     std::string type    = argv[2];
+    build_options opts;
+    for(int i = 3; i < argc; ++i){
+        std::string opt = argv[i];
+        if(opt == "--threads" && i+1 < argc){
+            opts.threads = std::stoull(argv[++i]);
+        }else if(opt == "--ram-budget" && i+1 < argc){
+            opts.ram_budget = std::stoull(argv[++i]);
+        }else if(opt == "--distinct"){
+            opts.distinct = true;
+        }else if(opt == "--mutual" && i+1 < argc){
+            std::stringstream ks(argv[++i]);
+            std::string k;
+            while(getline(ks, k, ',')){
+                opts.mutual.push_back(std::stoull(k));
+            }
+        }else if(opt == "--knn-file"){
+            opts.knn_file = true;
+        }else if(opt == "--graph" && i+1 < argc){
+            std::string named = argv[++i];
+            auto pos = named.find('=');
+            if(pos == std::string::npos || pos == 0){
+                std::cout << "Invalid graph: " << named << " (expected name=dataset)" << std::endl;
+                return 0;
+            }
+            opts.graphs.emplace_back(named.substr(0, pos), named.substr(pos+1));
+        }else{
+            std::cout << "Unknown option: " << opt << std::endl;
+            std::cout << "Usage: " << argv[0] << " <dataset> [ring|c-ring|ring-sel] [--threads N] [--ram-budget MB] [--distinct] [--mutual k1,k2,...] [--graph name=dataset]... [--knn-file]" << std::endl;
+            return 0;
+        }
+    }
     if(type == "ring"){
         std::string index_name = dataset + ".ring";
-        build_index<ring_ltj::ring_similarity<>>(dataset, index_name);
+        build_index<ring_ltj::ring_similarity<>>(dataset, index_name, opts);
     }else if (type == "c-ring"){
         std::string index_name = dataset + ".c-ring";
-        build_index<ring_ltj::c_ring_similarity>(dataset, index_name);
+        build_index<ring_ltj::c_ring_similarity>(dataset, index_name, opts);
     }else if (type == "ring-sel") {
         std::string index_name = dataset + ".ring-sel";
-        build_index<ring_ltj::ring_sel_similarity>(dataset, index_name);
+        build_index<ring_ltj::ring_sel_similarity>(dataset, index_name, opts);
     }else{
         std::cout << "Usage: " << argv[0] << " <dataset> [ring|c-ring|ring-sel|ring-m|c-ring-m|ring-sel-m]" << std::endl;
     }
@@ -0,0 +1,150 @@
+/*
+ * build-knn-index.cpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <iostream>
+#include "ring_similarity.hpp"
+#include "dataset_io.hpp"
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+using namespace std::chrono;
+using timer = std::chrono::high_resolution_clock;
+
+//Builds the KNN component of an existing index in its own file, the BWTs are not rebuilt
+
+struct build_options {
+    uint64_t threads = 1; //Threads used to parse the input
+    std::vector<uint64_t> mutual; //Values of k whose mutual neighbours are precomputed
+    std::vector<std::pair<std::string, std::string>> graphs; //Name and dataset of the additional KNN graphs
+};
+
+template<class ring>
+int build_knn(const std::string &dataset, const std::string &index, const build_options &opts){
+    typedef typename ring::knn_index_type knn_index_type;
+
+    //Only the stamp of the index is used
+    knn_index_type knn;
+    {
+        ring A;
+        cout << "--Loading " << index << endl;
+        if(!sdsl::load_from_file(A, index)){
+            cout << "Cannot read the index " << index << endl;
+            return 1;
+        }
+        knn.set_stamp(A.knn_stamp());
+    }
+
+    knn_graph_type g;
+    auto max_k = ring_ltj::dataset_io::read_knn(dataset, g, opts.threads);
+    if(max_k == 0){
+        cout << "Cannot read the KNN graph of " << dataset << endl;
+        return 1;
+    }
+    memory_monitor::start();
+    auto start = timer::now();
+    cout << "Building KNN with nodes=" << g.size() << " and max_k=" << max_k << std::endl;
+    {
+        auto stamp = knn.stamp();
+        knn = knn_index_type(g, max_k);
+        knn.set_stamp(stamp);
+    }
+    knn_graph_type().swap(g);
+    for(const auto &named : opts.graphs){
+        knn_graph_type g2;
+        auto max_k2 = ring_ltj::dataset_io::read_knn(named.second, g2, opts.threads);
+        if(max_k2 == 0){
+            cout << "  Cannot read the KNN graph of " << named.second << ", " << named.first << " is not built" << endl;
+            continue;
+        }
+        knn.add_graph(named.first, g2, max_k2);
+    }
+    if(!opts.mutual.empty()){
+        cout << "  Building mutual neighbours..." << flush;
+        knn.build_mutual(opts.mutual);
+        cout << " Done." << endl;
+    }
+    auto stop = timer::now();
+    memory_monitor::stop();
+    cout << "  KNN built  " << sdsl::size_in_bytes(knn) << " bytes" << endl;
+
+    std::string output = index + ".knn";
+    if(!knn.store_to_file(output)){
+        cout << "Cannot write " << output << endl;
+        return 1;
+    }
+    cout << "KNN saved in " << output << endl;
+    cout << duration_cast<seconds>(stop-start).count() << " seconds." << endl;
+    cout << memory_monitor::peak() << " bytes." << endl;
+    return 0;
+}
+
+std::string get_type(const std::string &file){
+    auto p = file.find_last_of('.');
+    return file.substr(p+1);
+}
+
+int main(int argc, char **argv)
+{
+
+    if(argc < 3){
+        std::cout << "Usage: " << argv[0] << " <dataset> <index> [--threads N] [--mutual k1,k2,...] [--graph name=dataset]..." << std::endl;
+        return 0;
+    }
+
+    std::string dataset = argv[1];
+    std::string index   = argv[2];
+    build_options opts;
+    for(int i = 3; i < argc; ++i){
+        std::string opt = argv[i];
+        if(opt == "--threads" && i+1 < argc){
+            opts.threads = std::stoull(argv[++i]);
+        }else if(opt == "--mutual" && i+1 < argc){
+            std::stringstream ks(argv[++i]);
+            std::string k;
+            while(getline(ks, k, ',')){
+                opts.mutual.push_back(std::stoull(k));
+            }
+        }else if(opt == "--graph" && i+1 < argc){
+            std::string named = argv[++i];
+            auto pos = named.find('=');
+            if(pos == std::string::npos || pos == 0){
+                std::cout << "Invalid graph: " << named << " (expected name=dataset)" << std::endl;
+                return 0;
+            }
+            opts.graphs.emplace_back(named.substr(0, pos), named.substr(pos+1));
+        }else{
+            std::cout << "Unknown option: " << opt << std::endl;
+            std::cout << "Usage: " << argv[0] << " <dataset> <index> [--threads N] [--mutual k1,k2,...] [--graph name=dataset]..." << std::endl;
+            return 0;
+        }
+    }
+    std::string type = get_type(index);
+    if(type == "ring" || type == "ring-knn"){
+        return build_knn<ring_ltj::ring_similarity<>>(dataset, index, opts);
+    }else if (type == "c-ring" || type == "c-ring-knn"){
+        return build_knn<ring_ltj::c_ring_similarity>(dataset, index, opts);
+    }else if (type == "ring-sel" || type == "ring-sel-knn") {
+        return build_knn<ring_ltj::ring_sel_similarity>(dataset, index, opts);
+    }
+    std::cout << "Type of index: " << type << " is not supported (ring|c-ring|ring-sel)." << std::endl;
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*
+ * convert-dataset.cpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <chrono>
+#include "dataset_io.hpp"
+
+using namespace std;
+using namespace std::chrono;
+using timer = std::chrono::high_resolution_clock;
+
+int main(int argc, char **argv)
+{
+
+    if(argc != 2 && argc != 3){
+        std::cout << "Usage: " << argv[0] << " <dataset> [threads]" << std::endl;
+        std::cout << "Converts <dataset>.dat and <dataset>-knn-dir.dat into "
+                     "<dataset>-triples.bin and <dataset>-knn-dir.bin" << std::endl;
+        return 0;
+    }
+
+    std::string dataset = argv[1];
+    uint64_t threads = (argc == 3) ? std::stoull(argv[2]) : 1;
+
+    auto start = timer::now();
+    vector<spo_triple> D;
+    if(!ring_ltj::dataset_io::read_triples_text(dataset + ".dat", D, threads)){
+        std::cout << "Cannot read " << dataset << ".dat" << std::endl;
+        return 1;
+    }
+    ring_ltj::dataset_io::write_triples_binary(dataset + "-triples.bin", D);
+    cout << "Triples: " << D.size() << endl;
+    vector<spo_triple>().swap(D);
+
+    knn_graph_type g;
+    auto max_k = ring_ltj::dataset_io::read_knn_text(dataset + "-knn-dir.dat", g, threads);
+    if(max_k == 0){
+        std::cout << "Cannot read " << dataset << "-knn-dir.dat" << std::endl;
+        return 1;
+    }
+    ring_ltj::dataset_io::write_knn_binary(dataset + "-knn-dir.bin", g, max_k);
+    cout << "KNN graph: " << g.size() << " nodes and max_k=" << max_k << endl;
+    auto stop = timer::now();
+    cout << duration_cast<milliseconds>(stop-start).count() << " milliseconds." << endl;
+
+    return 0;
+}
@@ -20,13 +20,35 @@
 #include <iostream>
 #include <utility>
 #include <chrono>
+#include <csignal>
 #include <triple_pattern.hpp>
 #include <ltj_algorithm_similarity.hpp>
+#include <ltj_best_k.hpp>
+#include <prepared_query.hpp>
+#include <result_cache.hpp>
+#include <query_governor.hpp>
 #include <utils.hpp>
+#include <parallel.hpp>
 
 using namespace std;
 using namespace std::chrono;
 
+//The first SIGINT cancels the running queries and the remaining ones, the second one terminates
+ring_ltj::cancel_token cancel_queries = ring_ltj::cancel_token::create();
+std::atomic<bool>* cancel_flag = nullptr;
+
+void on_interrupt(int){
+    if(cancel_flag != nullptr) cancel_flag->store(true);
+    std::signal(SIGINT, SIG_DFL);
+}
+
+//SIGHUP reloads the KNN component of --knn before the next query
+std::atomic<bool> reload_knn_flag(false);
+
+void on_hangup(int){
+    reload_knn_flag.store(true);
+}
+
 bool get_file_content(string filename, vector<string> & vector_of_strings)
 {
     // Open the File
@@ -90,6 +112,10 @@ bool is_best(string &s){
     return (s.at(0) == 'b');
 }
 
+bool is_distance(string &s){
+    return (s.at(0) == 'd');
+}
+
 uint8_t get_variable(string &s, std::unordered_map<std::string, uint8_t> &hash_table_vars){
     auto var = s.substr(1);
     auto it = hash_table_vars.find(var);
@@ -110,14 +136,42 @@ uint64_t get_k_sim(string &s){
     return std::stoull(s.substr(1));
 }
 
+//Threshold of k<k>d<t> or d<t> (negative if there is none)
+double get_distance(string &s){
+    auto pos = s.find('d');
+    if(pos == string::npos) return -1;
+    return std::stod(s.substr(pos+1));
+}
+
 uint64_t get_k_best(string &s){
     return std::stoull(s.substr(1));
 }
 
-ring_ltj::triple_pattern get_triple(string & s, std::unordered_map<std::string, uint8_t> &hash_table_vars) {
+//Removes the suffix @name of a predicate and returns the KNN graph it names (-1 if there is no such graph)
+uint64_t get_graph(string &s, const vector<string> &graph_names){
+    auto pos = s.find('@');
+    if(pos == string::npos) return 0;
+    auto name = s.substr(pos+1);
+    s = s.substr(0, pos);
+    for(uint64_t i = 0; i < graph_names.size(); ++i){
+        if(graph_names[i] == name) return i + 1;
+    }
+    return -1ULL;
+}
+
+ring_ltj::triple_pattern get_triple(string & s, std::unordered_map<std::string, uint8_t> &hash_table_vars,
+                                    const vector<string> &graph_names, bool &correct) {
     vector<string> terms = tokenizer(s, ' ');
 
     ring_ltj::triple_pattern triple;
+    uint64_t g = 0;
+    if(!is_variable(terms[1])){
+        g = get_graph(terms[1], graph_names);
+        if(g == -1ULL){
+            correct = false;
+            g = 0;
+        }
+    }
     if(is_variable(terms[0])){
         triple.var_s(get_variable(terms[0], hash_table_vars));
     }else{
@@ -127,6 +181,10 @@ ring_ltj::triple_pattern get_triple(string & s, std::unordered_map<std::string,
         triple.var_p(get_variable(terms[1], hash_table_vars));
     }else if(is_similarity(terms[1])) {
         triple.similarity(get_k_sim(terms[1]));
+        auto t = get_distance(terms[1]);
+        if(t >= 0) triple.distance(t);
+    }else if(is_distance(terms[1])) {
+        triple.distance(get_distance(terms[1]));
     }else if(is_best(terms[1])){
         triple.best(get_k_best(terms[1]));
     }else{
@@ -137,6 +195,11 @@ ring_ltj::triple_pattern get_triple(string & s, std::unordered_map<std::string,
     }else{
         triple.const_o(get_constant(terms[2]));
     }
+    if(triple.is_similarity() || triple.is_best()){
+        triple.in_graph(g);
+    }else if(g > 0){
+        correct = false;
+    }
     return triple;
 }
 
@@ -146,8 +209,180 @@ std::string get_type(const std::string &file){
 }
 
 
+struct parsed_query {
+    std::vector<ring_ltj::triple_pattern> patterns;
+    uint64_t n_vars = 0;
+    bool correct = true;
+};
+
+parsed_query parse_query(const std::string &query_string, const vector<string> &graph_names){
+    parsed_query pq;
+    std::unordered_map<std::string, uint8_t> hash_table_vars;
+    vector<string> tokens_query = tokenizer(query_string, '.');
+    bool best = false, skip = false, correct = true;
+    uint64_t k_best = 0;
+    for (uint64_t i = 0; !skip && i < tokens_query.size(); ++i) {
+        string& token = tokens_query[i];
+        auto triple_pattern = get_triple(token, hash_table_vars, graph_names, correct);
+        if(triple_pattern.is_best()){
+            if(best){
+                skip = (k_best != triple_pattern.k_best);
+            }else{
+                best = true;
+                k_best = triple_pattern.k_best;
+            }
+        }
+        pq.patterns.push_back(triple_pattern);
+    }
+    pq.correct = !skip && correct;
+    pq.n_vars = hash_table_vars.size();
+    return pq;
+}
+
+struct query_options {
+    uint64_t threads = 1;       //Queries solved at the same time
+    uint64_t join_threads = 1;  //Threads used by each query
+    bool count = false;         //Count the results without enumerating lonely variables
+    bool distinct = false;      //The GAO weights the variables with distinct counts (index built with --distinct)
+    bool prepared = false;      //Queries with the same template reuse its analysis and only bind their constants
+    uint64_t cache_mb = 0;      //MB of the cache of results (0 means no cache)
+    uint64_t page = 0;          //Results are retrieved with a cursor in pages of this size (0 means join)
+    uint64_t max_results_mb = 0; //MB of the results of a query before it is stopped (0 means no limit)
+    uint64_t knn_cache_mb = 0;  //MB of the cache of decoded lists of the KNN graph (0 means no cache)
+    std::string knn_file;       //KNN component stored in its own file (see build-knn-index)
+};
+
+/**
+ * Replaces the KNN component of the index with the one of opts.knn_file if a reload was requested
+ * (SIGHUP). The queries already running keep the old one. The cached results are dropped, and the
+ * queries that started before cannot store theirs (see result_cache::generation).
+ */
+template<class ring_type>
+void reload_knn(ring_type &graph, const query_options &opts, ring_ltj::result_cache* cache){
+    if(opts.knn_file.empty() || !reload_knn_flag.exchange(false)) return;
+    auto knn = std::make_shared<typename ring_type::knn_index_type>();
+    if(!knn->load_from_file(opts.knn_file)){
+        cerr << "KNN not reloaded: cannot read " << opts.knn_file << endl;
+    }else if(knn->names() != graph.knn_graph_names()){
+        //The queries were parsed with the identifiers of the current graphs
+        cerr << "KNN not reloaded: the named graphs of " << opts.knn_file << " are different" << endl;
+    }else if(!graph.replace_knn(knn)){
+        cerr << "KNN not reloaded: " << opts.knn_file << " was built for another index" << endl;
+    }else{
+        if(cache != nullptr) cache->clear();
+        cerr << "KNN reloaded from " << opts.knn_file << endl;
+    }
+}
+
+//Prepared queries by template (see prepared_query.hpp)
+template<class ltj_algorithm>
+using prepared_map_type = std::unordered_map<std::string, std::unique_ptr<ring_ltj::prepared_query<ltj_algorithm>>>;
+
+template<class ltj_algorithm, class ring_type>
+std::pair<uint64_t, uint64_t> run_query(parsed_query &pq, ring_type &graph, const query_options &opts,
+                                        prepared_map_type<ltj_algorithm>* prepared = nullptr,
+                                        ring_ltj::result_cache* cache = nullptr){
+    typedef ring_ltj::prepared_query<ltj_algorithm> prepared_type;
+    typedef typename ltj_algorithm::tuple_type tuple_type;
+    const uint64_t timeout = 600;
+
+    //The template and the constants of the query are known before running it
+    std::string shape;
+    typename prepared_type::params_type params;
+    if(prepared != nullptr){
+        shape = prepared_type::shape(pq.patterns);
+        params = prepared_type::parameters(pq.patterns);
+    }
+
+    auto start = high_resolution_clock::now();
+    uint64_t n_res;
+
+    //Timeout, cancellation and memory of the results are checked by the governor every few steps
+    ring_ltj::query_governor gov(timeout);
+    gov.set_cancel_token(cancel_queries);
+    if(opts.max_results_mb > 0){
+        gov.set_memory_limit(opts.max_results_mb * 1024 * 1024, pq.n_vars * sizeof(uint64_t));
+    }
+
+    //Only the number of results is reported, they are counted instead of stored (unless they are cached)
+    bool keep = (cache != nullptr && !opts.count);
+    std::vector<tuple_type> tuples;
+    auto res = ring_ltj::result_sink::make_callback_sink([&](const tuple_type &t){
+        if(keep) tuples.push_back(t);
+    });
+    ring_ltj::result_cache::canonical_type canonical;
+    uint64_t generation = 0;
+    if(cache != nullptr){
+        //Read before the query takes the KNN component, a reload in the meantime discards its results
+        generation = cache->generation();
+        canonical = ring_ltj::result_cache::canonicalize(pq.patterns);
+        bool hit = opts.count ? cache->get_count(canonical, n_res) : cache->get(canonical, res);
+        if(hit){
+            if(!opts.count) n_res = res.size();
+            auto stop = high_resolution_clock::now();
+            return {n_res, (uint64_t) duration_cast<nanoseconds>(stop - start).count()};
+        }
+    }
+
+    ring_ltj::ltj_best_k<ltj_algorithm> best(&pq.patterns, &graph, pq.n_vars);
+    if(best.has_best()){
+        //Only the k_best results with the smallest KNN ranks
+        best.join(res, gov);
+        n_res = res.size();
+    }else{
+        std::unique_ptr<ltj_algorithm> own;
+        ltj_algorithm* ltj;
+        if(prepared != nullptr){
+            auto it = prepared->find(shape);
+            if(it == prepared->end()){
+                it = prepared->insert({shape, std::unique_ptr<prepared_type>(
+                        new prepared_type(pq.patterns, &graph, pq.n_vars))}).first;
+            }
+            it->second->bind(params);
+            ltj = &it->second->algorithm();
+        }else{
+            own.reset(new ltj_algorithm(&pq.patterns, &graph, pq.n_vars));
+            ltj = own.get();
+        }
+        if(opts.count){
+            n_res = ltj->count(gov);
+        }else if(opts.join_threads > 1){
+            ltj->join_parallel(res, opts.join_threads, gov);
+            n_res = res.size();
+        }else if(opts.page > 0){
+            //The cursor is suspended after each page and resumed for the next one
+            ltj->cursor_reset();
+            while(!ltj->cursor_done() && gov.status() == ring_ltj::query_governor::running){
+                ltj->next_batch(res, opts.page, gov);
+            }
+            n_res = res.size();
+        }else{
+            ltj->join(res, gov);
+            n_res = res.size();
+        }
+    }
+    if(!gov.is_complete()){
+        //Standard error, so the output of the queries keeps its format
+        cerr << "Query stopped (" << ring_ltj::query_governor::status_name(gov.status()) << ") after "
+             << gov.steps() << " steps, " << n_res << " results, " << gov.elapsed_ms() << " ms" << endl;
+    }
+
+    //Results interrupted by the governor are not cached
+    if(cache != nullptr && gov.is_complete()){
+        if(opts.count){
+            cache->put_count(canonical, n_res, generation);
+        }else{
+            cache->put(canonical, tuples, 0, generation);
+        }
+    }
+    auto stop = high_resolution_clock::now();
+
+    auto total_time = duration_cast<nanoseconds>(stop - start).count();
+    return {n_res, total_time};
+}
+
 template<class ring_type, class ltj_algorithm>
-void query(const std::string &file, const std::string &queries){
+void query(const std::string &file, const std::string &queries, const query_options &opts){
     vector<string> dummy_queries;
     bool result = get_file_content(queries, dummy_queries);
 
@@ -157,117 +392,149 @@ void query(const std::string &file, const std::string &queries){
     sdsl::load_from_file(graph, file);
 
     cout << endl << " Index loaded " << sdsl::size_in_bytes(graph) << " bytes" << endl;
-
-    std::ifstream ifs;
-    uint64_t nQ = 0;
-
-    high_resolution_clock::time_point start, stop;
+    if(!opts.knn_file.empty()){
+        if(!graph.load_knn(opts.knn_file)){
+            cerr << "Cannot use the KNN of " << opts.knn_file << " (unreadable or built for another index)" << endl;
+            return;
+        }
+        cout << " KNN loaded from " << opts.knn_file << endl;
+    }
+    graph.set_knn_cache(opts.knn_cache_mb * 1024 * 1024);
+    if(graph.knn()->is_empty()){
+        //Standard error, so the output of the queries keeps its format
+        cerr << "Warning: the index has no KNN graph (built with --knn-file?), the similarity patterns have no "
+             << "results. Use --knn " << file << ".knn" << endl;
+    }
 
     if(result)
     {
-
-        int count = 1;
+        std::vector<parsed_query> parsed;
+        parsed.reserve(dummy_queries.size());
         for (string& query_string : dummy_queries) {
+            parsed.emplace_back(parse_query(query_string, graph.knn_graph_names()));
+        }
 
-            //vector<Term*> terms_created;
-            //vector<Triple*> query;
-            std::unordered_map<std::string, uint8_t> hash_table_vars;
-            std::vector<ring_ltj::triple_pattern> query;
-            vector<string> tokens_query = tokenizer(query_string, '.');
-            bool best = false, skip = false;
-            uint64_t k_best = 0;
-            for (uint64_t i = 0; !skip && i < tokens_query.size(); ++i) {
-                string& token = tokens_query[i];
-                auto triple_pattern = get_triple(token, hash_table_vars);
-                if(triple_pattern.is_best()){
-                    if(best){
-                        skip = (k_best != triple_pattern.k_best);
-                    }else{
-                        best = true;
-                        k_best = triple_pattern.k_best;
-                    }
+        //One map of prepared queries per thread
+        std::vector<prepared_map_type<ltj_algorithm>> prepared(std::max<uint64_t>(1, opts.threads));
+        //The cache of results is shared by all the threads
+        std::unique_ptr<ring_ltj::result_cache> cache;
+        if(opts.cache_mb > 0) cache.reset(new ring_ltj::result_cache(opts.cache_mb * 1024 * 1024));
+        if(opts.threads <= 1){
+            uint64_t nQ = 0;
+            for(auto &pq : parsed){
+                if(!pq.correct) {
+                    std::cout << "Incorrect query" << std::endl;
+                    continue;
                 }
-                query.push_back(triple_pattern);
-            }
-            if(skip) {
-                std::cout << "Incorrect query" << std::endl;
-                continue;
+                reload_knn(graph, opts, cache.get());
+                auto r = run_query<ltj_algorithm>(pq, graph, opts, opts.prepared ? &prepared[0] : nullptr,
+                                                 cache.get());
+                cout << nQ <<  ";" << r.first << ";" << r.second << endl;
+                nQ++;
             }
-
-
-            // vector<string> gao = get_gao(query);
-            // vector<string> gao = get_gao_min_opt(query, graph);
-            // cout << gao [0] << " - " << gao [1] << " - " << gao[2] << endl;
-
-            /*for(const auto & pair : hash_table_vars){
-                std::cout << pair.first << " -> " << (uint64_t) pair.second << std::endl;
-            }*/
-
-            typedef std::vector<typename ltj_algorithm::tuple_type> results_type;
-            results_type res;
-
-            start = high_resolution_clock::now();
-            ltj_algorithm ltj(&query, &graph, hash_table_vars.size());
-            ltj.join(res, 0, 600);
-            stop = high_resolution_clock::now();
-
-            auto total_time = duration_cast<nanoseconds>(stop - start).count();
-
-            std::unordered_map<uint8_t, std::string> ht;
-            for(const auto &p : hash_table_vars){
-                ht.insert({p.second, p.first});
+        }else{
+            //The index is read-only, each worker builds its own ltj_algorithm and result buffer
+            std::vector<std::pair<uint64_t, uint64_t>> stats(parsed.size());
+            ring_ltj::parallel::for_each(parsed.size(), opts.threads, [&](uint64_t i, uint64_t t){
+                if(parsed[i].correct){
+                    reload_knn(graph, opts, cache.get());
+                    stats[i] = run_query<ltj_algorithm>(parsed[i], graph, opts,
+                                                        opts.prepared ? &prepared[t] : nullptr, cache.get());
+                }
+            });
+            //Report in input order
+            uint64_t nQ = 0;
+            for(uint64_t i = 0; i < parsed.size(); ++i){
+                if(!parsed[i].correct) {
+                    std::cout << "Incorrect query" << std::endl;
+                    continue;
+                }
+                cout << nQ <<  ";" << stats[i].first << ";" << stats[i].second << endl;
+                nQ++;
             }
-
-            //cout << "Query Details:" << endl;
-
-
-
-
-            cout << nQ <<  ";" << res.size() << ";" << total_time << endl;
-
-            //cout << "##########" << endl;
-            //ltj.print_query(ht);
-            //ltj.print_results(res, ht);
-            //cout << "##########" << endl;
-
-            nQ++;
-
-            // cout << std::chrono::duration_cast<std::chrono::nanoseconds> (end - begin).count() << std::endl;
-
-            //cout << "RESULTS QUERY " << count << ": " << number_of_results << endl;
-            count += 1;
         }
-
-        //graph.print_knngraph();
+        if(cache){
+            //Standard error, so the output of the queries keeps its format
+            cerr << "Cache: " << cache->hits() << " hits, " << cache->misses() << " misses, "
+                 << cache->evictions() << " evictions, " << cache->entries() << " entries ("
+                 << cache->size_in_bytes() << " bytes)" << endl;
+        }
+        if(graph.get_knn_cache() != nullptr){
+            const auto* knn_cache = graph.get_knn_cache();
+            cerr << "KNN cache: " << knn_cache->hits() << " hits, " << knn_cache->misses() << " misses ("
+                 << knn_cache->hit_rate() * 100 << "%), " << knn_cache->evictions() << " evictions, "
+                 << knn_cache->entries() << " lists (" << knn_cache->size_in_bytes() << " bytes)" << endl;
+        }
     }
 }
 
+template<class ring_type, class trait_type>
+void query_dispatch(const std::string &index, const std::string &queries, const query_options &opts){
+    typedef ring_ltj::gao::gao_adaptive_sim_v3<ring_type, uint8_t, uint64_t, trait_type> gao_type;
+    typedef ring_ltj::ltj_algorithm_similarity<ring_type, uint8_t, uint64_t, gao_type> ltj_algorithm_type;
+    query<ring_type, ltj_algorithm_type>(index, queries, opts);
+}
+
+template<class ring_type>
+void query_ring(const std::string &index, const std::string &queries, const query_options &opts){
+    if(opts.distinct){
+        query_dispatch<ring_type, ring_ltj::utils::trait_distinct>(index, queries, opts);
+    }else{
+        query_dispatch<ring_type, ring_ltj::utils::trait_size>(index, queries, opts);
+    }
+}
 
 int main(int argc, char* argv[])
 {
 
     //typedef ring::c_ring ring_type;
-    if(argc != 3){
-        std::cout << "Usage: " << argv[0] << " <index> <queries>" << std::endl;
+    if(argc < 3){
+        std::cout << "Usage: " << argv[0] << " <index> <queries> [--threads N] [--join-threads N] [--count] [--distinct] [--prepared] [--cache MB] [--page N] [--max-results-mb MB] [--knn-cache MB] [--knn FILE]" << std::endl;
         return 0;
     }
 
     std::string index = argv[1];
     std::string queries = argv[2];
+    query_options opts;
+    for(int i = 3; i < argc; ++i){
+        std::string opt = argv[i];
+        if(opt == "--threads" && i+1 < argc){
+            opts.threads = std::stoull(argv[++i]);
+        }else if(opt == "--join-threads" && i+1 < argc){
+            opts.join_threads = std::stoull(argv[++i]);
+        }else if(opt == "--count"){
+            opts.count = true;
+        }else if(opt == "--distinct"){
+            opts.distinct = true;
+        }else if(opt == "--prepared"){
+            opts.prepared = true;
+        }else if(opt == "--cache" && i+1 < argc){
+            opts.cache_mb = std::stoull(argv[++i]);
+        }else if(opt == "--page" && i+1 < argc){
+            opts.page = std::stoull(argv[++i]);
+        }else if(opt == "--max-results-mb" && i+1 < argc){
+            opts.max_results_mb = std::stoull(argv[++i]);
+        }else if(opt == "--knn-cache" && i+1 < argc){
+            opts.knn_cache_mb = std::stoull(argv[++i]);
+        }else if(opt == "--knn" && i+1 < argc){
+            opts.knn_file = argv[++i];
+        }else{
+            std::cout << "Unknown option: " << opt << std::endl;
+            std::cout << "Usage: " << argv[0] << " <index> <queries> [--threads N] [--join-threads N] [--count] [--distinct] [--prepared] [--cache MB] [--page N] [--max-results-mb MB] [--knn-cache MB] [--knn FILE]" << std::endl;
+            return 0;
+        }
+    }
     std::string type = get_type(index);
+    cancel_flag = cancel_queries.flag();
+    std::signal(SIGINT, on_interrupt);
+    std::signal(SIGHUP, on_hangup);
 
     if(type == "ring-knn"){
-        typedef ring_ltj::ring_similarity<> ring_type;
-        typedef ring_ltj::ltj_algorithm_similarity<ring_type, uint8_t, uint64_t> ltj_algorithm_type;
-        query<ring_type, ltj_algorithm_type>(index, queries);
+        query_ring<ring_ltj::ring_similarity<>>(index, queries, opts);
     }else if (type == "c-ring-knn"){
-        typedef ring_ltj::c_ring_similarity ring_type;
-        typedef ring_ltj::ltj_algorithm_similarity<ring_type, uint8_t, uint64_t> ltj_algorithm_type;
-        query<ring_type, ltj_algorithm_type>(index, queries);
+        query_ring<ring_ltj::c_ring_similarity>(index, queries, opts);
     }else if (type == "ring-sel-knn") {
-        typedef ring_ltj::ring_sel_similarity ring_type;
-        typedef ring_ltj::ltj_algorithm_similarity<ring_type, uint8_t, uint64_t> ltj_algorithm_type;
-        query<ring_type, ltj_algorithm_type>(index, queries);
+        query_ring<ring_ltj::ring_sel_similarity>(index, queries, opts);
     }else{
         std::cout << "Type of index: " << type << " is not supported." << std::endl;
     }
@@ -0,0 +1,215 @@
+/*
+ * update-index.cpp
+ * Copyright (C) 2020 Author removed for double-blind evaluation
+ *
+ *
+ * This is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This software is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ * See the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <set>
+#include <vector>
+#include "ring_dynamic.hpp"
+#include "ltj_iterator_delta.hpp"
+
+using namespace std;
+
+using namespace std::chrono;
+using timer = std::chrono::high_resolution_clock;
+
+//Inserts and deletes triples of an index (see ring_dynamic). Each line of the updates is "+ s p o" or "- s p o".
+
+struct update_options {
+    uint64_t threshold = 1 << 16; //Updates that start a merge in the background
+    uint64_t threads = 1; //Threads used by the merges
+    uint64_t batch = 1024; //Consecutive updates of the same kind applied at once
+    bool check = false; //Compares the triples of the index with the expected ones after every batch
+    std::string output; //File of the updated index (the input index if it is empty)
+};
+
+typedef ring_ltj::delta_store::triple_type triple_type;
+
+//Triples of the index plus its delta, sorted in SPO
+template<class ring>
+std::vector<triple_type> triples(const std::shared_ptr<ring> &r){
+    std::vector<triple_type> res;
+    ring_ltj::triple_pattern tp;
+    tp.var_s(0);
+    tp.var_p(1);
+    tp.var_o(2);
+    ring_ltj::ltj_iterator_delta<ring, uint8_t, uint64_t> it(&tp, r.get(), r->delta());
+    if(it.is_empty()) return res;
+    for(uint64_t s = it.leap(0); s != 0; s = it.leap(0, s + 1)){
+        it.down(0, s);
+        for(uint64_t p = it.leap(1); p != 0; p = it.leap(1, p + 1)){
+            it.down(1, p);
+            for(uint64_t o = it.leap(2); o != 0; o = it.leap(2, o + 1)){
+                res.push_back(triple_type{{s, p, o}});
+            }
+            it.up(1);
+        }
+        it.up(0);
+    }
+    return res;
+}
+
+template<class ring>
+bool check(const std::shared_ptr<ring> &r, const std::set<triple_type> &expected, const std::string &when){
+    auto found = triples(r);
+    if(found.size() == expected.size() && std::equal(found.begin(), found.end(), expected.begin())){
+        return true;
+    }
+    cout << "Check failed " << when << ": " << found.size() << " triples instead of " << expected.size() << endl;
+    return false;
+}
+
+template<class ring>
+int update(const std::string &index, const std::string &updates, const update_options &opts){
+    typedef ring_ltj::ring_dynamic<ring> ring_dynamic_type;
+
+    std::shared_ptr<ring> A = std::make_shared<ring>();
+    cout << "--Loading " << index << endl;
+    if(!sdsl::load_from_file(*A, index)){
+        cout << "Cannot read the index " << index << endl;
+        return 1;
+    }
+    std::ifstream in(updates);
+    if(!in){
+        cout << "Cannot read the updates " << updates << endl;
+        return 1;
+    }
+
+    std::set<triple_type> expected;
+    if(opts.check){
+        auto t = triples(A);
+        expected.insert(t.begin(), t.end());
+    }
+
+    uint64_t n_inserts = 0, n_deletes = 0, skipped = 0, lines = 0;
+    bool ok = true;
+    auto start = timer::now();
+    {
+        ring_dynamic_type D(A, opts.threshold, opts.threads);
+        A.reset();
+        std::vector<triple_type> batch;
+        char kind = '+';
+        auto flush = [&](){
+            if(batch.empty()) return;
+            if(kind == '+'){
+                skipped += D.apply(batch, std::vector<triple_type>());
+                n_inserts += batch.size();
+                if(opts.check) expected.insert(batch.begin(), batch.end());
+            }else{
+                skipped += D.apply(std::vector<triple_type>(), batch);
+                n_deletes += batch.size();
+                if(opts.check) for(const auto &t : batch) expected.erase(t);
+            }
+            batch.clear();
+            //A merge may be running in the background
+            if(opts.check && ok) ok = check(D.ring(), expected, "after line " + std::to_string(lines));
+        };
+
+        std::string line;
+        while(getline(in, line)){
+            ++lines;
+            std::stringstream ss(line);
+            char k;
+            triple_type t{{0, 0, 0}};
+            if(!(ss >> k >> t[0] >> t[1] >> t[2]) || (k != '+' && k != '-')){
+                if(!line.empty()) cout << "Ignoring line " << lines << ": " << line << endl;
+                continue;
+            }
+            if(k != kind || batch.size() >= opts.batch){
+                flush();
+                kind = k;
+            }
+            //0 is not an identifier, ring_dynamic would skip the triple
+            if(t[0] == 0 || t[1] == 0 || t[2] == 0){
+                ++skipped;
+                continue;
+            }
+            batch.push_back(t);
+        }
+        flush();
+
+        //The delta is not stored with the index
+        if(D.pending() > 0 && !D.merge()){
+            cout << "Cannot merge the updates, no triple would be left" << endl;
+            return 1;
+        }
+        if(opts.check && ok) ok = check(D.ring(), expected, "after the last merge");
+        auto stop = timer::now();
+
+        std::string output = opts.output.empty() ? index : opts.output;
+        if(!sdsl::store_to_file(*D.ring(), output)){
+            cout << "Cannot write " << output << endl;
+            return 1;
+        }
+        cout << "Index saved in " << output << endl;
+        cout << n_inserts << " insertions, " << n_deletes << " deletions, " << skipped << " skipped, "
+             << D.merges() << " merges." << endl;
+        cout << duration_cast<seconds>(stop-start).count() << " seconds." << endl;
+    }
+    if(opts.check){
+        cout << (ok ? "Check passed." : "Check failed.") << endl;
+    }
+    return ok ? 0 : 1;
+}
+
+std::string get_type(const std::string &file){
+    auto p = file.find_last_of('.');
+    return file.substr(p+1);
+}
+
+int main(int argc, char **argv)
+{
+
+    if(argc < 3){
+        std::cout << "Usage: " << argv[0] << " <index> <updates> [--threshold N] [--threads N] [--check] [--output file]" << std::endl;
+        return 0;
+    }
+
+    std::string index   = argv[1];
+    std::string updates = argv[2];
+    update_options opts;
+    for(int i = 3; i < argc; ++i){
+        std::string opt = argv[i];
+        if(opt == "--threshold" && i+1 < argc){
+            opts.threshold = std::stoull(argv[++i]);
+        }else if(opt == "--threads" && i+1 < argc){
+            opts.threads = std::stoull(argv[++i]);
+        }else if(opt == "--check"){
+            opts.check = true;
+        }else if(opt == "--output" && i+1 < argc){
+            opts.output = argv[++i];
+        }else{
+            std::cout << "Unknown option: " << opt << std::endl;
+            std::cout << "Usage: " << argv[0] << " <index> <updates> [--threshold N] [--threads N] [--check] [--output file]" << std::endl;
+            return 0;
+        }
+    }
+    std::string type = get_type(index);
+    if(type == "ring" || type == "ring-knn"){
+        return update<ring_ltj::ring_similarity<>>(index, updates, opts);
+    }else if (type == "c-ring" || type == "c-ring-knn"){
+        return update<ring_ltj::c_ring_similarity>(index, updates, opts);
+    }else if (type == "ring-sel" || type == "ring-sel-knn") {
+        return update<ring_ltj::ring_sel_similarity>(index, updates, opts);
+    }
+    std::cout << "Type of index: " << type << " is not supported (ring|c-ring|ring-sel)." << std::endl;
+    return 0;
+}